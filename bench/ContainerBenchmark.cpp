@@ -0,0 +1,286 @@
+/**
+ * @brief Muxing throughput of a container, without encoding.
+ *
+ *    Synthetic Opus packets of varying sizes, frame durations and channel
+ *    counts are written to each container, and the output only counted. It reports, per scenario:
+ *
+ *      frames/s    Frames written per second of wall time
+ *      ns/frame    Time of a writeFrame() call, finalization included
+ *      B/s audio   Output bytes per second of audio
+ *      overhead    Output bytes that are not packet data, in percent
+ *      allocs/1k   Heap allocations per 1000 frames
+ *
+ *    It then checks that a seekable WebM whose output is taken while it is
+ *    written, as the worker does on every timeslice, still gets its Duration
+ *    and Cues, and fails if not.
+ *
+ *    See "make bench".
+ */
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <vector>
+#include "ContainerInterface.hpp"
+#include "WebMContainer.hpp"
+#include "lib/webm/mkvparser/mkvparser.h"
+
+namespace {
+  uint64_t allocation_count = 0;
+}
+
+#ifdef BENCHMARK_WRAP_MALLOC
+// Linked with -Wl,--wrap=malloc,... so the C libraries are counted too.
+extern "C" {
+  void *__real_malloc(std::size_t size);
+  void *__real_calloc(std::size_t count, std::size_t size);
+  void *__real_realloc(void *pointer, std::size_t size);
+
+  void *__wrap_malloc(std::size_t size)
+  {
+    allocation_count++;
+    return __real_malloc(size);
+  }
+
+  void *__wrap_calloc(std::size_t count, std::size_t size)
+  {
+    allocation_count++;
+    return __real_calloc(count, size);
+  }
+
+  void *__wrap_realloc(void *pointer, std::size_t size)
+  {
+    allocation_count++;
+    return __real_realloc(pointer, size);
+  }
+}
+#define BENCHMARK_MALLOC __real_malloc
+#else
+#define BENCHMARK_MALLOC std::malloc
+#endif
+
+void *operator new(std::size_t size)
+{
+  allocation_count++;
+  void *pointer = BENCHMARK_MALLOC(size ? size : 1);
+  if (!pointer) {
+    std::abort();
+  }
+  return pointer;
+}
+
+void operator delete(void *pointer) noexcept
+{
+  std::free(pointer);
+}
+
+void operator delete(void *pointer, std::size_t) noexcept
+{
+  std::free(pointer);
+}
+
+namespace {
+  // Seconds of audio muxed per scenario
+  const uint32_t kAudioSeconds = 600;
+  const uint32_t kSamplesPerMs = 48;
+  // The largest packet Opus produces is 1275 bytes per 20 ms, 3 frames at most
+  const std::size_t kMaxPacketSize = 3 * 1275;
+
+  struct Scenario {
+    ContainerInterface::Format format;
+    uint8_t channel_count;
+    uint32_t frame_samples;   // 120 = 2.5 ms ... 2880 = 60 ms
+    uint32_t bitrate;
+  };
+
+  /**
+   * @brief Discards the output, only counting it.
+   */
+  class CountingOutputSink
+    : public OutputSink
+  {
+  public:
+    CountingOutputSink() : bytes_(0) {}
+    void write(const void *data, std::size_t size) override { bytes_ += size; }
+    uint64_t bytes() const { return bytes_; }
+
+  private:
+    uint64_t bytes_;
+  };
+
+  const char *formatName(ContainerInterface::Format format)
+  {
+    return format == ContainerInterface::FORMAT_OGG ? "Ogg" : "WebM";
+  }
+
+  // xorshift32, so every run writes the same packets
+  uint32_t nextRandom(uint32_t &state)
+  {
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+  }
+
+  void run(const Scenario &scenario)
+  {
+    uint32_t random_state = 0x12345678;
+    uint32_t frame_count = kAudioSeconds * 1000 * kSamplesPerMs / scenario.frame_samples;
+    std::size_t average_size = (uint64_t)scenario.bitrate * scenario.frame_samples
+                                 / (8 * 1000 * kSamplesPerMs);
+
+    // Packets are made up front so only the container is measured.
+    std::vector<uint8_t> packets(kMaxPacketSize * 64);
+    for (std::size_t i = 0; i < packets.size(); i++) {
+      packets[i] = nextRandom(random_state);
+    }
+    std::vector<std::size_t> sizes(1024);
+    for (std::size_t i = 0; i < sizes.size(); i++) {
+      // 50% to 150% of the average, like VBR
+      std::size_t size = average_size / 2 + nextRandom(random_state) % (average_size + 1);
+      sizes[i] = std::max<std::size_t>(3, std::min(size, kMaxPacketSize));
+    }
+
+    CountingOutputSink sink;
+    uint64_t payload = 0;
+    uint64_t allocations_before = allocation_count;
+    auto start = std::chrono::steady_clock::now();
+    {
+      std::unique_ptr<ContainerInterface> container(
+        ContainerInterface::create(scenario.format));
+      container->setOutputSink(&sink);
+      container->init(48000, scenario.channel_count, 1);
+      for (uint32_t i = 0; i < frame_count; i++) {
+        std::size_t size = sizes[i % sizes.size()];
+        uint8_t *packet = &packets[(i % 64) * kMaxPacketSize];
+        container->writeFrame(packet, size, scenario.frame_samples);
+        payload += size;
+      }
+    }
+    auto end = std::chrono::steady_clock::now();
+    uint64_t allocations = allocation_count - allocations_before;
+
+    double seconds = std::chrono::duration<double>(end - start).count();
+    printf("%-5s %2u ch %5.1f ms %4u kbps | %10.0f frames/s %8.1f ns/frame"
+           " | %8.0f B/s audio %6.2f %% overhead | %8.2f allocs/1k\n",
+           formatName(scenario.format), scenario.channel_count,
+           scenario.frame_samples / (double)kSamplesPerMs,
+           scenario.bitrate / 1000,
+           frame_count / seconds,
+           seconds * 1e9 / frame_count,
+           sink.bytes() / (double)kAudioSeconds,
+           100.0 * (sink.bytes() - payload) / sink.bytes(),
+           allocations * 1000.0 / frame_count);
+  }
+}
+
+namespace {
+  // Seconds of audio of the seekable WebM check
+  const uint32_t kCheckSeconds = 10;
+  // Output taken every 50 frames of 20 ms, i.e. a 1 second timeslice
+  const uint32_t kCheckTimesliceFrames = 50;
+
+  /**
+   * @brief An IMkvReader over a file in memory.
+   */
+  class MemoryMkvReader
+    : public mkvparser::IMkvReader
+  {
+  public:
+    explicit MemoryMkvReader(const std::vector<uint8_t> &data) : data_(data) {}
+
+    int Read(long long position, long length, unsigned char *buffer) override
+    {
+      if (position < 0 || length < 0
+          || (unsigned long long)position + length > data_.size()) {
+        return -1;
+      }
+      std::copy(data_.begin() + position, data_.begin() + position + length, buffer);
+      return 0;
+    }
+
+    int Length(long long *total, long long *available) override
+    {
+      *total = *available = data_.size();
+      return 0;
+    }
+
+  private:
+    const std::vector<uint8_t> &data_;
+  };
+
+  bool checkSeekableWebM()
+  {
+    MemoryOutputSink sink;
+    sink.setSeekable(false);
+    std::vector<uint8_t> file;
+    std::vector<uint8_t> packet(160, 0);
+    uint32_t frame_count = kCheckSeconds * 50;
+    {
+      WebMContainer container;
+      container.setSeekable(true);
+      container.setOutputSink(&sink);
+      container.init(48000, 1, 1);
+      for (uint32_t i = 0; i < frame_count; i++) {
+        container.writeFrame(packet.data(), packet.size(), 960);
+        if (i % kCheckTimesliceFrames == 0) {
+          file.insert(file.end(), sink.data(), sink.data() + sink.size());
+          sink.clear();
+        }
+      }
+    }
+    file.insert(file.end(), sink.data(), sink.data() + sink.size());
+
+    MemoryMkvReader reader(file);
+    long long position = 0;
+    mkvparser::EBMLHeader ebml_header;
+    mkvparser::Segment *segment = nullptr;
+    if (ebml_header.Parse(&reader, position) != 0
+        || mkvparser::Segment::CreateInstance(&reader, position, segment) != 0) {
+      printf("Seekable WebM with a timeslice: not a WebM file\n");
+      return false;
+    }
+    std::unique_ptr<mkvparser::Segment> segment_owner(segment);
+    if (segment->Load() < 0) {
+      printf("Seekable WebM with a timeslice: corrupt segment\n");
+      return false;
+    }
+    // In nanoseconds. mkvmuxer ends it at the start of the last block, so it
+    // may be short by a frame.
+    long long duration = segment->GetInfo()->GetDuration();
+    long long expected = kCheckSeconds * 1000000000ll;
+    long long frame = 20000000;
+    const mkvparser::Cues *cues = segment->GetCues();
+    if (cues) {
+      while (!cues->DoneParsing()) {
+        cues->LoadCuePoint();
+      }
+    }
+    bool ok = duration >= expected - frame && duration <= expected
+              && cues && cues->GetCount() > 0;
+    printf("Seekable WebM with a timeslice: Duration %.3f s, %ld cue points: %s\n",
+           duration / 1e9, cues ? cues->GetCount() : 0, ok ? "OK" : "FAILED");
+    return ok;
+  }
+}
+
+int main(int argc, char *argv[])
+{
+  const uint8_t channel_counts[] = {1, 2, 6};
+  const uint32_t frame_samples[] = {120, 480, 960, 2880};
+  const uint32_t bitrates[] = {32000, 128000};
+
+  for (auto format : {ContainerInterface::FORMAT_OGG, ContainerInterface::FORMAT_WEBM}) {
+    for (uint8_t channel_count : channel_counts) {
+      for (uint32_t samples : frame_samples) {
+        for (uint32_t bitrate : bitrates) {
+          run(Scenario{format, channel_count, samples,
+                       bitrate * (channel_count > 2 ? 3 : 1)});
+        }
+      }
+    }
+  }
+  return checkSeekableWebM() ? 0 : 1;
+}
@@ -0,0 +1,143 @@
+/**
+ * @brief Encoding throughput of EncoderEngine with many concurrent sessions.
+ *
+ *    Every session encodes the same seconds of synthetic stereo audio into
+ *    its own container, at 48 kHz, which is encoded as it is, and at
+ *    44.1 kHz, which is resampled too. The input is
+ *    fed from one thread per session, like uploads arriving on their own
+ *    connections. It reports, per scenario:
+ *
+ *      audio s/s   Seconds of audio encoded per second of wall time, in total
+ *      per core    The same divided by the number of threads
+ *      ms/session  Wall time divided by the number of sessions
+ *
+ *    See "make bench-engine".
+ */
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <vector>
+#include "ContainerInterface.hpp"
+#include "EncoderEngine.hpp"
+
+namespace {
+  // Seconds of audio encoded by each session
+  const uint32_t kAudioSeconds = 10;
+  const uint8_t kChannelCount = 2;
+  const int kBitrate = 128000;
+
+  /**
+   * @brief Discards the output, only counting it.
+   */
+  class CountingOutputSink
+    : public OutputSink
+  {
+  public:
+    CountingOutputSink() : bytes_(0) {}
+    void write(const void *data, std::size_t size) override { bytes_ += size; }
+    uint64_t bytes() const { return bytes_; }
+
+  private:
+    uint64_t bytes_;
+  };
+
+  void feed(EncoderEngine &engine, int session, const std::vector<float> &signal)
+  {
+    uint32_t max_length = engine.getMaxInputLength();
+    for (std::size_t offset = 0; offset < signal.size(); offset += max_length) {
+      uint32_t length = std::min<std::size_t>(max_length, signal.size() - offset);
+      for (uint8_t ch = 0; ch < kChannelCount; ch++) {
+        float *input = engine.getInputBuffer(session, ch);
+        for (uint32_t i = 0; i < length; i++) {
+          input[i] = signal[offset + i] * (ch + 1) * 0.5f;
+        }
+      }
+      engine.submit(session, length);
+    }
+  }
+
+  void run(ContainerInterface::Format format, uint32_t sample_rate,
+           unsigned thread_count, unsigned session_count,
+           const std::vector<float> &signal)
+  {
+    std::vector<std::unique_ptr<CountingOutputSink>> sinks;
+    std::vector<std::unique_ptr<ContainerInterface>> containers;
+    std::vector<int> sessions;
+    std::vector<std::thread> producers;
+    int errors = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    {
+      EncoderEngine engine(thread_count);
+      for (unsigned i = 0; i < session_count; i++) {
+        sinks.emplace_back(new CountingOutputSink());
+        containers.emplace_back(ContainerInterface::create(format));
+        containers[i]->setOutputSink(sinks[i].get());
+        sessions.push_back(engine.openSession(containers[i].get(), sample_rate,
+                                              kChannelCount, kBitrate, i + 1));
+      }
+      for (unsigned i = 0; i < session_count; i++) {
+        producers.emplace_back(feed, std::ref(engine), sessions[i], std::cref(signal));
+      }
+      for (auto &producer : producers) {
+        producer.join();
+      }
+      for (unsigned i = 0; i < session_count; i++) {
+        errors += engine.closeSession(sessions[i]) != EncoderEngine::OK;
+      }
+      containers.clear();
+      thread_count = engine.getThreadCount();
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    double seconds = std::chrono::duration<double>(end - start).count();
+    double audio_per_second = (double)kAudioSeconds * session_count / seconds;
+    printf("%-5s %5u Hz %2u threads %4u sessions | %8.1f audio s/s %7.1f per core"
+           " | %8.2f ms/session | %d errors\n",
+           format == ContainerInterface::FORMAT_OGG ? "Ogg" : "WebM",
+           sample_rate, thread_count, session_count,
+           audio_per_second, audio_per_second / thread_count,
+           seconds * 1000 / session_count, errors);
+  }
+
+  // A sweep with some noise, so the encoder has to work on every frame
+  std::vector<float> makeSignal(uint32_t sample_rate)
+  {
+    std::vector<float> signal(kAudioSeconds * sample_rate);
+    uint32_t random_state = 0x12345678;
+    for (std::size_t i = 0; i < signal.size(); i++) {
+      random_state ^= random_state << 13;
+      random_state ^= random_state >> 17;
+      random_state ^= random_state << 5;
+      double t = (double)i / sample_rate;
+      signal[i] = 0.5f * std::sin(2 * M_PI * (200 + 100 * t) * t)
+                  + 0.05f * ((random_state & 0xFFFF) / 32768.0f - 1.0f);
+    }
+    return signal;
+  }
+}
+
+int main(int argc, char *argv[])
+{
+  unsigned cores = std::thread::hardware_concurrency();
+  const unsigned session_counts[] = {1, 16, 64, 256};
+  for (auto format : {ContainerInterface::FORMAT_OGG, ContainerInterface::FORMAT_WEBM}) {
+    for (uint32_t sample_rate : {48000u, 44100u}) {
+      std::vector<float> signal = makeSignal(sample_rate);
+      for (unsigned threads : {1u, cores}) {
+        for (unsigned sessions : session_counts) {
+          run(format, sample_rate, threads, sessions, signal);
+        }
+        if (cores <= 1) {
+          break;
+        }
+      }
+    }
+  }
+  return 0;
+}
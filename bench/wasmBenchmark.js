@@ -0,0 +1,100 @@
+/**
+ * The same scenarios as ContainerBenchmark.cpp, run with the built
+ * OggOpusEncoder.wasm and WebMOpusEncoder.wasm under Node, to compare WASM
+ * with native. Allocations are not counted here.
+ *
+ * Usage: node bench/wasmBenchmark.js [build directory]
+ */
+const path = require('path');
+
+const BUILD_DIR = path.resolve(process.argv[2] || path.join(__dirname, '..', 'build'));
+const FORMATS = ['Ogg', 'WebM'];
+
+// Seconds of audio muxed per scenario
+const AUDIO_SECONDS = 600;
+const SAMPLES_PER_MS = 48;
+// The largest packet Opus produces is 1275 bytes per 20 ms, 3 frames at most
+const MAX_PACKET_SIZE = 3 * 1275;
+// Read the output arena every so often, like the worker does.
+const FLUSH_INTERVAL_FRAMES = 50;
+
+// xorshift32, so every run writes the same packets as the native benchmark
+function nextRandom (state) {
+  state.value ^= state.value << 13;
+  state.value ^= state.value >>> 17;
+  state.value ^= state.value << 5;
+  state.value >>>= 0;
+  return state.value;
+}
+
+function run (Module, format, channelCount, frameSamples, bitrate) {
+  const randomState = { value: 0x12345678 };
+  const frameCount = Math.floor(AUDIO_SECONDS * 1000 * SAMPLES_PER_MS / frameSamples);
+  const averageSize = Math.floor(bitrate * frameSamples / (8 * 1000 * SAMPLES_PER_MS));
+
+  // Packets are made up front in the heap so only the container is measured.
+  const packets = Module._malloc(MAX_PACKET_SIZE * 64);
+  for (let i = 0; i < MAX_PACKET_SIZE * 64; i++) {
+    Module.HEAPU8[packets + i] = nextRandom(randomState) & 0xFF;
+  }
+  const sizes = new Array(1024);
+  for (let i = 0; i < sizes.length; i++) {
+    // 50% to 150% of the average, like VBR
+    const size = Math.floor(averageSize / 2) + nextRandom(randomState) % (averageSize + 1);
+    sizes[i] = Math.max(3, Math.min(size, MAX_PACKET_SIZE));
+  }
+
+  const output = new Module.MemoryOutputSink();
+  let outputBytes = 0;
+  let payload = 0;
+  const start = process.hrtime.bigint();
+  const container = new Module[`${format}Container`]();
+  container.setOutputSink(output);
+  container.init(48000, channelCount, 1);
+  for (let i = 0; i < frameCount; i++) {
+    const size = sizes[i % sizes.length];
+    container.writeFrame(packets + (i % 64) * MAX_PACKET_SIZE, size, frameSamples);
+    payload += size;
+    if (i % FLUSH_INTERVAL_FRAMES === 0) {
+      outputBytes += output.size();
+      output.clear();
+    }
+  }
+  Module.destroy(container);
+  outputBytes += output.size();
+  const end = process.hrtime.bigint();
+  Module.destroy(output);
+  Module._free(packets);
+
+  const seconds = Number(end - start) / 1e9;
+  console.log(`${format.padEnd(5)} ${String(channelCount).padStart(2)} ch ` +
+              `${(frameSamples / SAMPLES_PER_MS).toFixed(1).padStart(5)} ms ` +
+              `${String(bitrate / 1000).padStart(4)} kbps | ` +
+              `${(frameCount / seconds).toFixed(0).padStart(10)} frames/s ` +
+              `${(seconds * 1e9 / frameCount).toFixed(1).padStart(8)} ns/frame | ` +
+              `${(outputBytes / AUDIO_SECONDS).toFixed(0).padStart(8)} B/s audio ` +
+              `${(100 * (outputBytes - payload) / outputBytes).toFixed(2).padStart(6)} % overhead`);
+}
+
+async function main () {
+  for (const format of FORMATS) {
+    const factory = require(path.join(BUILD_DIR, `${format}OpusEncoder.js`));
+    const Module = await new Promise(resolve => {
+      // The object returned by the factory is thenable, but not a Promise.
+      factory().then(module => {
+        delete module.then;
+        resolve(module);
+      });
+    });
+    for (const channelCount of [1, 2, 6]) {
+      for (const frameSamples of [120, 480, 960, 2880]) {
+        for (const bitrate of [32000, 128000]) {
+          run(Module, format, channelCount, frameSamples,
+              bitrate * (channelCount > 2 ? 3 : 1));
+        }
+      }
+    }
+  }
+}
+
+main();
@@ -55,7 +55,8 @@ import WebMOpusWasm from 'opus-media-recorder/WebMOpusEncoder.wasm';`,
         PRE_EXAMPLE: '',
         WORKER_OPTIONS: `{
   OggOpusEncoderWasmPath: '${BASE_URL}/OggOpusEncoder.wasm',
-  WebMOpusEncoderWasmPath: '${BASE_URL}/WebMOpusEncoder.wasm'
+  WebMOpusEncoderWasmPath: '${BASE_URL}/WebMOpusEncoder.wasm',
+  WaveEncoderWasmPath: '${BASE_URL}/WaveEncoder.wasm'
 }`,
         POST_HTML:
 `<script type="text/javascript" src="${BASE_URL}/OpusMediaRecorder.umd.js"></script>
@@ -0,0 +1,60 @@
+#include "ComplexityGovernor.hpp"
+#include <algorithm>
+
+namespace {
+  // Samples per millisecond at 48 kHz
+  const uint32_t kSamplesPerMs = 48;
+  const int kMinComplexity = 0;
+  // Length of the moving average of the load, in ms of audio
+  const uint32_t kWindowMs = 500;
+  // Audio encoded after a change before the next one, in ms
+  const uint32_t kDownHoldMs = 500;
+  const uint32_t kUpHoldMs = 5000;
+  // Fractions of real time spent encoding
+  const double kHighLoad = 0.5;
+  const double kLowLoad = 0.2;
+}
+
+ComplexityGovernor::ComplexityGovernor()
+{
+  reset(10);
+}
+
+void ComplexityGovernor::reset(int max_complexity)
+{
+  max_complexity_ = max_complexity;
+  complexity_ = max_complexity;
+  load_ = 0.0;
+  since_change_ = 0;
+}
+
+bool ComplexityGovernor::update(double encode_time, uint32_t frame_samples)
+{
+  double duration = frame_samples * 1000.0 / kSamplesPerMs;  // In microseconds
+  // A moving average over the window whatever the frame size is
+  double weight = std::min(1.0, (double)frame_samples / (kWindowMs * kSamplesPerMs));
+  load_ += (encode_time / duration - load_) * weight;
+  since_change_ += frame_samples;
+
+  if (load_ > kHighLoad && complexity_ > kMinComplexity
+      && since_change_ >= kDownHoldMs * kSamplesPerMs) {
+    complexity_--;
+  } else if (load_ < kLowLoad && complexity_ < max_complexity_
+             && since_change_ >= kUpHoldMs * kSamplesPerMs) {
+    complexity_++;
+  } else {
+    return false;
+  }
+  since_change_ = 0;
+  return true;
+}
+
+int ComplexityGovernor::getComplexity() const
+{
+  return complexity_;
+}
+
+double ComplexityGovernor::getLoad() const
+{
+  return load_;
+}
@@ -0,0 +1,53 @@
+#ifndef COMPLEXITYGOVERNOR_H_
+#define COMPLEXITYGOVERNOR_H_
+
+#include <cstdint>
+
+/**
+ * @brief Picks the Opus complexity from how long frames take to encode.
+ *
+ *    The load is the encode time of a frame over its duration, smoothed over
+ *    about half a second of audio. Above 50% the device is close to falling
+ *    behind real time, as the worker has more to do than encoding, and the
+ *    complexity goes down one step. Below 20% it goes back up one step, at
+ *    most to the complexity set by the user. After a change the load of the
+ *    new complexity is measured for a while before the next one, so it does
+ *    not oscillate: half a second before going down again, 5 seconds before
+ *    going up.
+ *
+ * ## How to use
+ *
+ *    1. reset() with the complexity the user asked for.
+ *    2. After each frame, call update(). When it returns true, give
+ *       getComplexity() to the encoder.
+ */
+class ComplexityGovernor
+{
+public:
+  ComplexityGovernor();
+
+  /**
+   * @brief Start over from a complexity, which is also the highest one used.
+   */
+  void reset(int max_complexity);
+
+  /**
+   * @brief Account for one encoded frame.
+   *
+   * @param encode_time     Time taken to encode the frame, in microseconds
+   * @param frame_samples   Duration of the frame in samples at 48 kHz
+   * @return bool           The complexity has changed
+   */
+  bool update(double encode_time, uint32_t frame_samples);
+
+  int getComplexity() const;
+  double getLoad() const;
+
+private:
+  int max_complexity_;
+  int complexity_;
+  double load_;
+  uint64_t since_change_;   // Samples encoded since the last change
+};
+
+#endif /* COMPLEXITYGOVERNOR_H_ */
@@ -0,0 +1,166 @@
+#include "ContainerArena.hpp"
+#include <cassert>
+#include <cstdlib>
+
+namespace {
+  // Block sizes are kMinBlockSize << class, header included.
+  const std::size_t kMinBlockSize = 32;
+  const int kClassCount = 12;   // Up to 64 KiB
+  // In front of every block, so release() knows where it came from. Its size
+  // keeps the pointers handed out as aligned as those of malloc.
+  const std::size_t kHeaderSize = 16;
+
+  int sizeClass(std::size_t size)
+  {
+    for (int i = 0; i < kClassCount; i++) {
+      if (size <= kMinBlockSize << i) {
+        return i;
+      }
+    }
+    return -1;
+  }
+
+  const ContainerMemoryStats kNoStats = {0, 0, 0, 0};
+}
+
+struct ContainerArena::Pool {
+  uint8_t *memory;
+  std::size_t capacity;
+  std::size_t carved;             // Bytes of memory made into blocks so far
+  void *free_blocks[kClassCount]; // Linked through their first bytes
+  std::size_t live_blocks;
+  bool orphaned;                  // Given up by its arena, see reserve()
+  ContainerMemoryStats stats;
+};
+
+struct ContainerArena::BlockHeader {
+  Pool *pool;       // nullptr for a block of the heap
+  int size_class;
+};
+
+ContainerArena::ContainerArena()
+  : pool_(nullptr)
+{
+  // Nothing is reserved until reserve()
+}
+
+ContainerArena::~ContainerArena()
+{
+  reserve(0);
+}
+
+void ContainerArena::reserve(std::size_t bytes)
+{
+  if (pool_ && bytes > 0 && pool_->capacity >= bytes) {
+    return;
+  }
+  if (pool_) {
+    pool_->orphaned = true;
+    if (pool_->live_blocks == 0) {
+      releasePool(pool_);
+    }
+    pool_ = nullptr;
+  }
+  if (bytes == 0) {
+    return;
+  }
+  Pool *pool = static_cast<Pool *>(std::malloc(sizeof(Pool)));
+  uint8_t *memory = static_cast<uint8_t *>(std::malloc(bytes));
+  if (!pool || !memory) {
+    std::free(pool);
+    std::free(memory);
+    return; // Everything goes to the heap then
+  }
+  pool->memory = memory;
+  pool->capacity = bytes;
+  pool->carved = 0;
+  for (int i = 0; i < kClassCount; i++) {
+    pool->free_blocks[i] = nullptr;
+  }
+  pool->live_blocks = 0;
+  pool->orphaned = false;
+  pool->stats = kNoStats;
+  pool->stats.arena_bytes = bytes;
+  pool_ = pool;
+}
+
+const ContainerMemoryStats &ContainerArena::getStats() const
+{
+  return pool_ ? pool_->stats : kNoStats;
+}
+
+void *ContainerArena::allocate(std::size_t size)
+{
+  Pool *pool = pool_;
+  uint8_t *block = nullptr;
+  int size_class = sizeClass(size + kHeaderSize);
+  if (pool && size_class >= 0) {
+    std::size_t block_size = kMinBlockSize << size_class;
+    if (pool->free_blocks[size_class]) {
+      block = static_cast<uint8_t *>(pool->free_blocks[size_class]);
+      pool->free_blocks[size_class] = *reinterpret_cast<void **>(block);
+    } else if (pool->capacity - pool->carved >= block_size) {
+      block = pool->memory + pool->carved;
+      pool->carved += block_size;
+    }
+    if (block) {
+      pool->live_blocks++;
+      pool->stats.used_bytes += block_size;
+      if (pool->stats.used_bytes > pool->stats.peak_bytes) {
+        pool->stats.peak_bytes = pool->stats.used_bytes;
+      }
+    }
+  }
+  if (!block) {
+    if (pool) {
+      pool->stats.heap_allocations++;
+    }
+    return allocateFromHeap(size);
+  }
+  BlockHeader *header = reinterpret_cast<BlockHeader *>(block);
+  header->pool = pool;
+  header->size_class = size_class;
+  return block + kHeaderSize;
+}
+
+void *ContainerArena::allocateFromHeap(std::size_t size)
+{
+  static_assert(sizeof(BlockHeader) <= kHeaderSize, "Header too large");
+  uint8_t *block = static_cast<uint8_t *>(std::malloc(size + kHeaderSize));
+  if (!block) {
+    return nullptr;
+  }
+  BlockHeader *header = reinterpret_cast<BlockHeader *>(block);
+  header->pool = nullptr;
+  header->size_class = -1;
+  return block + kHeaderSize;
+}
+
+void ContainerArena::release(void *pointer)
+{
+  if (!pointer) {
+    return;
+  }
+  uint8_t *block = static_cast<uint8_t *>(pointer) - kHeaderSize;
+  const BlockHeader *header = reinterpret_cast<const BlockHeader *>(block);
+  Pool *pool = header->pool;
+  if (!pool) {
+    std::free(block);
+    return;
+  }
+  int size_class = header->size_class;
+  assert(pool->live_blocks > 0);
+  *reinterpret_cast<void **>(block) = pool->free_blocks[size_class];
+  pool->free_blocks[size_class] = block;
+  pool->live_blocks--;
+  pool->stats.used_bytes -= kMinBlockSize << size_class;
+  if (pool->orphaned && pool->live_blocks == 0) {
+    releasePool(pool);
+  }
+}
+
+void ContainerArena::releasePool(Pool *pool)
+{
+  std::free(pool->memory);
+  std::free(pool);
+}
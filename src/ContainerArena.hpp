@@ -0,0 +1,132 @@
+#ifndef CONTAINERARENA_H_
+#define CONTAINERARENA_H_
+
+#include <cstdint>
+#include <cstddef>
+#include <cstdlib>
+#include <type_traits>
+
+/**
+ * @brief Counters of a ContainerArena. See ContainerInterface::getMemoryStats().
+ */
+struct ContainerMemoryStats {
+  uint64_t arena_bytes;       // Reserved by the last init()
+  uint64_t used_bytes;        // In blocks taken from the arena now
+  uint64_t peak_bytes;        // Most used_bytes since it was reserved
+  uint64_t heap_allocations;  // Allocations that went to the heap instead
+};
+
+/**
+ * @brief Memory reserved in one piece for the buffers of a container, so a
+ *        long recording does not fragment the heap until it has to grow.
+ *
+ *    The reserved memory is carved into blocks of power of two sizes, from 32
+ *    bytes to 64 KiB, and freed blocks go to a free list of their size. Once
+ *    the container has warmed up, its buffers take blocks from the free lists
+ *    only. Allocations larger than 64 KiB, or that do not fit any more, go to
+ *    the heap and are counted.
+ *
+ *    Only what is allocated through an Allocator of the arena comes from it:
+ *    the frames of FrameInterleaver, the chunk list and the Ogg seek index.
+ *    libogg and the mkvmuxer of libwebm allocate on the heap as before.
+ *
+ *    A container is used by one thread at a time, and so is its arena. Blocks
+ *    may outlive it: the memory is freed with the last of them.
+ *
+ * ## How to use
+ *
+ *    1. reserve() the memory.
+ *    2. Give an Allocator of the arena to the standard containers that should
+ *       use it.
+ */
+class ContainerArena
+{
+public:
+  /**
+   * @brief Allocator of the standard library taking memory from an arena, or
+   *        from the heap without one.
+   */
+  template <typename T>
+  class Allocator
+  {
+  public:
+    typedef T value_type;
+    // Memory goes back to the arena it came from, whatever the container.
+    typedef std::true_type propagate_on_container_copy_assignment;
+    typedef std::true_type propagate_on_container_move_assignment;
+    typedef std::true_type propagate_on_container_swap;
+
+    explicit Allocator(ContainerArena *arena = nullptr) : arena_(arena) {}
+    template <typename U>
+    Allocator(const Allocator<U> &other) : arena_(other.arena()) {}
+
+    T *allocate(std::size_t count)
+    {
+      void *pointer = arena_ ? arena_->allocate(count * sizeof(T))
+                             : ContainerArena::allocateFromHeap(count * sizeof(T));
+      if (!pointer) {
+        std::abort(); // No exceptions to throw
+      }
+      return static_cast<T *>(pointer);
+    }
+
+    void deallocate(T *pointer, std::size_t)
+    {
+      ContainerArena::release(pointer);
+    }
+
+    ContainerArena *arena() const { return arena_; }
+
+    template <typename U>
+    bool operator==(const Allocator<U> &other) const { return arena_ == other.arena(); }
+    template <typename U>
+    bool operator!=(const Allocator<U> &other) const { return arena_ != other.arena(); }
+
+  private:
+    ContainerArena *arena_;
+  };
+
+  ContainerArena();
+  ~ContainerArena();
+
+  /**
+   * @brief Reserve bytes for the arena. The memory reserved before is kept if
+   *        it is at least as large, otherwise it is given up and freed once
+   *        its blocks are. Counters start over with new memory.
+   *
+   * @param bytes   0 gives up the memory, so allocations go to the heap
+   */
+  void reserve(std::size_t bytes);
+
+  const ContainerMemoryStats &getStats() const;
+
+  /**
+   * @brief Allocate from the arena, or from the heap if it does not fit.
+   *
+   * @return void*    nullptr if the heap is out of memory
+   */
+  void *allocate(std::size_t size);
+
+  /**
+   * @brief Allocate from the heap, so release() can free it too.
+   */
+  static void *allocateFromHeap(std::size_t size);
+
+  /**
+   * @brief Free a pointer from allocate() or allocateFromHeap().
+   */
+  static void release(void *pointer);
+
+private:
+  struct Pool;
+  struct BlockHeader;
+
+  Pool *pool_;
+
+  static void releasePool(Pool *pool);
+
+  ContainerArena(const ContainerArena &) = delete;
+  ContainerArena &operator=(const ContainerArena &) = delete;
+};
+
+#endif /* CONTAINERARENA_H_ */
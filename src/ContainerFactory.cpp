@@ -0,0 +1,33 @@
+#include "ContainerInterface.hpp"
+#include <cassert>
+#include "ContainerReader.hpp"
+#include "OggContainer.hpp"
+#include "OggReader.hpp"
+#include "WebMContainer.hpp"
+#include "WebMReader.hpp"
+
+// Not in ContainerInterface.cpp, so a build with one container does not need
+// the other one and its library.
+ContainerInterface *ContainerInterface::create(Format format)
+{
+  switch (format) {
+    case FORMAT_OGG:
+      return new OggContainer();
+    case FORMAT_WEBM:
+      return new WebMContainer();
+  }
+  assert(false); // Not a Format
+  return nullptr;
+}
+
+ContainerReader *ContainerReader::create(ContainerInterface::Format format)
+{
+  switch (format) {
+    case ContainerInterface::FORMAT_OGG:
+      return new OggReader();
+    case ContainerInterface::FORMAT_WEBM:
+      return new WebMReader();
+  }
+  assert(false); // Not a Format
+  return nullptr;
+}
@@ -1,16 +1,84 @@
 #include "ContainerInterface.hpp"
+#include <algorithm>
 #include <cassert>
 
+namespace {
+  // Samples per frame of the CELT-only fullband configurations 28 to 31
+  const int kSilentFrameSamples[] = {120, 240, 480, 960};
+  // A packet holds at most 120 ms.
+  const int kMaxSilentPacketSamples = 5760;
+  // See setBitrate()
+  const uint32_t kDefaultChannelBitrate = 64000;
+  // See ContainerInterface::arenaSize()
+  const std::size_t kChunkListArenaSize = 1024;
+
+  /**
+   * Write an Opus packet of frame_count frames of no data, one per stream,
+   * with a code 3 TOC byte and a frame count byte. Streams but the last one
+   * are self-delimited by a frame size byte. See RFC 6716 section 3.2.5 and
+   * appendix B.
+   */
+  std::size_t writeSilentPacket(uint8_t *packet,
+                                const ContainerInterface::ChannelMapping &mapping,
+                                int config, int frame_count)
+  {
+    std::size_t size = 0;
+    for (int stream = 0; stream < mapping.stream_count; stream++) {
+      bool stereo = stream < mapping.coupled_count;
+      packet[size++] = config << 3 | stereo << 2 | 3;
+      packet[size++] = frame_count;   // Same sizes, no padding
+      if (stream + 1 < mapping.stream_count) {
+        packet[size++] = 0;
+      }
+    }
+    return size;
+  }
+}
+
+ContainerInterface::ChannelMapping ContainerInterface::channelMapping(uint8_t channel_count)
+{
+  assert(channel_count > 0 && channel_count <= kMaxChannelCount);
+  // Vorbis channel order, see https://tools.ietf.org/html/rfc7845#section-5.1.1.2
+  // Same table as vorbis_mappings in libopus' opus_multistream_encoder.c.
+  static const ChannelMapping surround[kMaxChannelCount] = {
+    {1, 1, 0, {0}},                       // Mono
+    {1, 1, 1, {0, 1}},                    // Stereo
+    {1, 2, 1, {0, 2, 1}},                 // Linear surround
+    {1, 2, 2, {0, 1, 2, 3}},              // Quadraphonic
+    {1, 3, 2, {0, 4, 1, 2, 3}},           // 5.0
+    {1, 4, 2, {0, 4, 1, 2, 3, 5}},        // 5.1
+    {1, 4, 3, {0, 4, 1, 2, 3, 5, 6}},     // 6.1
+    {1, 5, 3, {0, 6, 1, 2, 3, 4, 5, 7}}   // 7.1
+  };
+  ChannelMapping mapping = surround[channel_count - 1];
+  if (channel_count <= 2) {
+    // Family 0 has no table, the stream counts are implied.
+    mapping.family = 0;
+  }
+  return mapping;
+}
+
 ContainerInterface::ContainerInterface()
   : sample_rate_(48000),
-    channel_count_(1)
+    channel_count_(1),
+    tracks_(),
+    stats_(),
+    arena_(),
+    memory_output_(),
+    output_sink_(defaultOutputSink()),
+    bitrate_(0),
+    chunk_samples_(0),
+    chunks_(ContainerArena::Allocator<ContainerChunk>(&arena_)),
+    chunk_started_(false),
+    last_chunk_time_(0)
 {
   // Nothing to do
 }
 
 ContainerInterface::~ContainerInterface()
 {
-  // Nothing to do
+  // Subclasses write their last bytes in their destructors, which run first.
+  output_sink_->flush();
 }
 
 void ContainerInterface::init(uint32_t sample_rate, uint8_t channel_count, int serial)
@@ -18,13 +86,200 @@ void ContainerInterface::init(uint32_t sample_rate, uint8_t channel_count, int s
   // The container for Opus only supports 48000, other than this value must be
   // a mistake by us, not user. Therefore it has to be caught using assert().
   assert(sample_rate == 48000);
-  // It supports up to 2 channels for now
-  assert(channel_count > 0 && channel_count <= 2);
+  initTracks(sample_rate, channel_count, serial);
+  arena_.reserve(arenaSize());
+}
+
+void ContainerInterface::finish(void)
+{
+  if (tracks_.empty()) {
+    return; // Not initialized
+  }
+  finishStream();
+  tracks_.clear();
+  output_sink_->flush();
+}
+
+void ContainerInterface::reset(uint32_t sample_rate, uint8_t channel_count, int serial)
+{
+  finish();
+  init(sample_rate, channel_count, serial);
+}
+
+void ContainerInterface::initTracks(uint32_t sample_rate, uint8_t channel_count, int serial)
+{
   sample_rate_ = sample_rate;
   channel_count_ = channel_count;
+  tracks_.assign(1, TrackInfo{channel_count, serial, channelMapping(channel_count),
+                              0, sample_rate, 0});
+  stats_ = ContainerStats();
+  chunks_.clear();
+  chunk_started_ = false;
+  last_chunk_time_ = 0;
+}
+
+int ContainerInterface::addTrack(uint8_t channel_count, int serial)
+{
+  assert(!tracks_.empty()); // init() must be called first
+  tracks_.push_back(TrackInfo{channel_count, serial, channelMapping(channel_count),
+                              0, sample_rate_, 0});
+  arena_.reserve(arenaSize());
+  return tracks_.size() - 1;
+}
+
+int ContainerInterface::getTrackCount() const
+{
+  return tracks_.size();
 }
 
-void ContainerInterface::writeOpusIdHeader(uint8_t *header)
+const ContainerInterface::ChannelMapping &ContainerInterface::getChannelMapping(int track) const
+{
+  assert(track >= 0 && track < (int)tracks_.size());
+  return tracks_[track].mapping;
+}
+
+void ContainerInterface::setTrackHeader(int track, const IdHeader &header)
+{
+  assert(track >= 0 && track < (int)tracks_.size());
+  assert(header.channel_count == tracks_[track].channel_count);
+  TrackInfo &info = tracks_[track];
+  info.mapping = header.mapping;
+  info.pre_skip = header.pre_skip;
+  info.input_sample_rate = header.input_sample_rate;
+  info.output_gain = header.output_gain;
+}
+
+void ContainerInterface::writeFrame(void *data, std::size_t size, int num_samples)
+{
+  writeTrackFrame(0, data, size, num_samples);
+}
+
+void ContainerInterface::writeTrackGap(int track, int num_samples)
+{
+  assert(track >= 0 && track < (int)tracks_.size());
+  // 3 bytes per stream at most. Headers from setTrackHeader() are checked by
+  // parseOpusIdHeader(), but are sized for any stream count all the same.
+  uint8_t packet[3 * 255];
+  int left = (num_samples + 60) / 120 * 120;
+  while (left > 0) {
+    // The longest frames that fit, as many as a packet holds
+    int index = 3;
+    while (kSilentFrameSamples[index] > left) {
+      index--;
+    }
+    int frame_samples = kSilentFrameSamples[index];
+    int frame_count = std::min(left, kMaxSilentPacketSamples) / frame_samples;
+    std::size_t size = writeSilentPacket(packet, tracks_[track].mapping,
+                                         28 + index, frame_count);
+    writeTrackFrame(track, packet, size, frame_samples * frame_count);
+    left -= frame_samples * frame_count;
+  }
+}
+
+void ContainerInterface::setOutputSink(OutputSink *sink)
+{
+  output_sink_ = sink ? sink : defaultOutputSink();
+}
+
+OutputSink *ContainerInterface::getOutputSink() const
+{
+  return output_sink_;
+}
+
+MemoryOutputSink &ContainerInterface::getMemoryOutput()
+{
+  return memory_output_;
+}
+
+const ContainerStats &ContainerInterface::getStats() const
+{
+  return stats_;
+}
+
+void ContainerInterface::setChunkDuration(uint32_t chunk_samples)
+{
+  chunk_samples_ = chunk_samples;
+}
+
+int ContainerInterface::getChunkCount() const
+{
+  return chunks_.size();
+}
+
+const ContainerChunk &ContainerInterface::getChunk(int index) const
+{
+  assert(index >= 0 && index < (int)chunks_.size());
+  return chunks_[index];
+}
+
+void ContainerInterface::clearChunks(void)
+{
+  chunks_.clear();
+}
+
+bool ContainerInterface::chunkDue(uint64_t time) const
+{
+  return chunk_samples_ > 0
+         && (!chunk_started_ || time - last_chunk_time_ >= chunk_samples_);
+}
+
+void ContainerInterface::startChunk(uint64_t time)
+{
+  chunks_.push_back(ContainerChunk{stats_.bytes, time});
+  chunk_started_ = true;
+  last_chunk_time_ = time;
+}
+
+void ContainerInterface::setBitrate(uint32_t bits_per_second)
+{
+  bitrate_ = bits_per_second;
+}
+
+const ContainerMemoryStats &ContainerInterface::getMemoryStats() const
+{
+  return arena_.getStats();
+}
+
+std::size_t ContainerInterface::arenaSize(void) const
+{
+  // A few chunks at a time, as they are taken while recording.
+  return chunk_samples_ > 0 ? kChunkListArenaSize : 0;
+}
+
+std::size_t ContainerInterface::interleaverArenaSize(uint32_t samples) const
+{
+  if (tracks_.size() < 2) {
+    return 0;
+  }
+  // Blocks are rounded up to a power of two, so up to twice the bytes.
+  return tracks_.size() * kTrackArenaSize + 2 * expectedBytes(samples);
+}
+
+std::size_t ContainerInterface::expectedBytes(uint64_t samples) const
+{
+  uint64_t bitrate = bitrate_ > 0 ? bitrate_
+                                  : kDefaultChannelBitrate * channel_count_;
+  return bitrate * samples / 48000 / 8;
+}
+
+void ContainerInterface::writeOutput(const void *data, std::size_t size)
+{
+  output_sink_->write(data, size);
+  stats_.bytes += size;
+}
+
+OutputSink *ContainerInterface::defaultOutputSink()
+{
+#ifdef __EMSCRIPTEN__
+  // It has no state, so every container can share it.
+  static EmscriptenOutputSink emscripten_output;
+  return &emscripten_output;
+#else
+  return &memory_output_;
+#endif
+}
+
+std::size_t ContainerInterface::writeOpusIdHeader(uint8_t *header, int track)
 {
   /**
    * @brief ID header format: https://tools.ietf.org/html/rfc7845#section-5.1
@@ -52,27 +307,98 @@ void ContainerInterface::writeOpusIdHeader(uint8_t *header)
   using namespace OpusIdHeaderType;
 
   assert(header);
+  assert(track >= 0 && track < (int)tracks_.size());
   // Magic Signature 'OpusHead'
   const static string magic = "OpusHead";
   memcpy(header + MAGIC_OFFSET, magic.c_str(), magic.size());
   // The version must always be 1 (8 bits, unsigned).
   header[VER_OFFSET] = 1;
   // Number of output channels (8 bits, unsigned).
-  header[CH_OFFSET] = channel_count_;
-  // Firefox seems to have problem with non-zero pre-skip.
+  header[CH_OFFSET] = tracks_[track].channel_count;
+  // Firefox seems to have problem with non-zero pre-skip, so it is zero
+  // unless a remuxed stream had one (16 bits, unsigned, little endian).
   // Related topic: https://wiki.xiph.org/MatroskaOpus#Proposal_2:_Use_pre-skip_data_from_CodecPrivate
-  const uint16_t pre_skip = 0;
-  memcpy(header + PRE_SKIP_OFFSET, &pre_skip, sizeof(uint16_t));
+  memcpy(header + PRE_SKIP_OFFSET, &tracks_[track].pre_skip, sizeof(uint16_t));
   // The sampling rate of input source (32 bits, unsigned, little endian).
-  memcpy(header + SAMPLE_RATE_OFFSET, &sample_rate_, sizeof(uint32_t));
+  memcpy(header + SAMPLE_RATE_OFFSET, &tracks_[track].input_sample_rate,
+         sizeof(uint32_t));
   // Output gain, an encoder should set this field to zero (16 bits, signed,
   // little endian).
-  const uint16_t gain = 0;
-  memcpy(header + GAIN_OFFSET, &gain, sizeof(uint16_t));
-  // Channel Mapping Family 0: mono or stereo (left, right). (8 bits, unsigned).
-  header[MAPPING_FAMILY_OFFSET] = 0;
+  memcpy(header + GAIN_OFFSET, &tracks_[track].output_gain, sizeof(int16_t));
+  // Channel Mapping Family (8 bits, unsigned).
+  //  0: mono or stereo (left, right), no mapping table.
+  //  1: up to 8 channels in Vorbis order, followed by the mapping table.
+  const ChannelMapping &mapping = tracks_[track].mapping;
+  header[MAPPING_FAMILY_OFFSET] = mapping.family;
+  if (mapping.family == 0) {
+    return SIZE;
+  }
+  // Stream Count, Coupled Count and one byte per channel (8 bits, unsigned).
+  header[STREAM_COUNT_OFFSET] = mapping.stream_count;
+  header[COUPLED_COUNT_OFFSET] = mapping.coupled_count;
+  memcpy(header + CHANNEL_MAPPING_OFFSET, mapping.mapping,
+         tracks_[track].channel_count);
+  return CHANNEL_MAPPING_OFFSET + tracks_[track].channel_count;
 }
 
+bool ContainerInterface::parseOpusIdHeader(const uint8_t *data, std::size_t size,
+                                           IdHeader *header)
+{
+  // See writeOpusIdHeader() for the layout. Fields are little endian, like
+  // the hosts this runs on.
+  using namespace OpusIdHeaderType;
+
+  assert(header);
+  if (!data || size < SIZE || memcmp(data + MAGIC_OFFSET, "OpusHead", 8) != 0) {
+    return false;
+  }
+  // Only the major version, the upper 4 bits, breaks compatibility.
+  if ((data[VER_OFFSET] >> 4) != 0) {
+    return false;
+  }
+  header->channel_count = data[CH_OFFSET];
+  memcpy(&header->pre_skip, data + PRE_SKIP_OFFSET, sizeof(uint16_t));
+  memcpy(&header->input_sample_rate, data + SAMPLE_RATE_OFFSET, sizeof(uint32_t));
+  memcpy(&header->output_gain, data + GAIN_OFFSET, sizeof(int16_t));
+
+  ChannelMapping &mapping = header->mapping;
+  uint8_t channel_count = header->channel_count;
+  mapping.family = data[MAPPING_FAMILY_OFFSET];
+  if (channel_count == 0 || channel_count > kMaxChannelCount) {
+    return false;
+  }
+  if (mapping.family == 0) {
+    if (channel_count > 2) {
+      return false;
+    }
+    mapping = channelMapping(channel_count);
+    return true;
+  }
+  // Family 255 has the same table as family 1, with undefined channel order.
+  if ((mapping.family != 1 && mapping.family != 255)
+      || size < (std::size_t)CHANNEL_MAPPING_OFFSET + channel_count) {
+    return false;
+  }
+  mapping.stream_count = data[STREAM_COUNT_OFFSET];
+  mapping.coupled_count = data[COUPLED_COUNT_OFFSET];
+  // No more streams than the channels supported, as every container trusts
+  // the count. RFC 7845 section 5.1.1 limits the decoded channels to 255.
+  if (mapping.stream_count == 0 || mapping.stream_count > kMaxChannelCount
+      || mapping.coupled_count > mapping.stream_count
+      || mapping.stream_count + mapping.coupled_count > 255) {
+    return false;
+  }
+  memset(mapping.mapping, 0, sizeof(mapping.mapping));
+  memcpy(mapping.mapping, data + CHANNEL_MAPPING_OFFSET, channel_count);
+  for (uint8_t ch = 0; ch < channel_count; ch++) {
+    // 255 is a silent channel
+    if (mapping.mapping[ch] != 255
+        && mapping.mapping[ch] >= mapping.stream_count + mapping.coupled_count) {
+      return false;
+    }
+  }
+  return true;
+}
 
 void ContainerInterface::writeOpusCommentHeader(uint8_t *header)
 {
@@ -4,6 +4,9 @@
 #include <cstdint>
 #include <cstring>
 #include <string>
+#include <vector>
+#include "ContainerArena.hpp"
+#include "OutputSink.hpp"
 
 // See ContainerInterface::writeOpusIdHeader for more detail
 namespace OpusIdHeaderType {
@@ -15,7 +18,12 @@ namespace OpusIdHeaderType {
     SAMPLE_RATE_OFFSET = 12,
     GAIN_OFFSET = 16,
     MAPPING_FAMILY_OFFSET = 18,
-    SIZE = MAPPING_FAMILY_OFFSET + 1
+    SIZE = MAPPING_FAMILY_OFFSET + 1,
+    // Channel mapping table, only with mapping family 1
+    STREAM_COUNT_OFFSET = 19,
+    COUPLED_COUNT_OFFSET = 20,
+    CHANNEL_MAPPING_OFFSET = 21,
+    MAX_SIZE = CHANNEL_MAPPING_OFFSET + 8
   };
 }
 
@@ -34,37 +42,331 @@ namespace OpusCommentHeaderType {
   };
 }
 
+/**
+ * @brief Counters of a container since init(). See ContainerInterface::getStats().
+ */
+struct ContainerStats {
+  uint64_t frames;    // Frames written, of all tracks
+  uint64_t bytes;     // Bytes written to the sink, rewrites for patching included
+  uint64_t pages;     // Ogg pages
+  uint64_t clusters;  // WebM clusters
+  uint64_t samples;   // End of the audio written, at 48 kHz, of the longest track
+};
+
+/**
+ * @brief Where a chunk of the output starts. See ContainerInterface::setChunkDuration().
+ */
+struct ContainerChunk {
+  uint64_t offset;  // Bytes written before it, counted as ContainerStats::bytes
+  uint64_t time;    // Its first sample at 48 kHz, pre-skip included
+};
+
 class ContainerInterface
 {
 public:
+  // Mapping family 1 is defined up to 7.1
+  static const uint8_t kMaxChannelCount = 8;
+
+  /**
+   * @brief How the channels of a track are spread over Opus streams.
+   *        See https://tools.ietf.org/html/rfc7845#section-5.1.1
+   */
+  struct ChannelMapping {
+    uint8_t family;         // 0 for mono and stereo, 1 for surround
+    uint8_t stream_count;
+    uint8_t coupled_count;  // Streams holding a stereo pair
+    uint8_t mapping[kMaxChannelCount];  // Decoded channel index of each channel
+  };
+
+  /**
+   * @brief   The mapping used for channel_count channels. Above 2 channels it
+   *          is family 1 in Vorbis channel order, with as many channels paired
+   *          into coupled streams as possible, the same as
+   *          opus_multistream_surround_encoder_create() chooses.
+   */
+  static ChannelMapping channelMapping(uint8_t channel_count);
+
+  /**
+   * @brief The fields of an ID header, see writeOpusIdHeader().
+   */
+  struct IdHeader {
+    uint8_t channel_count;
+    uint16_t pre_skip;            // Samples to discard at 48 kHz
+    uint32_t input_sample_rate;   // Informational only
+    int16_t output_gain;          // Q7.8 in dB
+    ChannelMapping mapping;
+  };
+
+  /**
+   * @brief   Parse an ID header, e.g. of an Ogg stream or WebM CodecPrivate.
+   *          The mapping table is checked against the channel count, so a
+   *          header accepted here can be written as it is.
+   *
+   * @param data      The header packet
+   * @param size      Byte size of the header packet
+   * @param header    Where the fields are stored
+   * @return bool     false if it is not an ID header of up to 8 channels, or
+   *                  of a mapping family other than 0, 1 or 255
+   */
+  static bool parseOpusIdHeader(const uint8_t *data, std::size_t size,
+                                IdHeader *header);
+
+  enum Format {
+    FORMAT_OGG,
+    FORMAT_WEBM
+  };
+
+  /**
+   * @brief   Make an Opus container of a format chosen at runtime, so one
+   *          binary can write both. Defined in ContainerFactory.cpp, which
+   *          only builds linking both containers need.
+   *
+   * @param format                  The format of the new container
+   * @return ContainerInterface*    A new container, owned by the caller
+   */
+  static ContainerInterface *create(Format format);
+
   ContainerInterface();
-  ~ContainerInterface();
+  virtual ~ContainerInterface();
 
   /**
-   * @brief Initialize a new Ogg Container object
+   * @brief Initialize a new Ogg Container object. It has one track, track 0.
    *
    * @param sample_rate     Sampling rate of the stream
-   * @param channel_count   The number of channels of the stream the maximum is 2.
+   * @param channel_count   The number of channels of the stream, up to 8.
    * @param serial          Unique number of the stream. Usually a random number.
    */
   virtual void init(uint32_t sample_rate, uint8_t channel_count, int serial);
 
   /**
-   * @brief   Insert data (or a packet). The inserted data can be later collected
-   *          as Ogg pages by calling producePacketPage().
+   * @brief   End the stream now, writing what destroying the container would.
+   *          The container is then uninitialized, with no track, and can be
+   *          started again with init() or reset(). Does nothing if it is
+   *          uninitialized already.
+   */
+  void finish(void);
+
+  /**
+   * @brief   finish() then init(), so one container can write one stream
+   *          after another. The output sink, settings such as the Ogg paging
+   *          policy, and buffers already grown are kept.
+   *
+   * @param sample_rate     Sampling rate of the new stream
+   * @param channel_count   The number of channels of the new stream
+   * @param serial          Unique number of the new stream
+   */
+  void reset(uint32_t sample_rate, uint8_t channel_count, int serial);
+
+  /**
+   * @brief   Add another track: an audio track in WebM, a logical bitstream in
+   *          Ogg. All tracks must be added after init() and before the first
+   *          frame. Frames of different tracks are interleaved by timestamp.
+   *
+   * @param channel_count   The number of channels of the track
+   * @param serial          Unique number of the track. Usually a random number.
+   * @return int            The track index to pass to writeTrackFrame()
+   */
+  virtual int addTrack(uint8_t channel_count, int serial);
+  int getTrackCount() const;
+  const ChannelMapping &getChannelMapping(int track) const;
+
+  /**
+   * @brief   Replace the ID header fields of a track, e.g. with those of the
+   *          stream being remuxed. Call it before the first frame, once the
+   *          track exists. The default is no pre-skip, no gain, the sample
+   *          rate given to init() and channelMapping() of the channel count.
+   *
+   * @param track     Track index, 0 for the first
+   * @param header    Its channel_count must be that of the track
+   */
+  virtual void setTrackHeader(int track, const IdHeader &header);
+
+  /**
+   * @brief   Insert data (or a packet) of track 0.
+   *
+   * @param data          A pointer to the packet buffer
+   * @param size          Byte size of the packet data
+   * @param num_samples   The number of samples of the packet
+   */
+  void writeFrame(void *data, std::size_t size, int num_samples);
+
+  /**
+   * @brief   Insert data (or a packet) of a track.
    *
+   * @param track         Track index returned by addTrack(), 0 for the first
    * @param data          A pointer to the packet buffer
    * @param size          Byte size of the packet data
-   * @param num_samples   if < 0, the packet is considered as metadata packet
+   * @param num_samples   The number of samples of the packet
+   */
+  virtual void writeTrackFrame(int track, void *data, std::size_t size,
+                               int num_samples) = 0;
+
+  /**
+   * @brief   Skip samples of a track, e.g. silence the encoder left out. By
+   *          default they are written as Opus packets of empty frames, which
+   *          decoders conceal like DTX frames, so the track stays continuous
+   *          and Ogg granule positions advance over them. WebM leaves a gap
+   *          in the block timestamps instead.
+   *
+   * @param track         Track index returned by addTrack(), 0 for the first
+   * @param num_samples   Samples at 48 kHz, rounded to 2.5 ms (120 samples)
+   */
+  virtual void writeTrackGap(int track, int num_samples);
+
+  /**
+   * @brief   Set where the produced bytes go. Call it before init(). The sink
+   *          is not owned and must outlive the container.
+   *
+   *          The default is the JavaScript push in Emscripten builds and an
+   *          internal memory buffer (see getMemoryOutput()) in native builds.
+   *
+   * @param sink    A sink, or nullptr to go back to the default
    */
-  virtual void writeFrame(void *data, std::size_t size, int num_samples) = 0;
+  void setOutputSink(OutputSink *sink);
+  OutputSink *getOutputSink() const;
+
+  /**
+   * @brief   The internal memory buffer used as the default sink natively.
+   */
+  MemoryOutputSink &getMemoryOutput();
+
+  const ContainerStats &getStats() const;
+
+  /**
+   * @brief   Cut the output into chunks that can be handed on one by one, e.g.
+   *          uploaded while recording. A chunk starts on a WebM cluster or on
+   *          new Ogg pages of every stream, at least chunk_samples after the
+   *          start of the previous one, so it can be decoded given the bytes
+   *          before the first chunk: the EBML header and Tracks, or the ID
+   *          and comment pages. Call it before init().
+   *
+   *          Where chunks start is listed by getChunk(). A seekable WebM has
+   *          no chunks, its beginning is rewritten at the end.
+   *
+   * @param chunk_samples   At 48 kHz, e.g. 48000 for 1 second. 0 (default)
+   *                        lists no chunks.
+   */
+  void setChunkDuration(uint32_t chunk_samples);
+
+  /**
+   * @brief   Chunks started since init() or the last clearChunks(), oldest first.
+   */
+  int getChunkCount() const;
+  const ContainerChunk &getChunk(int index) const;
+
+  /**
+   * @brief   Forget the chunks listed so far, once they are taken.
+   */
+  void clearChunks(void);
+
+  /**
+   * @brief   The bitrate expected of all tracks together, e.g. that of the
+   *          encoder, from which init() and addTrack() size the memory they
+   *          reserve for the container, see getMemoryStats(). Call it before
+   *          init().
+   *
+   * @param bits_per_second   0 (default) assumes 64 kbps per channel
+   */
+  void setBitrate(uint32_t bits_per_second);
+
+  /**
+   * @brief   Usage of the memory reserved by init() for the buffers of the
+   *          container, see ContainerArena. heap_allocations staying the same
+   *          while writing frames means those buffers allocate nothing more.
+   *          libogg and libwebm allocate on the heap, which is not counted.
+   */
+  const ContainerMemoryStats &getMemoryStats() const;
 
 protected:
+  struct TrackInfo {
+    uint8_t channel_count;
+    int serial;
+    ChannelMapping mapping;
+    uint16_t pre_skip;
+    uint32_t input_sample_rate;
+    int16_t output_gain;
+  };
+
   uint32_t sample_rate_;
-  uint8_t channel_count_;
+  uint8_t channel_count_;         // The same as tracks_[0].channel_count
+  std::vector<TrackInfo> tracks_;
+  ContainerStats stats_;
+  // Give an Allocator of it to the buffers of the container.
+  ContainerArena arena_;
+
+  // Queues and recycled frames of the interleaver, per track
+  static const std::size_t kTrackArenaSize = 4 * 1024;
+  // How far a track gets ahead of the others in the interleaver, as the input
+  // of each track is encoded in blocks in turn: well under a second.
+  static const uint32_t kInterleavedSamples = 48000;
+
+  /**
+   * @brief   Write the end of the stream. Called by finish() when the
+   *          container is initialized. Subclasses must call finish() in their
+   *          destructor, where it still reaches their own finishStream().
+   */
+  virtual void finishStream(void) {}
 
-  void writeOpusIdHeader(uint8_t *header);
+  /**
+   * @brief   Bytes init() and addTrack() reserve for arena_, from the settings
+   *          and the tracks: those of the chunk list with setChunkDuration(),
+   *          none otherwise. Subclasses add their own buffers.
+   */
+  virtual std::size_t arenaSize(void) const;
+
+  /**
+   * @brief   Bytes of the frames the interleaver holds with several tracks,
+   *          up to samples ahead, and of its queues. 0 with a single track.
+   */
+  std::size_t interleaverArenaSize(uint32_t samples) const;
+
+  /**
+   * @brief   Bytes of output expected for samples at 48 kHz, see setBitrate().
+   */
+  std::size_t expectedBytes(uint64_t samples) const;
+
+  /**
+   * @brief   Set up track 0. init() without the checks specific to Opus.
+   */
+  void initTracks(uint32_t sample_rate, uint8_t channel_count, int serial);
+
+  /**
+   * @brief   Write the ID header of a track.
+   *
+   * @param header          At least OpusIdHeaderType::MAX_SIZE bytes
+   * @return std::size_t    The size of the header, which depends on the mapping
+   */
+  std::size_t writeOpusIdHeader(uint8_t *header, int track = 0);
   void writeOpusCommentHeader(uint8_t *header);
+
+  /**
+   * @brief   Hand produced bytes to the output sink.
+   */
+  void writeOutput(const void *data, std::size_t size);
+
+  /**
+   * @brief   Whether a chunk should start at time, see setChunkDuration().
+   *          Always true for the first one.
+   */
+  bool chunkDue(uint64_t time) const;
+
+  /**
+   * @brief   List a chunk starting at time with the next byte written.
+   */
+  void startChunk(uint64_t time);
+
+private:
+  MemoryOutputSink memory_output_;
+  OutputSink *output_sink_;
+  uint32_t bitrate_;          // See setBitrate()
+
+  // See setChunkDuration()
+  uint32_t chunk_samples_;
+  std::vector<ContainerChunk, ContainerArena::Allocator<ContainerChunk> > chunks_;
+  bool chunk_started_;        // Whether a chunk started since init()
+  uint64_t last_chunk_time_;  // Start of the last chunk
+
+  OutputSink *defaultOutputSink();
 };
 
 #endif /* CONTAINERINTERFACE_H_ */
@@ -0,0 +1,111 @@
+#include "ContainerReader.hpp"
+#include <cassert>
+
+ContainerReader::ContainerReader()
+  : tracks_(),
+    data_(nullptr),
+    size_(0)
+{
+  // Nothing to do
+}
+
+ContainerReader::~ContainerReader()
+{
+  // Nothing to do
+}
+
+int ContainerReader::packetSamples(const uint8_t *data, std::size_t size)
+{
+  /**
+   * @brief TOC byte: https://tools.ietf.org/html/rfc6716#section-3.1
+   *
+   *     0 1 2 3 4 5 6 7
+   *    +-+-+-+-+-+-+-+-+
+   *    | config  |s| c |
+   *    +-+-+-+-+-+-+-+-+
+   *
+   *    config is the mode and the frame duration, c the number of frames:
+   *    0: 1 frame, 1 and 2: 2 frames, 3: the count is in the next byte.
+   */
+  if (!data || size == 0) {
+    return -1;
+  }
+  int config = data[0] >> 3;
+  int frame_samples;
+  if (config < 12) {
+    // SILK-only: 10, 20, 40 or 60 ms
+    static const int silk[4] = {480, 960, 1920, 2880};
+    frame_samples = silk[config & 3];
+  } else if (config < 16) {
+    // Hybrid: 10 or 20 ms
+    frame_samples = (config & 1) ? 960 : 480;
+  } else {
+    // CELT-only: 2.5, 5, 10 or 20 ms
+    frame_samples = 120 << (config & 3);
+  }
+
+  int frame_count;
+  switch (data[0] & 3) {
+    case 0:
+      frame_count = 1;
+      break;
+    case 1:
+    case 2:
+      frame_count = 2;
+      break;
+    default:
+      if (size < 2) {
+        return -1;
+      }
+      frame_count = data[1] & 0x3F;
+      break;
+  }
+  int samples = frame_count * frame_samples;
+  // A packet holds at least one frame and at most 120 ms.
+  if (frame_count == 0 || samples > 5760) {
+    return -1;
+  }
+  return samples;
+}
+
+int ContainerReader::getTrackCount() const
+{
+  return tracks_.size();
+}
+
+const ContainerInterface::IdHeader &ContainerReader::getTrackHeader(int track) const
+{
+  assert(track >= 0 && track < (int)tracks_.size());
+  return tracks_[track];
+}
+
+int ContainerReader::remux(ContainerInterface *container, int serial)
+{
+  assert(container);
+  assert(container->getTrackCount() == 0); // Must be uninitialized
+  if (tracks_.empty()) {
+    return ERR_NOT_OPUS;
+  }
+
+  // Opus is always decoded at 48 kHz, whatever the input sample rate was.
+  container->init(48000, tracks_[0].channel_count, serial);
+  for (std::size_t i = 1; i < tracks_.size(); i++) {
+    container->addTrack(tracks_[i].channel_count, (int)((uint32_t)serial + i));
+  }
+  for (std::size_t i = 0; i < tracks_.size(); i++) {
+    container->setTrackHeader(i, tracks_[i]);
+  }
+
+  Packet packet;
+  int result;
+  while ((result = readPacket(&packet)) > 0) {
+    if (packet.gap_samples > 0) {
+      container->writeTrackGap(packet.track, packet.gap_samples);
+    }
+    // Containers do not modify the packet.
+    container->writeTrackFrame(packet.track, const_cast<uint8_t *>(packet.data),
+                               packet.size, packet.num_samples);
+  }
+  container->finish();
+  return result;
+}
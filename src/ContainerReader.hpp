@@ -0,0 +1,110 @@
+#ifndef CONTAINERREADER_H_
+#define CONTAINERREADER_H_
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include "ContainerInterface.hpp"
+
+/**
+ * @brief Reads the Opus packets of an Ogg or WebM file, so they can be
+ *        written to a container of the other format without decoding them.
+ *
+ * ## How to use
+ *
+ *    1. Instantiate OggReader or WebMReader, or call create().
+ *    2. Call open() with the whole file. It parses the headers of every Opus
+ *       track, see getTrackHeader(). Other tracks are skipped.
+ *    3. Call readPacket() until it returns 0, or remux() to write all
+ *       packets to a container.
+ *
+ *    The file is not copied and must outlive the reader.
+ */
+class ContainerReader
+{
+public:
+  enum Error {
+    OK = 0,
+    ERR_INVALID_DATA = -1,  // Not a valid file, or truncated
+    ERR_NOT_OPUS = -2,      // No Opus track
+    ERR_UNSUPPORTED = -3    // e.g. a chained Ogg stream
+  };
+
+  /**
+   * @brief An Opus packet of a track.
+   */
+  struct Packet {
+    int track;            // Index of the track, in the order of open()
+    const uint8_t *data;  // Valid until the next call to readPacket()
+    std::size_t size;
+    // Samples at 48 kHz. Less than the packet holds for the last packet of
+    // a track trimmed at the end, by the granule position of its Ogg page or
+    // the DiscardPadding of its WebM block. OggContainer keeps it in the
+    // last granule position, WebMContainer in a DiscardPadding.
+    int num_samples;
+    // Samples skipped before the packet, a gap in the WebM block timestamps
+    // of the track, e.g. silence left out by the encoder. 0 in Ogg.
+    int gap_samples;
+  };
+
+  /**
+   * @brief   Make a reader of a format. Defined in ContainerFactory.cpp.
+   *
+   * @param format              The format of the file to read
+   * @return ContainerReader*   A new reader, owned by the caller
+   */
+  static ContainerReader *create(ContainerInterface::Format format);
+
+  /**
+   * @brief   The number of samples at 48 kHz of an Opus packet, from its TOC
+   *          byte. See https://tools.ietf.org/html/rfc6716#section-3.1
+   *          For a multistream packet it is that of its first stream, which
+   *          is the same for every stream.
+   *
+   * @return int    The number of samples, or -1 if the packet is invalid
+   */
+  static int packetSamples(const uint8_t *data, std::size_t size);
+
+  ContainerReader();
+  virtual ~ContainerReader();
+
+  /**
+   * @brief   Parse the headers of a file.
+   *
+   * @param data    The whole file
+   * @param size    Byte size of the file
+   * @return int    OK or one of Error
+   */
+  virtual int open(const void *data, std::size_t size) = 0;
+
+  int getTrackCount() const;
+  const ContainerInterface::IdHeader &getTrackHeader(int track) const;
+
+  /**
+   * @brief   Read the next packet of any track, in the order of the file.
+   *
+   * @param packet    Where the packet is stored
+   * @return int      1 if a packet was read, 0 at the end of the file, or
+   *                  one of Error
+   */
+  virtual int readPacket(Packet *packet) = 0;
+
+  /**
+   * @brief   Write every packet left to a container, with the tracks and ID
+   *          headers of the file, then finish() it. The container must be
+   *          uninitialized.
+   *
+   * @param container   The container to write to, with its output sink set
+   * @param serial      Unique number of the first track. Other tracks get the
+   *                    following numbers.
+   * @return int        OK or one of Error. The container is finished anyway.
+   */
+  int remux(ContainerInterface *container, int serial);
+
+protected:
+  std::vector<ContainerInterface::IdHeader> tracks_;
+  const uint8_t *data_;
+  std::size_t size_;
+};
+
+#endif /* CONTAINERREADER_H_ */
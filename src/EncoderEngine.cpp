@@ -0,0 +1,270 @@
+#include "EncoderEngine.hpp"
+#include <cassert>
+#include <cstring>
+
+EncoderEngine::Session::Session(ContainerInterface *container)
+  : engine(nullptr),
+    pipeline(container),
+    channel_count(0),
+    input(),
+    next_frame_size(0),
+    queue(),
+    free_blocks(),
+    scheduled(false),
+    error(OK)
+{
+  // Nothing to do
+}
+
+EncoderEngine::Session::~Session()
+{
+  assert(queue.empty() && !scheduled);
+  for (Block *block : free_blocks) {
+    delete block;
+  }
+}
+
+EncoderEngine::EncoderEngine(unsigned thread_count)
+  : pool_(thread_count),
+    sessions_mutex_(),
+    sessions_()
+{
+  // Nothing to do
+}
+
+EncoderEngine::~EncoderEngine()
+{
+  for (std::size_t i = 0; i < sessions_.size(); i++) {
+    if (sessions_[i]) {
+      closeSession(i);
+    }
+  }
+}
+
+int EncoderEngine::openSession(ContainerInterface *container,
+                               uint32_t input_sample_rate, uint8_t channel_count,
+                               int bitrate, int serial, int resample_quality,
+                               uint32_t frame_size)
+{
+  assert(container);
+  // Two sessions on one container would run on two threads at once.
+  assert(container->getTrackCount() == 0);
+  Session *session = new Session(container);
+  int err = session->pipeline.init(input_sample_rate, channel_count, bitrate, serial,
+                                   resample_quality, frame_size);
+  if (err != OK) {
+    delete session;
+    return err;
+  }
+  session->engine = this;
+  session->channel_count = channel_count;
+  session->input.assign(getMaxInputLength() * channel_count, 0.0f);
+
+  std::lock_guard<std::mutex> lock(sessions_mutex_);
+  for (std::size_t i = 0; i < sessions_.size(); i++) {
+    if (!sessions_[i]) {
+      sessions_[i] = session;
+      return i;
+    }
+  }
+  sessions_.push_back(session);
+  return sessions_.size() - 1;
+}
+
+int EncoderEngine::setFrameSize(int session, uint32_t frame_size)
+{
+  Session *s = getSession(session);
+  if (!s) {
+    return ERR_INVALID_SESSION;
+  }
+  if (!EncoderPipeline::isValidFrameSize(frame_size)) {
+    return EncoderPipeline::ERR_INVALID_FRAME_SIZE;
+  }
+  // The pipeline may be encoding meanwhile, so it goes along with a block.
+  s->next_frame_size = frame_size;
+  return OK;
+}
+
+int EncoderEngine::setControl(int session, int control, int value)
+{
+  Session *s = getSession(session);
+  if (!s) {
+    return ERR_INVALID_SESSION;
+  }
+  // Settings change seldom, so waiting is simpler than queueing them.
+  waitIdle(s);
+  return s->pipeline.setControl(control, value);
+}
+
+float *EncoderEngine::getInputBuffer(int session, uint8_t channel)
+{
+  Session *s = getSession(session);
+  assert(s && channel < s->channel_count);
+  return &s->input[channel * getMaxInputLength()];
+}
+
+uint32_t EncoderEngine::getMaxInputLength() const
+{
+  // Blocks are copied to the pipeline as they are.
+  return EncoderPipeline::kMaxInputLength;
+}
+
+int EncoderEngine::submit(int session, uint32_t length)
+{
+  Session *s = getSession(session);
+  if (!s) {
+    return ERR_INVALID_SESSION;
+  }
+  assert(length <= getMaxInputLength());
+
+  Block *block = nullptr;
+  bool schedule = false;
+  {
+    std::unique_lock<std::mutex> lock(s->mutex);
+    s->changed.wait(lock, [s] { return s->queue.size() < kMaxQueuedBlocks; });
+    if (s->error != OK) {
+      return s->error;
+    }
+    if (!s->free_blocks.empty()) {
+      block = s->free_blocks.back();
+      s->free_blocks.pop_back();
+    }
+  }
+  // Copy outside the lock, so the session keeps running meanwhile.
+  if (!block) {
+    block = new Block();
+    block->samples.resize(s->input.size());
+  }
+  for (uint8_t ch = 0; ch < s->channel_count; ch++) {
+    memcpy(&block->samples[ch * getMaxInputLength()],
+           &s->input[ch * getMaxInputLength()], length * sizeof(float));
+  }
+  block->length = length;
+  block->frame_size = s->next_frame_size;
+  s->next_frame_size = 0;
+  {
+    std::lock_guard<std::mutex> lock(s->mutex);
+    s->queue.push_back(block);
+    schedule = !s->scheduled;
+    s->scheduled = true;
+  }
+  if (schedule) {
+    pool_.submit(runSession, s);
+  }
+  return OK;
+}
+
+int EncoderEngine::drain(int session)
+{
+  Session *s = getSession(session);
+  if (!s) {
+    return ERR_INVALID_SESSION;
+  }
+  return waitIdle(s);
+}
+
+const EncoderPipeline *EncoderEngine::getPipeline(int session) const
+{
+  Session *s = getSession(session);
+  return s ? &s->pipeline : nullptr;
+}
+
+int EncoderEngine::closeSession(int session)
+{
+  Session *s = nullptr;
+  {
+    std::lock_guard<std::mutex> lock(sessions_mutex_);
+    if (session < 0 || (std::size_t)session >= sessions_.size()) {
+      return ERR_INVALID_SESSION;
+    }
+    s = sessions_[session];
+    sessions_[session] = nullptr;
+  }
+  if (!s) {
+    return ERR_INVALID_SESSION;
+  }
+  int err = waitIdle(s);
+  // Idle, so the last frame is encoded on this thread.
+  if (s->next_frame_size != 0) {
+    s->pipeline.setFrameSize(s->next_frame_size);
+  }
+  int close_err = s->pipeline.close();
+  if (err == OK) {
+    err = close_err;
+  }
+  delete s;
+  return err;
+}
+
+unsigned EncoderEngine::getThreadCount() const
+{
+  return pool_.getThreadCount();
+}
+
+EncoderEngine::Session *EncoderEngine::getSession(int session) const
+{
+  std::lock_guard<std::mutex> lock(sessions_mutex_);
+  if (session < 0 || (std::size_t)session >= sessions_.size()) {
+    return nullptr;
+  }
+  return sessions_[session];
+}
+
+int EncoderEngine::waitIdle(Session *session)
+{
+  std::unique_lock<std::mutex> lock(session->mutex);
+  session->changed.wait(lock, [session] { return !session->scheduled; });
+  return session->error;
+}
+
+void EncoderEngine::runSession(void *argument)
+{
+  Session *s = static_cast<Session *>(argument);
+  uint32_t max_length = s->engine->getMaxInputLength();
+  bool more = true;
+  for (std::size_t i = 0; more && i < kBlocksPerTask; i++) {
+    Block *block = nullptr;
+    bool failed = false;
+    {
+      std::lock_guard<std::mutex> lock(s->mutex);
+      assert(s->scheduled && !s->queue.empty());
+      block = s->queue.front();
+      s->queue.pop_front();
+      failed = s->error != OK;
+      s->changed.notify_all();
+    }
+
+    // After an error the blocks are dropped, submit() reports it.
+    if (!failed) {
+      for (uint8_t ch = 0; ch < s->channel_count; ch++) {
+        memcpy(s->pipeline.getInputBuffer(ch), &block->samples[ch * max_length],
+               block->length * sizeof(float));
+      }
+      int err = OK;
+      if (block->frame_size != 0) {
+        err = s->pipeline.setFrameSize(block->frame_size);
+      }
+      if (err == OK) {
+        err = s->pipeline.encode(block->length);
+      }
+      if (err != OK) {
+        std::lock_guard<std::mutex> lock(s->mutex);
+        s->error = err;
+      }
+    }
+
+    std::lock_guard<std::mutex> lock(s->mutex);
+    s->free_blocks.push_back(block);
+    more = !s->queue.empty();
+    if (!more) {
+      // The session may be deleted as soon as the lock is released.
+      s->scheduled = false;
+      s->changed.notify_all();
+    }
+  }
+  // Go to the back of the deque, so a session with a long backlog takes
+  // turns with the others.
+  if (more) {
+    s->engine->pool_.submit(runSession, s);
+  }
+}
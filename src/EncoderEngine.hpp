@@ -0,0 +1,172 @@
+#ifndef ENCODERENGINE_H_
+#define ENCODERENGINE_H_
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <vector>
+#include "ContainerInterface.hpp"
+#include "EncoderPipeline.hpp"
+#include "ThreadPool.hpp"
+
+/**
+ * @brief Many independent encoding sessions on one ThreadPool.
+ *
+ *    A session is an EncoderPipeline writing to its own container, which
+ *    writes to its own OutputSink. submit() copies the input of a session into
+ *    a queued block and returns; the blocks are encoded and muxed in order by
+ *    whichever thread of the pool picks the session up. A session runs on one
+ *    thread at a time, so neither the pipeline, the container nor the sink
+ *    need to be thread-safe, and different sessions never share any state.
+ *
+ *    A session has a bounded queue. submit() waits when it is full, so a
+ *    producer faster than the pool cannot grow memory without limit.
+ *
+ * ## How to use
+ *
+ *    1. Instantiate with the number of threads.
+ *    2. Make a container and set its output sink, then call openSession().
+ *       The container is not owned and must not be initialized yet.
+ *    3. Copy up to getMaxInputLength() samples of each channel to
+ *       getInputBuffer(session, channel), then call submit(). The buffers
+ *       can be reused as soon as submit() returns.
+ *    4. Call drain() before reading the output sink or the stats of the
+ *       container from another thread.
+ *    5. Call closeSession(), then destroy the container to finish the file,
+ *       or finish() it to open another session on it.
+ *
+ *    Functions of different sessions can be called from different threads.
+ *    Functions of one session must be called from one thread at a time.
+ */
+class EncoderEngine
+{
+public:
+  enum Error {
+    OK = EncoderPipeline::OK,
+    // EncoderPipeline::Error are returned as they are
+    ERR_INVALID_SESSION = -16
+  };
+
+  /**
+   * @param thread_count    The number of threads, or 0 for one per core
+   */
+  explicit EncoderEngine(unsigned thread_count = 0);
+
+  /**
+   * @brief Close the sessions still open and join the threads.
+   */
+  ~EncoderEngine();
+
+  /**
+   * @brief Start a session. See EncoderPipeline::init().
+   *
+   * @param container           An uninitialized container with an output sink
+   * @param input_sample_rate   Sampling rate of the input
+   * @param channel_count       The number of channels, up to 8
+   * @param bitrate             Bits per second, or <= 0 to let libopus decide
+   * @param serial              Unique number of the stream
+   * @param resample_quality    0 to 10, lower is faster
+   * @param frame_size          Samples per channel of a frame at 48000 Hz
+   * @return int                The session, >= 0, or one of EncoderPipeline::Error
+   */
+  int openSession(ContainerInterface *container, uint32_t input_sample_rate,
+                  uint8_t channel_count, int bitrate, int serial,
+                  int resample_quality = EncoderPipeline::kDefaultResampleQuality,
+                  uint32_t frame_size = EncoderPipeline::kDefaultFrameSize);
+
+  /**
+   * @brief Change the frame size of a session, in order with the blocks: it
+   *        applies from the first frame of the next block submitted.
+   *
+   * @return int      OK, ERR_INVALID_SESSION or ERR_INVALID_FRAME_SIZE
+   */
+  int setFrameSize(int session, uint32_t frame_size);
+
+  /**
+   * @brief Change an encoder setting of a session, see
+   *        EncoderPipeline::setControl(). It waits for the blocks submitted
+   *        so far, so they are encoded with the old setting.
+   *
+   * @return int      OK, ERR_INVALID_SESSION or ERR_INVALID_CONTROL
+   */
+  int setControl(int session, int control, int value);
+
+  /**
+   * @brief Planar input buffer of a channel, getMaxInputLength() samples long.
+   */
+  float *getInputBuffer(int session, uint8_t channel);
+  uint32_t getMaxInputLength() const;
+
+  /**
+   * @brief Queue the samples copied to the input buffers.
+   *
+   * @param length    The number of samples per channel, up to getMaxInputLength()
+   * @return int      OK, or the first error of the session so far
+   */
+  int submit(int session, uint32_t length);
+
+  /**
+   * @brief Wait until every block submitted so far is encoded and muxed.
+   *
+   * @return int      OK, or the first error of the session so far
+   */
+  int drain(int session);
+
+  /**
+   * @brief The pipeline of a session, e.g. for its time histograms. Read it
+   *        only after drain().
+   */
+  const EncoderPipeline *getPipeline(int session) const;
+
+  /**
+   * @brief Drain, encode the samples left in the last frame and end the
+   *        session. The container can be destroyed or finished afterwards.
+   *
+   * @return int      OK, or the first error of the session
+   */
+  int closeSession(int session);
+
+  unsigned getThreadCount() const;
+
+private:
+  // Blocks a session can have queued, about 3 seconds of audio at 44.1 kHz
+  static const std::size_t kMaxQueuedBlocks = 32;
+  // Blocks encoded before a session yields its thread to the next one
+  static const std::size_t kBlocksPerTask = 4;
+
+  struct Block {
+    std::vector<float> samples;   // Planar, getMaxInputLength() per channel
+    uint32_t length;
+    uint32_t frame_size;          // New frame size from this block on, or 0
+  };
+
+  struct Session {
+    explicit Session(ContainerInterface *container);
+    ~Session();
+
+    EncoderEngine *engine;
+    EncoderPipeline pipeline;
+    uint8_t channel_count;
+    std::vector<float> input;     // Planar, written by the caller
+    uint32_t next_frame_size;     // For the next block, or 0. Caller only.
+
+    // Guarded by mutex
+    std::mutex mutex;
+    std::condition_variable changed;  // A block was taken or the queue ran dry
+    std::deque<Block *> queue;
+    std::vector<Block *> free_blocks;
+    bool scheduled;                   // Queued in the pool or running
+    int error;
+  };
+
+  ThreadPool pool_;
+  mutable std::mutex sessions_mutex_;
+  std::vector<Session *> sessions_;   // nullptr for a closed session
+
+  Session *getSession(int session) const;
+  int waitIdle(Session *session);   // Returns the error of the session
+  static void runSession(void *argument);
+};
+
+#endif /* ENCODERENGINE_H_ */
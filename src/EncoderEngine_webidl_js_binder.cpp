@@ -0,0 +1,15 @@
+/**
+ * Reference: https://kripken.github.io/emscripten-site/docs/porting/connecting_cpp_and_javascript/WebIDL-Binder.html#compiling-the-project-using-the-bindings-glue-code
+ * This is a requriement by Emscripten to bind C++ classes with JS.
+ *
+ * Binder of the multi-session (pthreads) module, with both containers.
+ */
+
+#include "OggContainer.hpp"
+#include "WebMContainer.hpp"
+#include "OggReader.hpp"
+#include "WebMReader.hpp"
+#include "EncoderPipeline.hpp"
+#include "EncoderEngine.hpp"
+// This is an auto-generated code by Emscripten located in /build directory.
+#include "OggWebMContainerMT.webidl_glue.cpp"
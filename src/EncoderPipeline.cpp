@@ -0,0 +1,631 @@
+#include "EncoderPipeline.hpp"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+
+namespace {
+  /**
+   * Index of the input channel of each channel in Vorbis order, from Web Audio
+   * and WAVE channel order. See https://tools.ietf.org/html/rfc7845#section-5.1.1.2
+   */
+  const uint8_t kVorbisOrder[ContainerInterface::kMaxChannelCount][ContainerInterface::kMaxChannelCount] = {
+    {0},                        // Mono
+    {0, 1},                     // L R
+    {0, 2, 1},                  // L R C             -> L C R
+    {0, 1, 2, 3},               // L R SL SR
+    {0, 2, 1, 3, 4},            // L R C SL SR       -> L C R SL SR
+    {0, 2, 1, 4, 5, 3},         // L R C LFE SL SR   -> L C R SL SR LFE
+    {0, 2, 1, 5, 6, 4, 3},      // L R C LFE BC SL SR -> L C R SL SR BC LFE
+    {0, 2, 1, 6, 7, 4, 5, 3}    // L R C LFE BL BR SL SR -> L C R SL SR BL BR LFE
+  };
+}
+
+EncoderPipeline::EncoderPipeline(ContainerInterface *container)
+  : container_(container),
+    encoder_(nullptr),
+    surround_encoder_(nullptr),
+    resampler_(nullptr),
+    polyphase_(),
+    track_(0),
+    default_complexity_(0),
+    complexity_(0),
+    adaptive_complexity_(false),
+    governor_(),
+    silence_threshold_db_(0),
+    silence_threshold_(0.0f),
+    silent_samples_(0),
+    gated_frames_(0),
+    channel_count_(0),
+    input_sample_rate_(0),
+    resample_quality_(kDefaultResampleQuality),
+    input_order_(nullptr),
+    input_block_length_(0),
+    output_frame_length_(kDefaultFrameSize),
+    next_frame_length_(kDefaultFrameSize),
+    frame_index_(0),
+    resampled_length_(0)
+{
+  assert(container_);
+}
+
+EncoderPipeline::~EncoderPipeline()
+{
+  destroy();
+}
+
+int EncoderPipeline::init(uint32_t input_sample_rate, uint8_t channel_count,
+                          int bitrate, int serial, int resample_quality,
+                          uint32_t frame_size)
+{
+  if (channel_count == 0 || channel_count > ContainerInterface::kMaxChannelCount) {
+    destroy();
+    return ERR_ENCODER_INIT;
+  }
+  if (resample_quality < 0 || resample_quality > SPEEX_RESAMPLER_QUALITY_MAX) {
+    destroy();
+    return ERR_RESAMPLER_INIT;
+  }
+  if (!isValidFrameSize(frame_size)) {
+    destroy();
+    return ERR_INVALID_FRAME_SIZE;
+  }
+  // A pipeline initialized before keeps its encoder and resampler if the
+  // format is the same, and only clears their state. The encoder only exists
+  // if the resampler was made too.
+  uint32_t input_block_length = inputBlockLength(input_sample_rate, frame_size);
+  bool reuse = (encoder_ || surround_encoder_)
+               && channel_count == channel_count_
+               && input_sample_rate == input_sample_rate_
+               && (input_sample_rate == kOutputSampleRate
+                   || (resample_quality == resample_quality_
+                       && input_block_length == input_block_length_));
+  if (!reuse) {
+    destroy();
+  }
+  channel_count_ = channel_count;
+  input_sample_rate_ = input_sample_rate;
+  resample_quality_ = resample_quality;
+  input_order_ = kVorbisOrder[channel_count - 1];
+  input_block_length_ = input_block_length;
+  output_frame_length_ = frame_size;
+  next_frame_length_ = frame_size;
+  frame_index_ = 0;
+  resampled_length_ = 0;
+
+  int err;
+  if (reuse) {
+    err = resetEncoder(bitrate);
+    resetResampler();
+  } else {
+    err = createEncoder(bitrate);
+    if (err == OK) {
+      err = createResampler();
+    }
+    if (err != OK) {
+      destroy();
+    }
+  }
+  if (err != OK) {
+    return err;
+  }
+  // Only once the encoder is ready, so a failure leaves no empty track.
+  if (container_->getTrackCount() == 0) {
+    container_->init(kOutputSampleRate, channel_count, serial);
+    track_ = 0;
+  } else {
+    track_ = container_->addTrack(channel_count, serial);
+  }
+  complexity_ = default_complexity_;
+  adaptive_complexity_ = false;
+  governor_.reset(complexity_);
+  silence_threshold_db_ = 0;
+  silence_threshold_ = 0.0f;
+  silent_samples_ = 0;
+  gated_frames_ = 0;
+
+  // The capacity is kept, so reinitializing does not allocate either.
+  input_.assign(kMaxInputLength * channel_count, 0.0f);
+  if (input_sample_rate == kOutputSampleRate) {
+    // Any frame size fits, so setFrameSize() does not allocate.
+    frame_.assign(kMaxFrameSize * channel_count, 0.0f);
+    resampled_.clear();
+  } else {
+    // A frame short of being complete, plus the output of a block. SpeexDSP
+    // may give a sample more than the exact ratio as its phase wraps.
+    uint64_t block_output = (uint64_t)input_block_length_ * kOutputSampleRate
+                            / input_sample_rate + 2;
+    frame_.assign(input_block_length_ * channel_count, 0.0f);
+    resampled_.assign((kMaxFrameSize + block_output) * channel_count, 0.0f);
+  }
+  // A multistream packet holds a packet of every stream
+  packet_.assign(kMaxPacketSize * container_->getChannelMapping(track_).stream_count, 0);
+  encode_time_.clear();
+  mux_time_.clear();
+  return OK;
+}
+
+int EncoderPipeline::createEncoder(int bitrate)
+{
+  int err;
+  if (channel_count_ <= 2) {
+    encoder_ = opus_encoder_create(kOutputSampleRate, channel_count_,
+                                   kApplication, &err);
+    if (err != OPUS_OK) {
+      encoder_ = nullptr;
+      return ERR_ENCODER_INIT;
+    }
+  } else {
+    const ContainerInterface::ChannelMapping expected =
+        ContainerInterface::channelMapping(channel_count_);
+    int stream_count;
+    int coupled_count;
+    uint8_t mapping[ContainerInterface::kMaxChannelCount];
+    surround_encoder_ = opus_multistream_surround_encoder_create(
+        kOutputSampleRate, channel_count_, expected.family,
+        &stream_count, &coupled_count, mapping, kApplication, &err);
+    if (err != OPUS_OK) {
+      surround_encoder_ = nullptr;
+      return ERR_ENCODER_INIT;
+    }
+    // The container describes the streams the same way in its ID header.
+    assert(stream_count == expected.stream_count);
+    assert(coupled_count == expected.coupled_count);
+    assert(memcmp(mapping, expected.mapping, channel_count_) == 0);
+  }
+  /** Configures the bitrate in the encoder.
+   * Rates from 500 to 512000 bits per second are meaningful, as well as the
+   * special values #OPUS_AUTO (-1000) and #OPUS_BITRATE_MAX (-1).
+   * The default is determined based on the number of channels and the input
+   * sampling rate. With multiple streams it is the total of all streams.
+   */
+  if (bitrate > 0) {
+    if (encoder_) {
+      opus_encoder_ctl(encoder_, OPUS_SET_BITRATE(bitrate));
+    } else {
+      opus_multistream_encoder_ctl(surround_encoder_, OPUS_SET_BITRATE(bitrate));
+    }
+  }
+  // It depends on how libopus was built, and reset restores it.
+  opus_int32 complexity;
+  if (encoderGetCtl(OPUS_GET_COMPLEXITY(&complexity)) != OK) {
+    return ERR_ENCODER_INIT;
+  }
+  default_complexity_ = complexity;
+  return OK;
+}
+
+int EncoderPipeline::resetEncoder(int bitrate)
+{
+  // The same as a new encoder: OPUS_AUTO unless a bitrate is given
+  opus_int32 value = bitrate > 0 ? bitrate : OPUS_AUTO;
+  int err;
+  if (encoder_) {
+    err = opus_encoder_ctl(encoder_, OPUS_RESET_STATE);
+    if (err == OPUS_OK) {
+      err = opus_encoder_ctl(encoder_, OPUS_SET_BITRATE(value));
+    }
+  } else {
+    err = opus_multistream_encoder_ctl(surround_encoder_, OPUS_RESET_STATE);
+    if (err == OPUS_OK) {
+      err = opus_multistream_encoder_ctl(surround_encoder_, OPUS_SET_BITRATE(value));
+    }
+  }
+  // OPUS_RESET_STATE keeps the controls, so those the last recording may have
+  // changed go back to their defaults here.
+  if (err != OPUS_OK
+      || encoderCtl(OPUS_SET_COMPLEXITY(default_complexity_)) != OK
+      || encoderCtl(OPUS_SET_VBR(1)) != OK
+      || encoderCtl(OPUS_SET_BANDWIDTH(OPUS_AUTO)) != OK
+      || encoderCtl(OPUS_SET_DTX(0)) != OK) {
+    return ERR_ENCODER_INIT;
+  }
+  return OK;
+}
+
+int EncoderPipeline::encoderCtl(int request, opus_int32 value)
+{
+  assert(encoder_ || surround_encoder_);
+  int err = encoder_
+            ? opus_encoder_ctl(encoder_, request, value)
+            : opus_multistream_encoder_ctl(surround_encoder_, request, value);
+  return err == OPUS_OK ? OK : ERR_INVALID_CONTROL;
+}
+
+int EncoderPipeline::encoderGetCtl(int request, opus_int32 *value) const
+{
+  assert(encoder_ || surround_encoder_);
+  // A multistream encoder answers for its first stream.
+  int err = encoder_
+            ? opus_encoder_ctl(encoder_, request, value)
+            : opus_multistream_encoder_ctl(surround_encoder_, request, value);
+  return err == OPUS_OK ? OK : ERR_INVALID_CONTROL;
+}
+
+int EncoderPipeline::setControl(int control, int value)
+{
+  switch (control) {
+    case CONTROL_BITRATE:
+      return encoderCtl(OPUS_SET_BITRATE(value > 0 ? value : OPUS_AUTO));
+
+    case CONTROL_COMPLEXITY:
+      if (value < 0 || value > 10) {
+        return ERR_INVALID_CONTROL;
+      }
+      complexity_ = value;
+      // The governor starts over from the new highest complexity.
+      governor_.reset(complexity_);
+      return encoderCtl(OPUS_SET_COMPLEXITY(complexity_));
+
+    case CONTROL_VBR:
+      return encoderCtl(OPUS_SET_VBR(value != 0));
+
+    case CONTROL_BANDWIDTH:
+      return encoderCtl(OPUS_SET_BANDWIDTH(value));
+
+    case CONTROL_ADAPTIVE_COMPLEXITY:
+      adaptive_complexity_ = value != 0;
+      governor_.reset(complexity_);
+      return encoderCtl(OPUS_SET_COMPLEXITY(complexity_));
+
+    case CONTROL_DTX:
+      return encoderCtl(OPUS_SET_DTX(value != 0));
+
+    case CONTROL_SILENCE_THRESHOLD:
+      if (value > 0) {
+        return ERR_INVALID_CONTROL;
+      }
+      silence_threshold_db_ = value;
+      silence_threshold_ = value < 0 ? std::pow(10.0f, value / 10.0f) : 0.0f;
+      silent_samples_ = 0;
+      return OK;
+
+    default:
+      return ERR_INVALID_CONTROL;
+  }
+}
+
+int EncoderPipeline::getControl(int control) const
+{
+  opus_int32 value;
+  int err;
+  switch (control) {
+    case CONTROL_BITRATE:
+      err = encoderGetCtl(OPUS_GET_BITRATE(&value));
+      break;
+
+    case CONTROL_COMPLEXITY:
+      return adaptive_complexity_ ? governor_.getComplexity() : complexity_;
+
+    case CONTROL_VBR:
+      err = encoderGetCtl(OPUS_GET_VBR(&value));
+      break;
+
+    case CONTROL_BANDWIDTH:
+      err = encoderGetCtl(OPUS_GET_BANDWIDTH(&value));
+      break;
+
+    case CONTROL_ADAPTIVE_COMPLEXITY:
+      return adaptive_complexity_;
+
+    case CONTROL_DTX:
+      err = encoderGetCtl(OPUS_GET_DTX(&value));
+      break;
+
+    case CONTROL_SILENCE_THRESHOLD:
+      return silence_threshold_db_;
+
+    default:
+      return ERR_INVALID_CONTROL;
+  }
+  return err == OK ? value : err;
+}
+
+int EncoderPipeline::setFrameSize(uint32_t frame_size)
+{
+  if (!isValidFrameSize(frame_size)) {
+    return ERR_INVALID_FRAME_SIZE;
+  }
+  next_frame_length_ = frame_size;
+  // At 48000 Hz frame_ is the frame, which has not started yet.
+  if (input_sample_rate_ == kOutputSampleRate && frame_index_ == 0) {
+    input_block_length_ = frame_size;
+    output_frame_length_ = frame_size;
+  }
+  return OK;
+}
+
+uint32_t EncoderPipeline::getFrameSize() const
+{
+  return next_frame_length_;
+}
+
+bool EncoderPipeline::isValidFrameSize(uint32_t frame_size)
+{
+  switch (frame_size) {
+    case 120: case 240: case 480: case 960: case 1920: case 2880:
+      return true;
+    default:
+      return false;
+  }
+}
+
+uint32_t EncoderPipeline::inputBlockLength(uint32_t input_sample_rate,
+                                           uint32_t frame_size)
+{
+  if (input_sample_rate == kOutputSampleRate) {
+    return frame_size;
+  }
+  if (input_sample_rate == PolyphaseResampler::kInputSampleRate) {
+    // Whole periods of 147 input samples, e.g. 6 of them for 20 ms.
+    return PolyphaseResampler::kInputPeriod
+           * std::max<uint32_t>(1, frame_size / PolyphaseResampler::kOutputPeriod);
+  }
+  // About a frame, rounded down
+  return std::max<uint32_t>(1, (uint64_t)input_sample_rate * frame_size
+                               / kOutputSampleRate);
+}
+
+int EncoderPipeline::createResampler(void)
+{
+  switch (input_sample_rate_) {
+    case kOutputSampleRate:
+      // Nothing to resample
+      return OK;
+
+    case PolyphaseResampler::kInputSampleRate:
+      if (!polyphase_.init(channel_count_, resample_quality_, input_block_length_)) {
+        return ERR_RESAMPLER_INIT;
+      }
+      return OK;
+
+    default:
+      int err;
+      resampler_ = speex_resampler_init(channel_count_, input_sample_rate_,
+                                        kOutputSampleRate, resample_quality_, &err);
+      if (err != RESAMPLER_ERR_SUCCESS) {
+        resampler_ = nullptr;
+        return ERR_RESAMPLER_INIT;
+      }
+      return OK;
+  }
+}
+
+void EncoderPipeline::resetResampler(void)
+{
+  if (resampler_) {
+    speex_resampler_reset_mem(resampler_);
+  } else if (input_sample_rate_ == PolyphaseResampler::kInputSampleRate) {
+    polyphase_.reset();
+  }
+}
+
+int EncoderPipeline::getTrack() const
+{
+  return track_;
+}
+
+float *EncoderPipeline::getInputBuffer(uint8_t channel)
+{
+  assert(channel < channel_count_);
+  return &input_[channel * kMaxInputLength];
+}
+
+uint32_t EncoderPipeline::getMaxInputLength() const
+{
+  return kMaxInputLength;
+}
+
+int EncoderPipeline::encode(uint32_t length)
+{
+  assert(encoder_ || surround_encoder_);
+  assert(length <= kMaxInputLength);
+
+  uint32_t index = 0;
+  while (index < length) {
+    // Interleave as many samples as the current frame or block can take.
+    // Format: | ch0 | ch1 | ch0 | ch1 | ch0 | ch1 | ch0 | ch1 | ...
+    // Surround channels are put in Vorbis order at the same time.
+    uint32_t frame_offset = frame_index_ / channel_count_;
+    uint32_t count = std::min(input_block_length_ - frame_offset, length - index);
+    for (uint8_t ch = 0; ch < channel_count_; ch++) {
+      const float *src = &input_[input_order_[ch] * kMaxInputLength + index];
+      float *dst = &frame_[frame_offset * channel_count_ + ch];
+      for (uint32_t i = 0; i < count; i++) {
+        dst[i * channel_count_] = src[i];
+      }
+    }
+    frame_index_ += count * channel_count_;
+    index += count;
+
+    // When the frame or block is full, then encode.
+    if (frame_index_ >= input_block_length_ * channel_count_) {
+      int err = processBlock();
+      if (err != OK) {
+        return err;
+      }
+    }
+  }
+  return OK;
+}
+
+int EncoderPipeline::close(void)
+{
+  assert(encoder_ || surround_encoder_);
+  // Fill the rest of the current frame or block with silence.
+  std::fill(frame_.begin() + frame_index_,
+            frame_.begin() + input_block_length_ * channel_count_, 0.0f);
+  if (frame_index_ > 0) {
+    int err = processBlock();
+    if (err != OK) {
+      return err;
+    }
+  }
+  // Plus a whole frame of silence
+  if (input_sample_rate_ == kOutputSampleRate) {
+    std::fill(frame_.begin(), frame_.begin() + input_block_length_ * channel_count_, 0.0f);
+    return processBlock();
+  }
+  std::fill(frame_.begin(), frame_.end(), 0.0f);
+  uint64_t silence = 0;
+  while (silence * kOutputSampleRate < (uint64_t)output_frame_length_ * input_sample_rate_) {
+    int err = processBlock();
+    if (err != OK) {
+      return err;
+    }
+    silence += input_block_length_;
+  }
+  // What is left in the FIFO is padded to a frame.
+  return encodeResampled(true);
+}
+
+const TimeHistogram &EncoderPipeline::getEncodeTime() const
+{
+  return encode_time_;
+}
+
+const TimeHistogram &EncoderPipeline::getMuxTime() const
+{
+  return mux_time_;
+}
+
+uint32_t EncoderPipeline::getGatedFrameCount() const
+{
+  return gated_frames_;
+}
+
+int EncoderPipeline::processBlock(void)
+{
+  frame_index_ = 0;
+  if (input_sample_rate_ == kOutputSampleRate) {
+    // The block is a frame, encoded as it is.
+    int err = encodePacket(frame_.data());
+    input_block_length_ = next_frame_length_;
+    output_frame_length_ = next_frame_length_;
+    return err;
+  }
+
+  // Resample the block to the end of the FIFO.
+  float *output = &resampled_[resampled_length_ * channel_count_];
+  if (resampler_) {
+    spx_uint32_t input_length = input_block_length_;
+    spx_uint32_t output_length = resampled_.size() / channel_count_ - resampled_length_;
+    int err = speex_resampler_process_interleaved_float(resampler_,
+                                                        frame_.data(), &input_length,
+                                                        output, &output_length);
+    if (err != RESAMPLER_ERR_SUCCESS || input_length != input_block_length_) {
+      return ERR_RESAMPLING;
+    }
+    resampled_length_ += output_length;
+  } else {
+    resampled_length_ += polyphase_.process(frame_.data(), input_block_length_, output);
+  }
+  return encodeResampled(false);
+}
+
+int EncoderPipeline::encodeResampled(bool pad)
+{
+  uint32_t offset = 0;
+  while (true) {
+    // A new frame size applies to the samples not encoded yet.
+    output_frame_length_ = next_frame_length_;
+    uint32_t left = resampled_length_ - offset;
+    if (left == 0 || (left < output_frame_length_ && !pad)) {
+      break;
+    }
+    if (left < output_frame_length_) {
+      std::fill(resampled_.begin() + resampled_length_ * channel_count_,
+                resampled_.begin() + (offset + output_frame_length_) * channel_count_,
+                0.0f);
+      resampled_length_ = offset + output_frame_length_;
+    }
+    int err = encodePacket(&resampled_[offset * channel_count_]);
+    if (err != OK) {
+      return err;
+    }
+    offset += output_frame_length_;
+  }
+  // Move the rest, shorter than a frame, to the front for the next block.
+  if (offset > 0) {
+    std::memmove(resampled_.data(), &resampled_[offset * channel_count_],
+                 (resampled_length_ - offset) * channel_count_ * sizeof(float));
+    resampled_length_ -= offset;
+  }
+  return OK;
+}
+
+int EncoderPipeline::encodePacket(const float *pcm)
+{
+  if (silence_threshold_ > 0.0f && isSilent(pcm)) {
+    silent_samples_ += output_frame_length_;
+    if (silent_samples_ > kSilenceHangover) {
+      // Neither encoded nor timed, the container skips it.
+      container_->writeTrackGap(track_, output_frame_length_);
+      gated_frames_++;
+      return OK;
+    }
+  } else {
+    if (silent_samples_ > kSilenceHangover) {
+      // The decoder concealed the gap, as if packets were lost. Code the
+      // first frame after it without reference to the ones before.
+      if (encoder_) {
+        opus_encoder_ctl(encoder_, OPUS_RESET_STATE);
+      } else {
+        opus_multistream_encoder_ctl(surround_encoder_, OPUS_RESET_STATE);
+      }
+    }
+    silent_samples_ = 0;
+  }
+
+  // Only the encoder is timed, the governor can make it faster.
+  double start = TimeHistogram::now();
+  opus_int32 packet_length;
+  if (encoder_) {
+    packet_length = opus_encode_float(encoder_, pcm, output_frame_length_,
+                                      packet_.data(), packet_.size());
+  } else {
+    packet_length = opus_multistream_encode_float(surround_encoder_, pcm,
+                                                  output_frame_length_,
+                                                  packet_.data(), packet_.size());
+  }
+  if (packet_length < 0) {
+    return ERR_ENCODING;
+  }
+  double encoded = TimeHistogram::now();
+  // Input packet to Ogg or WebM page generator
+  container_->writeTrackFrame(track_, packet_.data(), packet_length,
+                              output_frame_length_);
+  encode_time_.add(encoded - start);
+  if (adaptive_complexity_
+      && governor_.update(encoded - start, output_frame_length_)) {
+    encoderCtl(OPUS_SET_COMPLEXITY(governor_.getComplexity()));
+  }
+  mux_time_.add(TimeHistogram::now() - encoded);
+  return OK;
+}
+
+bool EncoderPipeline::isSilent(const float *pcm) const
+{
+  uint32_t length = output_frame_length_ * channel_count_;
+  float power = 0.0f;
+  for (uint32_t i = 0; i < length; i++) {
+    power += pcm[i] * pcm[i];
+  }
+  return power < silence_threshold_ * length;
+}
+
+void EncoderPipeline::destroy(void)
+{
+  if (encoder_) {
+    opus_encoder_destroy(encoder_);
+    encoder_ = nullptr;
+  }
+  if (surround_encoder_) {
+    opus_multistream_encoder_destroy(surround_encoder_);
+    surround_encoder_ = nullptr;
+  }
+  if (resampler_) {
+    speex_resampler_destroy(resampler_);
+    resampler_ = nullptr;
+  }
+}
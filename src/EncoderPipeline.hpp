@@ -0,0 +1,258 @@
+#ifndef ENCODERPIPELINE_H_
+#define ENCODERPIPELINE_H_
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include "lib/opus/include/opus.h"
+#include "lib/opus/include/opus_multistream.h"
+#include "lib/speexdsp/include/speex/speex_resampler.h"
+#include "ComplexityGovernor.hpp"
+#include "ContainerInterface.hpp"
+#include "PolyphaseResampler.hpp"
+#include "TimeHistogram.hpp"
+
+/**
+ * @brief Resampler, Opus encoder and container chained together.
+ *
+ *    A block of planar input samples is copied into the input buffers once,
+ *    then encode() interleaves, resamples, encodes and muxes every complete
+ *    frame of the block without leaving WASM. All buffers are allocated by
+ *    init(), so nothing is allocated per frame.
+ *
+ *    Mono and stereo use the plain Opus encoder. From 3 up to 8 channels the
+ *    surround multistream encoder codes channel pairs as coupled stereo
+ *    streams, using the mapping of ContainerInterface::channelMapping().
+ *    Input channels are in Web Audio (and WAVE) order, e.g. L R C LFE SL SR
+ *    for 5.1, and are reordered to Vorbis order while interleaving.
+ *
+ *    |input buffers| =={interleave}=> |frame| =={resampler}=> |resampled|
+ *      =={encoder}=> |packet| =={container}=> output sink
+ *
+ *    The resampler depends on the input rate. 48000 Hz input is encoded as it
+ *    is, 44100 Hz goes through PolyphaseResampler and any other rate through
+ *    SpeexDSP. The quality is the same 0 to 10 scale for both.
+ *
+ *    Frames are 2.5, 5, 10, 20, 40 or 60 ms long, 20 ms by default, and the
+ *    duration can change between any two frames. At 48000 Hz frame_ is one
+ *    frame. Otherwise frame_ is a block of input resampled at once, sized for
+ *    the frame duration given to init(), and resampled_ is a FIFO the frames
+ *    are encoded from, so the block and the frame do not have to line up.
+ *
+ *    Encoder settings can change at any time with setControl(). With
+ *    CONTROL_ADAPTIVE_COMPLEXITY a ComplexityGovernor lowers the complexity
+ *    while frames take too long to encode, e.g. on a busy phone.
+ *
+ *    Silence can be cheap in two ways. CONTROL_DTX lets libopus send tiny
+ *    packets for it. CONTROL_SILENCE_THRESHOLD gates frames quieter than the
+ *    threshold before the encoder, once 200 ms of them have passed, so they
+ *    cost no encoding at all and are written with
+ *    ContainerInterface::writeTrackGap().
+ *
+ * ## How to use
+ *
+ *    1. Instantiate with a container. The container is not owned.
+ *    2. Call init(). The first pipeline of a container initializes it, the
+ *       following ones add a track to it, so several pipelines can feed one
+ *       multi-track container.
+ *    3. Copy up to getMaxInputLength() samples of each channel to
+ *       getInputBuffer(channel), then call encode() with the number of samples.
+ *    4. Call close() to encode the samples left in the last frame.
+ *    5. To record again, finish() the container and call init() again. With
+ *       the same channel count, input rate and resampling quality the encoder
+ *       and the resampler are reused, so a warm pipeline starts without
+ *       allocating.
+ */
+class EncoderPipeline
+{
+public:
+  // The same as BUFFER_SIZE of OpusMediaRecorder.js
+  static const uint32_t kMaxInputLength = 4096;
+  // Resampling quality, between 0 and 10 inclusive. 10 being highest quality.
+  static const int kDefaultResampleQuality = 6;
+  // Samples per channel of a frame at 48000 Hz: 20 ms by default, 60 ms at most
+  static const uint32_t kDefaultFrameSize = 960;
+  static const uint32_t kMaxFrameSize = 2880;
+
+  enum Error {
+    OK = 0,
+    ERR_ENCODER_INIT = -1,
+    ERR_RESAMPLER_INIT = -2,
+    ERR_RESAMPLING = -3,
+    ERR_ENCODING = -4,
+    ERR_INVALID_FRAME_SIZE = -5,
+    ERR_INVALID_CONTROL = -6
+  };
+
+  // Encoder settings of setControl() and getControl()
+  enum Control {
+    CONTROL_BITRATE = 0,              // Bits per second, <= 0 to let libopus decide
+    CONTROL_COMPLEXITY = 1,           // 0 to 10, the highest with adaptive complexity
+    CONTROL_VBR = 2,                  // 1 for VBR, the default, 0 for CBR
+    CONTROL_BANDWIDTH = 3,            // OPUS_AUTO, the default, or OPUS_BANDWIDTH_*
+    CONTROL_ADAPTIVE_COMPLEXITY = 4,  // 1 to let a ComplexityGovernor lower it
+    CONTROL_DTX = 5,                  // 1 for discontinuous transmission
+    CONTROL_SILENCE_THRESHOLD = 6     // Gate below this power in dBFS, 0 for none
+  };
+
+  EncoderPipeline(ContainerInterface *container);
+  ~EncoderPipeline();
+
+  /**
+   * @brief Initialize the pipeline and the container, or a new track of it.
+   *        Also starts a new recording after close() once the container is
+   *        finished, see ContainerInterface::finish(). The container is
+   *        only touched once the encoder and the resampler are ready, so an
+   *        error leaves it as it was.
+   *
+   * @param input_sample_rate   Sampling rate of the input, usually 44100 or 48000
+   * @param channel_count       The number of channels, up to 8
+   * @param bitrate             Bits per second, or <= 0 to let libopus decide
+   * @param serial              Unique number of the stream passed to the container
+   * @param resample_quality    0 to 10, lower is faster. Unused at 48000 Hz.
+   * @param frame_size          Samples per channel of a frame at 48000 Hz,
+   *                            see isValidFrameSize()
+   * @return int                OK or one of Error
+   */
+  int init(uint32_t input_sample_rate, uint8_t channel_count, int bitrate, int serial,
+           int resample_quality = kDefaultResampleQuality,
+           uint32_t frame_size = kDefaultFrameSize);
+
+  /**
+   * @brief Change the frame size from the next frame on. The frame being
+   *        filled, if any, keeps its size. Timestamps stay exact as every
+   *        frame is written with its own number of samples.
+   *
+   * @param frame_size    Samples per channel of a frame at 48000 Hz
+   * @return int          OK or ERR_INVALID_FRAME_SIZE
+   */
+  int setFrameSize(uint32_t frame_size);
+  uint32_t getFrameSize() const;
+
+  /**
+   * @brief Whether Opus has frames of this many samples at 48000 Hz:
+   *        120, 240, 480, 960, 1920 or 2880 (2.5 to 60 ms).
+   */
+  static bool isValidFrameSize(uint32_t frame_size);
+
+  /**
+   * @brief Change an encoder setting from the next frame on. init() sets
+   *        them all back to the defaults of libopus, but the bitrate.
+   *
+   * @param control   One of Control
+   * @param value     See Control
+   * @return int      OK or ERR_INVALID_CONTROL
+   */
+  int setControl(int control, int value);
+
+  /**
+   * @brief The setting in use. The bitrate and the bandwidth are those
+   *        libopus chose when they are automatic, and the complexity is the
+   *        one the governor chose when it is adaptive.
+   *
+   * @return int      The value, or ERR_INVALID_CONTROL
+   */
+  int getControl(int control) const;
+
+  /**
+   * @brief The container track this pipeline writes to.
+   */
+  int getTrack() const;
+
+  /**
+   * @brief Planar input buffer of a channel, getMaxInputLength() samples long.
+   */
+  float *getInputBuffer(uint8_t channel);
+  uint32_t getMaxInputLength() const;
+
+  /**
+   * @brief Encode the samples copied to the input buffers.
+   *
+   * @param length    The number of samples per channel, up to getMaxInputLength()
+   * @return int      OK or one of Error
+   */
+  int encode(uint32_t length);
+
+  /**
+   * @brief Pad the last frame with silence and encode it. At least one more
+   *        frame of silence is encoded so the delay of the resampler and the
+   *        encoder does not cut off the end of the recording.
+   *
+   * @return int      OK or one of Error
+   */
+  int close(void);
+
+  /**
+   * @brief Time of Opus encoding, and of muxing, of each frame. Resampling
+   *        is in neither.
+   */
+  const TimeHistogram &getEncodeTime() const;
+  const TimeHistogram &getMuxTime() const;
+
+  /**
+   * @brief Frames left out by the silence gate since init().
+   */
+  uint32_t getGatedFrameCount() const;
+
+private:
+  // 48000 Hz is the only rate the containers accept
+  static const uint32_t kOutputSampleRate = 48000;
+  /** Defined in opus_defines.h
+   *  OPUS_APPLICATION_VOIP = Voice (Lower fidelity)
+   *  OPUS_APPLICATION_AUDIO = Full Band Audio (Highest fidelity)
+   *  OPUS_APPLICATION_RESTRICTED_LOWDELAY = Restricted Low Delay (Lowest latency) */
+  static const int kApplication = OPUS_APPLICATION_AUDIO;
+  // Recommended by libopus for the maximum packet size
+  static const std::size_t kMaxPacketSize = 4000;
+  // Silence encoded before the gate closes, 200 ms, for the tail of speech
+  static const uint32_t kSilenceHangover = 9600;
+
+  ContainerInterface *container_;
+  OpusEncoder *encoder_;            // Up to 2 channels
+  OpusMSEncoder *surround_encoder_; // Otherwise
+  SpeexResamplerState *resampler_;  // Rates other than 44100 and 48000
+  PolyphaseResampler polyphase_;    // 44100 Hz
+  int track_;
+  int default_complexity_;          // Of libopus, read from a new encoder
+  int complexity_;                  // Set by setControl()
+  bool adaptive_complexity_;
+  ComplexityGovernor governor_;
+  int silence_threshold_db_;        // 0 when the gate is off
+  float silence_threshold_;         // Mean square of a sample below it
+  uint32_t silent_samples_;         // Since the last frame above the threshold
+  uint32_t gated_frames_;
+  uint8_t channel_count_;
+  uint32_t input_sample_rate_;
+  int resample_quality_;
+  const uint8_t *input_order_;    // Input channel of each interleaved channel
+  uint32_t input_block_length_;   // Samples per channel in frame_ when full
+  uint32_t output_frame_length_;  // Samples per channel in an encoded frame
+  uint32_t next_frame_length_;    // Set by setFrameSize(), used from the next frame
+  uint32_t frame_index_;          // Interleaved samples in frame_ so far
+  uint32_t resampled_length_;     // Samples per channel in resampled_ so far
+
+  std::vector<float> input_;      // Planar, kMaxInputLength per channel
+  std::vector<float> frame_;      // Interleaved. A frame, up to kMaxFrameSize per
+                                  // channel, at 48000 Hz, otherwise a block
+  std::vector<float> resampled_;  // Interleaved FIFO, a frame plus a resampled
+                                  // block per channel. Empty at 48000 Hz
+  std::vector<uint8_t> packet_;
+
+  TimeHistogram encode_time_;
+  TimeHistogram mux_time_;
+
+  int createEncoder(int bitrate);
+  int resetEncoder(int bitrate);
+  int encoderCtl(int request, opus_int32 value);
+  int encoderGetCtl(int request, opus_int32 *value) const;
+  static uint32_t inputBlockLength(uint32_t input_sample_rate, uint32_t frame_size);
+  int createResampler(void);
+  void resetResampler(void);
+  int processBlock(void);
+  int encodeResampled(bool pad);
+  int encodePacket(const float *pcm);
+  bool isSilent(const float *pcm) const;
+  void destroy(void);
+};
+
+#endif /* ENCODERPIPELINE_H_ */
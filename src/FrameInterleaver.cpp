@@ -0,0 +1,76 @@
+#include "FrameInterleaver.hpp"
+#include <cassert>
+#include <utility>
+
+FrameInterleaver::FrameInterleaver(ContainerArena *arena)
+  : allocator_(arena),
+    queues_(),
+    free_frames_(allocator_),
+    queued_(0),
+    queued_samples_(0)
+{
+  // Nothing to do
+}
+
+void FrameInterleaver::setTrackCount(int track_count)
+{
+  assert(queued_ == 0); // Cannot change tracks while frames are queued
+  queues_.resize(track_count, Queue(allocator_));
+}
+
+void FrameInterleaver::push(int track, uint64_t timestamp, const void *data,
+                            std::size_t size, int num_samples)
+{
+  assert(track >= 0 && track < (int)queues_.size());
+  Frame frame{0, 0, 0, Bytes(allocator_)};
+  if (!free_frames_.empty()) {
+    // Reuse the buffer of a popped frame
+    std::swap(frame, free_frames_.back());
+    free_frames_.pop_back();
+  }
+  const uint8_t *bytes = static_cast<const uint8_t *>(data);
+  frame.track = track;
+  frame.timestamp = timestamp;
+  frame.num_samples = num_samples;
+  frame.data.assign(bytes, bytes + size);
+  queues_[track].push_back(std::move(frame));
+  queued_++;
+  queued_samples_ += num_samples;
+}
+
+const FrameInterleaver::Frame *FrameInterleaver::front(bool drain) const
+{
+  int track = earliestTrack(drain || queued_samples_ > kMaxQueuedSamples);
+  if (track < 0) {
+    return nullptr;
+  }
+  return &queues_[track].front();
+}
+
+void FrameInterleaver::pop(void)
+{
+  int track = earliestTrack(true);
+  assert(track >= 0); // Nothing to pop
+  queued_samples_ -= queues_[track].front().num_samples;
+  free_frames_.push_back(std::move(queues_[track].front()));
+  queues_[track].pop_front();
+  queued_--;
+}
+
+int FrameInterleaver::earliestTrack(bool drain) const
+{
+  int earliest = -1;
+  for (std::size_t i = 0; i < queues_.size(); i++) {
+    if (queues_[i].empty()) {
+      if (!drain) {
+        return -1;  // This track may still have an earlier frame
+      }
+      continue;
+    }
+    if (earliest < 0
+        || queues_[i].front().timestamp < queues_[earliest].front().timestamp) {
+      earliest = i;
+    }
+  }
+  return earliest;
+}
@@ -0,0 +1,89 @@
+#ifndef FRAMEINTERLEAVER_H_
+#define FRAMEINTERLEAVER_H_
+
+#include <cstdint>
+#include <cstddef>
+#include <deque>
+#include <vector>
+#include "ContainerArena.hpp"
+
+/**
+ * @brief Orders frames of several tracks by timestamp.
+ *
+ *    Frames of each track arrive in order, but tracks are written
+ *    independently. A frame can only be written once every track has a frame
+ *    queued, because until then a track may still deliver an earlier one.
+ *    If one track falls silent for too long (kMaxQueuedSamples), frames are
+ *    released anyway so memory stays bounded. The limit is a duration, so it
+ *    holds for any frame size.
+ *
+ *    Buffers of popped frames are recycled, so after a short warm-up queueing
+ *    does not allocate. Frames and their buffers come from the arena given to
+ *    the constructor, if any.
+ *
+ * ## How to use
+ *
+ *    1. setTrackCount()
+ *    2. push() a frame, then write frames while front() returns one, calling
+ *       pop() after each.
+ *    3. At the end of the stream, do the same with front(true) to drain.
+ */
+class FrameInterleaver
+{
+public:
+  typedef std::vector<uint8_t, ContainerArena::Allocator<uint8_t> > Bytes;
+
+  struct Frame {
+    int track;
+    uint64_t timestamp;   // Start of the frame in samples
+    int num_samples;
+    Bytes data;
+  };
+
+  /**
+   * @param arena   The arena of the container, or nullptr for the heap
+   */
+  explicit FrameInterleaver(ContainerArena *arena = nullptr);
+
+  void setTrackCount(int track_count);
+
+  /**
+   * @brief Queue a copy of a frame.
+   *
+   * @param track         Track index
+   * @param timestamp     Start of the frame, in samples at the common rate
+   * @param data          A pointer to the frame data
+   * @param size          Byte size of the frame data
+   * @param num_samples   Passed through to the writer
+   */
+  void push(int track, uint64_t timestamp, const void *data, std::size_t size,
+            int num_samples);
+
+  /**
+   * @brief The earliest frame that can be written now, or nullptr.
+   *
+   * @param drain   Release frames even if some tracks have nothing queued.
+   */
+  const Frame *front(bool drain = false) const;
+
+  /**
+   * @brief Remove the frame returned by front().
+   */
+  void pop(void);
+
+private:
+  // 10 seconds at 48 kHz
+  static const uint64_t kMaxQueuedSamples = 480000;
+
+  typedef std::deque<Frame, ContainerArena::Allocator<Frame> > Queue;
+
+  ContainerArena::Allocator<Frame> allocator_;
+  std::vector<Queue> queues_;
+  std::vector<Frame, ContainerArena::Allocator<Frame> > free_frames_;
+  std::size_t queued_;
+  uint64_t queued_samples_;   // Sum of num_samples of the queued frames
+
+  int earliestTrack(bool drain) const;
+};
+
+#endif /* FRAMEINTERLEAVER_H_ */
@@ -0,0 +1,23 @@
+#include "HeapUsage.hpp"
+#include <malloc.h>
+
+std::size_t HeapUsage::peak_ = 0;
+
+HeapUsage::HeapUsage()
+{
+  // The mark is shared by every instance
+}
+
+double HeapUsage::sample(void)
+{
+  std::size_t used = mallinfo().uordblks;
+  if (used > peak_) {
+    peak_ = used;
+  }
+  return used;
+}
+
+double HeapUsage::getPeak(void) const
+{
+  return peak_;
+}
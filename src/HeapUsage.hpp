@@ -0,0 +1,34 @@
+#ifndef HEAPUSAGE_H_
+#define HEAPUSAGE_H_
+
+#include <cstddef>
+
+/**
+ * @brief Bytes allocated with malloc and their high-water mark, e.g. in the
+ *        WASM heap. The WASM memory only grows in large steps and never
+ *        shrinks, so its size says little about what is used.
+ *
+ *    The mark is sampled, so call sample() after work that may allocate,
+ *    e.g. every encode() call. It is shared by the whole module. Uses
+ *    mallinfo(), which emmalloc and glibc have.
+ */
+class HeapUsage
+{
+public:
+  HeapUsage();
+
+  /**
+   * @brief Bytes allocated now, also raising the peak.
+   */
+  double sample(void);
+
+  /**
+   * @brief The most bytes sample() has seen allocated.
+   */
+  double getPeak(void) const;
+
+private:
+  static std::size_t peak_;
+};
+
+#endif /* HEAPUSAGE_H_ */
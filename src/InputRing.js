@@ -0,0 +1,90 @@
+// Layout of the SharedArrayBuffer. inputWorklet.js, which cannot import this
+// file, writes the same layout: keep them in sync.
+// Int32 header: frames written, frames read, frames dropped, channel count.
+const WRITE_INDEX = 0;
+const READ_INDEX = 1;
+const DROPPED_FRAMES = 2;
+const CHANNEL_COUNT = 3;
+const HEADER_BYTES = 16;
+// Then one plane of capacity float samples per channel.
+
+/**
+ * A single-producer single-consumer ring of planar float samples in a
+ * SharedArrayBuffer, from the AudioWorklet of inputWorklet.js to the encoder
+ * worker, without messages and without the main thread.
+ *
+ * Neither side locks or waits. The indices are frame counters published with
+ * Atomics once the samples are in place. The writer drops a whole block
+ * rather than overwrite samples not read yet, and counts it. The counters
+ * wrap at 2^32 and the capacity is a power of two, so positions stay exact
+ * across the wrap.
+ */
+class InputRing {
+  /**
+   * Allocate a ring.
+   * @param {number} channelCount
+   * @param {number} minCapacity - Frames it must hold, rounded up to a power
+   *        of two.
+   * @return {InputRing}
+   */
+  static create (channelCount, minCapacity) {
+    let capacity = 1;
+    while (capacity < minCapacity) {
+      capacity *= 2;
+    }
+    const buffer = new SharedArrayBuffer(HEADER_BYTES + channelCount * capacity * 4);
+    new Int32Array(buffer, 0, HEADER_BYTES / 4)[CHANNEL_COUNT] = channelCount;
+    return new InputRing(buffer);
+  }
+
+  /**
+   * @param {SharedArrayBuffer} buffer - The buffer of a ring made by create(),
+   *        e.g. posted to another thread.
+   */
+  constructor (buffer) {
+    this.buffer = buffer;
+    this._header = new Int32Array(buffer, 0, HEADER_BYTES / 4);
+    this.channelCount = this._header[CHANNEL_COUNT];
+    this.capacity = (buffer.byteLength - HEADER_BYTES) / 4 / this.channelCount;
+    this._planes = [];
+    for (let ch = 0; ch < this.channelCount; ch++) {
+      this._planes.push(new Float32Array(buffer, HEADER_BYTES + ch * this.capacity * 4,
+                                         this.capacity));
+    }
+  }
+
+  /**
+   * Frames dropped by the writer because the ring was full, i.e. the reader
+   * fell behind by more than its capacity.
+   * @return {number}
+   */
+  getDroppedFrames () {
+    return Atomics.load(this._header, DROPPED_FRAMES) >>> 0;
+  }
+
+  /**
+   * Hand the frames written so far to callback as views into the ring, then
+   * give their room back to the writer. Frames wrapping around the end of the
+   * ring take a second call.
+   * @param {function(Float32Array[])} callback - One view per channel, only
+   *        valid during the call.
+   * @return {number} - Frames read.
+   */
+  read (callback) {
+    const read = Atomics.load(this._header, READ_INDEX);
+    const count = (Atomics.load(this._header, WRITE_INDEX) - read) >>> 0;
+    if (count === 0) {
+      return 0;
+    }
+    const start = (read >>> 0) % this.capacity;
+    const first = Math.min(count, this.capacity - start);
+    callback(this._planes.map(plane => plane.subarray(start, start + first)));
+    if (first < count) {
+      callback(this._planes.map(plane => plane.subarray(0, count - first)));
+    }
+    Atomics.store(this._header, READ_INDEX, (read + count) | 0);
+    return count;
+  }
+}
+
+module.exports = InputRing;
@@ -1,77 +1,233 @@
 #include "OggContainer.hpp"
-#include "emscriptenImport.hpp"
 #include <vector>
 #include <string>
 #include <cstdlib>
 #include <cstring>
 #include <cassert>
 
-Container::Container()
+OggContainer::OggContainer()
   : ContainerInterface(),
-    stream_state_(),
+    streams_(),
     page_(),
-    packet_()
+    headers_written_(false),
+    interleaver_(&arena_),
+    max_page_granules_(0),
+    target_page_size_(0),
+    flush_packets_(0),
+    seek_interval_(0),
+    seek_points_(ContainerArena::Allocator<OggSeekPoint>(&arena_))
 {
   // Nothing to do
 }
 
-Container::~Container()
+OggContainer::~OggContainer()
 {
-  writePacket(nullptr, 0, 0, true); // This does nothing but marks end_of_stream
-  while (producePacketPage(true) != 0) {} // Produce the last page
-  ogg_stream_clear(&stream_state_);
+  finish();
 }
 
-void Container::init(uint32_t sample_rate, uint8_t channel_count, int serial)
+void OggContainer::finishStream(void)
+{
+  if (!headers_written_) {
+    writeHeaders();
+  }
+  // Write the frames still waiting for other streams
+  while (const FrameInterleaver::Frame *frame = interleaver_.front(true)) {
+    writeAudioPacket(frame->track, const_cast<uint8_t *>(frame->data.data()),
+                     frame->data.size(), frame->num_samples);
+    interleaver_.pop();
+  }
+  for (std::size_t i = 0; i < streams_.size(); i++) {
+    writePacket(i, nullptr, 0, 0, true); // This does nothing but marks end_of_stream
+    while (producePacketPage(i, true) != 0) {} // Produce the last page
+    ogg_stream_clear(&streams_[i].state);
+  }
+  streams_.clear();
+  headers_written_ = false;
+  interleaver_.setTrackCount(1);
+}
+
+void OggContainer::init(uint32_t sample_rate, uint8_t channel_count, int serial)
 {
   ContainerInterface::init(sample_rate, channel_count, serial);
+  seek_points_.clear();
 
-  int result = ogg_stream_init(&stream_state_, serial);
-  assert(result == 0);  // Init failed
+  streams_.resize(1);
+  initStream(0, serial);
+}
+
+int OggContainer::addTrack(uint8_t channel_count, int serial)
+{
+  assert(!headers_written_); // Streams must be added before the first frame
+  int track = ContainerInterface::addTrack(channel_count, serial);
+  streams_.resize(track + 1);
+  initStream(track, serial);
+  interleaver_.setTrackCount(streams_.size());
+  return track;
+}
+
+void OggContainer::setTrackHeader(int track, const IdHeader &header)
+{
+  assert(!headers_written_); // ID headers are written on the first frame
+  ContainerInterface::setTrackHeader(track, header);
+}
+
+void OggContainer::writeTrackFrame(int track, void *data, std::size_t size,
+                                   int num_samples)
+{
+  assert(track >= 0 && track < (int)streams_.size());
+  stats_.frames++;
+  if (!headers_written_) {
+    writeHeaders();
+  }
+  if (streams_.size() == 1) {
+    writeAudioPacket(0, (uint8_t *)data, size, num_samples);
+    return;
+  }
+
+  Stream &stream = streams_[track];
+  interleaver_.push(track, stream.queued_granulepos, data, size, num_samples);
+  stream.queued_granulepos += num_samples;
+  while (const FrameInterleaver::Frame *frame = interleaver_.front()) {
+    writeAudioPacket(frame->track, const_cast<uint8_t *>(frame->data.data()),
+                     frame->data.size(), frame->num_samples);
+    interleaver_.pop();
+  }
+}
+
+void OggContainer::setPagingPolicy(uint32_t max_page_granules,
+                                   uint32_t target_page_size,
+                                   uint32_t flush_packets)
+{
+  max_page_granules_ = max_page_granules;
+  target_page_size_ = target_page_size;
+  flush_packets_ = flush_packets;
+}
+
+void OggContainer::setSeekIndexInterval(uint32_t interval_granules)
+{
+  seek_interval_ = interval_granules;
+}
+
+int OggContainer::getSeekPointCount() const
+{
+  return seek_points_.size();
+}
+
+const OggSeekPoint &OggContainer::getSeekPoint(int index) const
+{
+  assert(index >= 0 && index < (int)seek_points_.size());
+  return seek_points_[index];
+}
+
+void OggContainer::writeSeekIndex(OutputSink *sink) const
+{
+  assert(sink);
+  uint8_t header[12];
+  memcpy(header, "OpusIdx1", 8);
+  uint32_t count = seek_points_.size();
+  memcpy(header + 8, &count, sizeof(uint32_t));
+  sink->write(header, sizeof(header));
+  for (const OggSeekPoint &point : seek_points_) {
+    uint8_t entry[20];
+    memcpy(entry, &point.granulepos, sizeof(uint64_t));
+    memcpy(entry + 8, &point.offset, sizeof(uint64_t));
+    memcpy(entry + 16, &point.serial, sizeof(uint32_t));
+    sink->write(entry, sizeof(entry));
+  }
+  sink->flush();
+}
+
+std::size_t OggContainer::arenaSize(void) const
+{
+  std::size_t bytes = ContainerInterface::arenaSize();
+  // The stream ahead waits for a page of the others at most.
+  bytes += interleaverArenaSize(max_page_granules_ > 0 ? max_page_granules_
+                                                       : kInterleavedSamples);
+  if (seek_interval_ > 0) {
+    // Points of the first minutes, three times as the vector grows. A longer
+    // index outgrows the arena and goes to the heap.
+    bytes += 3 * sizeof(OggSeekPoint) * (kSeekIndexArenaSamples / seek_interval_ + 1);
+  }
+  return bytes;
+}
 
-  packet_.b_o_s = 1;
-  packet_.e_o_s = 0;
-  packet_.granulepos = 0;
-  packet_.packet = nullptr;
-  packet_.packetno = 0;
-  packet_.bytes = 0;
+void OggContainer::writeAudioPacket(int stream, uint8_t *data, std::size_t size,
+                                    int num_samples)
+{
+  Stream &s = streams_[stream];
+  // A chunk starts on new pages of every stream, so a decoder starting there
+  // gets no packet continued from a page before it.
+  if (chunkDue(s.packet.granulepos)) {
+    for (std::size_t i = 0; i < streams_.size(); i++) {
+      while (producePacketPage(i, true) != 0) {}
+    }
+    startChunk(s.packet.granulepos);
+  }
+  writePacket(stream, data, size, num_samples, false);
+  s.packets_in_page++;
+  if ((uint64_t)s.packet.granulepos > stats_.samples) {
+    stats_.samples = s.packet.granulepos;
+  }
 
-  // Generate ID Page
-  produceIDPage();
-  // produce ID page
-  produceCommentPage();
+  bool force = (flush_packets_ > 0 && s.packets_in_page >= flush_packets_)
+                || (max_page_granules_ > 0
+                    && s.packet.granulepos - s.page_granulepos >= max_page_granules_);
+  while (producePacketPage(stream, force) != 0) {}
 }
 
-void Container::writeFrame(void *data, std::size_t size, int num_samples)
+void OggContainer::writeHeaders(void)
 {
-  writePacket((uint8_t *)data, size, num_samples, false);
-  while (producePacketPage(false) != 0) {}
+  // All beginning-of-stream pages first, then the rest of the headers.
+  for (std::size_t i = 0; i < streams_.size(); i++) {
+    produceIDPage(i);
+  }
+  for (std::size_t i = 0; i < streams_.size(); i++) {
+    produceCommentPage(i);
+  }
+  headers_written_ = true;
 }
-void Container::produceIDPage(void)
+
+void OggContainer::initStream(int stream, int serial)
+{
+  Stream &s = streams_[stream];
+  int result = ogg_stream_init(&s.state, serial);
+  assert(result == 0);  // Init failed
+
+  s.packet.b_o_s = 1;
+  s.packet.e_o_s = 0;
+  s.packet.granulepos = 0;
+  s.packet.packet = nullptr;
+  s.packet.packetno = 0;
+  s.packet.bytes = 0;
+  s.packets_in_page = 0;
+  s.page_granulepos = 0;
+  s.queued_granulepos = 0;
+  s.next_seek_granulepos = 0;
+}
+
+void OggContainer::produceIDPage(int stream)
 {
-  std::vector<uint8_t> tmp_buffer(OpusIdHeaderType::SIZE);
-  uint8_t *header = &tmp_buffer[0];
-  writeOpusIdHeader(header);
+  uint8_t header[OpusIdHeaderType::MAX_SIZE];
+  std::size_t size = writeOpusIdHeader(header, stream);
 
   // Produce an OGG page
-  writePacket(header, tmp_buffer.size(), -1);
-  int result = producePacketPage(true);
+  writePacket(stream, header, size, -1);
+  int result = producePacketPage(stream, true);
   assert(result != 0); // Unexpected error
 }
 
-void Container::produceCommentPage(void)
+void OggContainer::produceCommentPage(int stream)
 {
-  std::vector<uint8_t> tmp_buffer(OpusCommentHeaderType::SIZE);
-  uint8_t *header = &tmp_buffer[0];
+  uint8_t header[OpusCommentHeaderType::SIZE];
   writeOpusCommentHeader(header);
 
   // Produce an OGG page
-  writePacket(header, tmp_buffer.size(), -1);
-  int result = producePacketPage(true);
+  writePacket(stream, header, sizeof(header), -1);
+  int result = producePacketPage(stream, true);
   assert(result != 0);  // Unexpected error
 }
 
-int Container::producePacketPage(bool force)
+int OggContainer::producePacketPage(int stream, bool force)
 {
   /**
    * @brief Ogg page header format: https://tools.ietf.org/html/rfc3533#section-6
@@ -96,53 +252,73 @@ int Container::producePacketPage(bool force)
    *  | ...                                                           | 28-
    *  +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
    */
+  ogg_stream_state *state = &streams_[stream].state;
   int result;
-  if (force) {
-    result = ogg_stream_flush(&stream_state_, &page_);
+  if (target_page_size_ > 0) {
+    result = force ? ogg_stream_flush_fill(state, &page_, target_page_size_)
+                   : ogg_stream_pageout_fill(state, &page_, target_page_size_);
+  } else if (force) {
+    result = ogg_stream_flush(state, &page_);
   } else {
-    result = ogg_stream_pageout(&stream_state_, &page_);
+    result = ogg_stream_pageout(state, &page_);
   }
   // result == 0 means no page to produce, or internal error has occurred.
   // You should NOT copy page in this case.
   // Nonzero value means operation successful.
   if (result == 0) {
-    assert(!ogg_stream_check(&stream_state_)); // Allocation error
+    assert(!ogg_stream_check(state)); // Allocation error
   } else {
-    emscriptenPushBuffer(page_.header, page_.header_len);
-    emscriptenPushBuffer(page_.body, page_.body_len);
+    Stream &s = streams_[stream];
+    // Audio pages starting with a new packet can be seek points.
+    if (seek_interval_ > 0 && headers_written_ && !ogg_page_continued(&page_)
+        && s.page_granulepos >= s.next_seek_granulepos) {
+      seek_points_.push_back(OggSeekPoint{(uint64_t)s.page_granulepos, stats_.bytes,
+                                          ogg_page_serialno(&page_)});
+      s.next_seek_granulepos = s.page_granulepos + seek_interval_;
+    }
+    writeOutput(page_.header, page_.header_len);
+    writeOutput(page_.body, page_.body_len);
+    stats_.pages++;
+    // -1 means no packet ends on this page
+    if (ogg_page_granulepos(&page_) >= 0) {
+      s.page_granulepos = ogg_page_granulepos(&page_);
+    }
+    s.packets_in_page = 0;
   }
   return result;
 }
 
-void Container::writePacket(uint8_t *data, std::size_t size,
-                              int num_samples, bool e_o_s)
+void OggContainer::writePacket(int stream, uint8_t *data, std::size_t size,
+                               int num_samples, bool e_o_s)
 {
+  ogg_stream_state *state = &streams_[stream].state;
+  ogg_packet &packet = streams_[stream].packet;
   assert(!(data == nullptr && size > 0)); // No copy more than zero over null
-  assert(!ogg_stream_eos(&stream_state_)); // Already end-of-stream
+  assert(!ogg_stream_eos(state)); // Already end-of-stream
 
   // After setting End-Of-Stream, there must be no more packet to write
   if (e_o_s) {
-    packet_.e_o_s = 1;
+    packet.e_o_s = 1;
   }
 
   if (data) {
-    packet_.packet = data;
+    packet.packet = data;
   }
-  packet_.bytes = size;
+  packet.bytes = size;
   if (num_samples < 0) {
     // The granule position of ID/comment pages should be zero
-    packet_.granulepos = 0;
+    packet.granulepos = 0;
   } else {
-    packet_.granulepos += num_samples;
+    packet.granulepos += num_samples;
   }
 
-  int result = ogg_stream_packetin(&stream_state_, &packet_);
+  int result = ogg_stream_packetin(state, &packet);
   assert(result == 0); // Allocation error
 
   // Begingging-Of-Stream must be cleared after the first page
-  if (packet_.b_o_s) {
-    packet_.b_o_s = 0;
+  if (packet.b_o_s) {
+    packet.b_o_s = 0;
   }
-  packet_.packetno++;
-  packet_.packet = nullptr;
+  packet.packetno++;
+  packet.packet = nullptr;
 }
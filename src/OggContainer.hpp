@@ -3,8 +3,20 @@
 
 #include <cstdint>
 #include <cstddef>
+#include <vector>
 #include "lib/ogg/include/ogg/ogg.h"
 #include "ContainerInterface.hpp"
+#include "FrameInterleaver.hpp"
+
+/**
+ * @brief A point of the seek index of OggContainer: a page where decoding a
+ *        stream can start.
+ */
+struct OggSeekPoint {
+  uint64_t granulepos;  // Granule position of the stream before the page
+  uint64_t offset;      // Byte offset of the page, counted as ContainerStats::bytes
+  int serial;           // Serial number of the stream
+};
 
 /**
  * @brief Ogg Container class
@@ -51,44 +63,156 @@
  *          getOggHeader(), getOggHeaderSize(), getOggBody(), getOggBodySize().
  *      3. Copy buffers using the pointers manually.
  *      4. If producePacketPage() return non-zero value, iterate from step 1.
+ *
+ * ## Multiple streams
+ *
+ *    Each track added by addTrack() is a logical bitstream with its own serial
+ *    number, multiplexed in one physical stream (grouping, RFC 3533 section 4).
+ *    ID pages of all streams come first, then all comment pages, so headers
+ *    are written on the first frame, when every stream is known. Packets of
+ *    the streams are then interleaved in timestamp order.
+ *
+ * ## Chunks
+ *
+ *    With setChunkDuration(), pages of every stream are flushed where a chunk
+ *    starts, so its first page starts with a new packet. Page sequence
+ *    numbers of a chunk read without the chunks before it skip, which
+ *    decoders treat as lost pages.
  */
-class Container
-  : protected ContainerInterface
+class OggContainer
+  : public ContainerInterface
 {
 public:
   /**
    * @brief Construct a new Ogg Container object
    *
    * @param sample_rate     Sampling rate of the stream
-   * @param channel_count   The number of channels of the stream the maxium is 2.
+   * @param channel_count   The number of channels of the stream, up to 8.
    * @param serial          Uniqute number of the stream. Usually a random number.
    */
-  Container();
-  ~Container();
+  OggContainer();
+  ~OggContainer();
 
   void init(uint32_t sample_rate, uint8_t channel_count, int serial) override;
 
-  void writeFrame(void *data, std::size_t size, int num_samples) override;
+  int addTrack(uint8_t channel_count, int serial) override;
+
+  void setTrackHeader(int track, const IdHeader &header) override;
+
+  void writeTrackFrame(int track, void *data, std::size_t size,
+                       int num_samples) override;
+
+  /**
+   * @brief   Choose when audio pages are emitted instead of leaving it to
+   *          libogg, which holds a page back until about 4 kB of packets are
+   *          queued. Zero disables a condition. All zero is the default.
+   *
+   *          Live streaming wants short pages for a low time-to-first-byte,
+   *          archiving wants full pages for less header overhead.
+   *
+   * @param max_page_granules   Flush once a page holds this many samples at
+   *                            48 kHz, e.g. 9600 for 200 ms.
+   * @param target_page_size    Emit pages when about this many bytes of
+   *                            packets are queued, instead of libogg's 4096.
+   * @param flush_packets       Flush every N packets.
+   */
+  void setPagingPolicy(uint32_t max_page_granules, uint32_t target_page_size,
+                       uint32_t flush_packets);
+
+  /**
+   * @brief   Record a seek index while muxing, so players can seek without
+   *          bisecting the file: the byte offset and granule position of a
+   *          page of each stream, at least interval_granules apart. Only
+   *          pages starting with a new packet are points. To play from a
+   *          granule position, start at the last point 80 ms (3840) or more
+   *          before it, for the decoder to converge (RFC 7845 section 4.6).
+   *          Call it before init(). The index is kept until the next init().
+   *
+   * @param interval_granules   At 48 kHz, e.g. 48000 for a point per
+   *                            second. 0 (default) records nothing.
+   */
+  void setSeekIndexInterval(uint32_t interval_granules);
+  int getSeekPointCount() const;
+  const OggSeekPoint &getSeekPoint(int index) const;
+
+  /**
+   * @brief   Write the seek index as a sidecar file, e.g. recording.opus.idx.
+   *          Little-endian, 20 bytes per point in stream order:
+   *
+   *            0   'OpusIdx1'      Magic and version
+   *            8   uint32          Number of points
+   *            12  Points:
+   *                  uint64        Granule position
+   *                  uint64        Byte offset of the page
+   *                  uint32        Serial number of the stream
+   *
+   * @param sink    Where the sidecar goes, not the sink of the container
+   */
+  void writeSeekIndex(OutputSink *sink) const;
+
+protected:
+  void finishStream(void) override;
+
+  /**
+   * @brief   Frames waiting in the interleaver with several streams, about a
+   *          page of them, and the seek index.
+   */
+  std::size_t arenaSize(void) const override;
 
 private:
-  ogg_stream_state stream_state_;
+  // Seek index kept in the arena, 10 minutes at 48 kHz
+  static const uint32_t kSeekIndexArenaSamples = 10 * 60 * 48000;
+
+  // A logical bitstream
+  struct Stream {
+    ogg_stream_state state;
+    ogg_packet packet;
+    // Packets and granule position since the last page
+    uint32_t packets_in_page;
+    ogg_int64_t page_granulepos;
+    // End of the last frame queued in the interleaver
+    ogg_int64_t queued_granulepos;
+    // Granule position due for the next seek point
+    ogg_int64_t next_seek_granulepos;
+  };
+
+  std::vector<Stream> streams_;
   ogg_page page_;
-  ogg_packet packet_;
+  bool headers_written_;
+  FrameInterleaver interleaver_;
+
+  // Paging policy. See setPagingPolicy().
+  uint32_t max_page_granules_;
+  uint32_t target_page_size_;
+  uint32_t flush_packets_;
+
+  // Seek index. See setSeekIndexInterval().
+  uint32_t seek_interval_;
+  std::vector<OggSeekPoint, ContainerArena::Allocator<OggSeekPoint> > seek_points_;
 
   /**
    * @brief   Insert data (or a packet). The inserted data can be later collected
    *          as Ogg pages by calling producePacketPage().
    *
+   * @param stream        Index of the stream
    * @param data          A pointer to the packet buffer
    * @param size          Byte size of the packet data
    * @param num_samples   if < 0, the packet is considered as metadata packet
    * @param e_o_s         Set if this is the last packet
    */
-  void writePacket(uint8_t *data, std::size_t size, int num_samples, bool e_o_s = false);
+  void writePacket(int stream, uint8_t *data, std::size_t size, int num_samples,
+                   bool e_o_s = false);
+
+  /**
+   * @brief   Write a packet of audio and emit the pages the policy asks for.
+   */
+  void writeAudioPacket(int stream, uint8_t *data, std::size_t size, int num_samples);
 
-  void produceIDPage(void);
-  void produceCommentPage(void);
-  int producePacketPage(bool force = false);
+  void writeHeaders(void);
+  void produceIDPage(int stream);
+  void produceCommentPage(int stream);
+  int producePacketPage(int stream, bool force = false);
+  void initStream(int stream, int serial);
 };
 
 #endif /* OGGCONTAINER_H_ */
@@ -4,5 +4,6 @@
  */
 
 #include "OggContainer.hpp"
+#include "EncoderPipeline.hpp"
 // This is an auto-generated code by Emscripten located in /build directory.
-#include "Container.webidl_glue.cpp"
\ No newline at end of file
+#include "OggContainer.webidl_glue.cpp"
\ No newline at end of file
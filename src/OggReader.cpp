@@ -0,0 +1,194 @@
+#include "OggReader.hpp"
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+OggReader::OggReader()
+  : ContainerReader(),
+    sync_(),
+    page_(),
+    offset_(0),
+    page_pending_(false),
+    current_stream_(-1),
+    streams_()
+{
+  ogg_sync_init(&sync_);
+}
+
+OggReader::~OggReader()
+{
+  close();
+  ogg_sync_clear(&sync_);
+}
+
+int OggReader::open(const void *data, std::size_t size)
+{
+  assert(data || size == 0);
+  close();
+  data_ = static_cast<const uint8_t *>(data);
+  size_ = size;
+
+  // Beginning-of-stream pages of all streams of a link come first.
+  bool any_page = false;
+  while (nextPage()) {
+    any_page = true;
+    if (!ogg_page_bos(&page_)) {
+      page_pending_ = true;
+      break;
+    }
+    int result = addStream();
+    if (result != OK) {
+      return result;
+    }
+  }
+  if (streams_.empty()) {
+    return any_page ? ERR_NOT_OPUS : ERR_INVALID_DATA;
+  }
+  return OK;
+}
+
+int OggReader::readPacket(Packet *packet)
+{
+  assert(packet);
+  ogg_packet op;
+  while (true) {
+    if (current_stream_ >= 0) {
+      Stream &s = streams_[current_stream_];
+      int result = ogg_stream_packetout(&s.state, &op);
+      if (result > 0) {
+        if (!s.tags_read) {
+          // The comment header, which only describes the source
+          s.tags_read = true;
+          continue;
+        }
+        int samples = packetSamples(op.packet, op.bytes);
+        if (samples < 0) {
+          return ERR_INVALID_DATA;
+        }
+        ogg_int64_t start = s.granulepos;
+        s.granulepos += samples;
+
+        packet->track = current_stream_;
+        packet->data = op.packet;
+        packet->size = op.bytes;
+        packet->num_samples = samples;
+        packet->gap_samples = 0;
+        // Only the last packet of a page has a granule position.
+        if (op.granulepos >= 0) {
+          if (!s.granule_offset_known) {
+            // A first page with fewer samples than its packets hold is only
+            // valid as the last page, trimming the end. RFC 7845 section 4.
+            s.granule_offset = std::max<ogg_int64_t>(0, op.granulepos - s.granulepos);
+            s.granule_offset_known = true;
+          }
+          ogg_int64_t end = op.granulepos - s.granule_offset;
+          if (op.e_o_s && end < s.granulepos) {
+            packet->num_samples = std::max<ogg_int64_t>(0, end - start);
+          }
+        }
+        return 1;
+      }
+      // result < 0 is a gap, where pages were lost. Keep reading after it.
+      if (result < 0) {
+        continue;
+      }
+    }
+
+    if (!page_pending_ && !nextPage()) {
+      return 0;
+    }
+    if (ogg_page_bos(&page_)) {
+      // The next link of a chained file, kept for the next call
+      page_pending_ = true;
+      return ERR_UNSUPPORTED;
+    }
+    page_pending_ = false;
+    // Pages of skipped streams are dropped.
+    current_stream_ = findStream(ogg_page_serialno(&page_));
+    if (current_stream_ >= 0
+        && ogg_stream_pagein(&streams_[current_stream_].state, &page_) != 0) {
+      return ERR_INVALID_DATA;
+    }
+  }
+}
+
+void OggReader::close(void)
+{
+  for (Stream &s : streams_) {
+    ogg_stream_clear(&s.state);
+  }
+  streams_.clear();
+  tracks_.clear();
+  ogg_sync_reset(&sync_);
+  offset_ = 0;
+  page_pending_ = false;
+  current_stream_ = -1;
+}
+
+bool OggReader::nextPage(void)
+{
+  while (true) {
+    int result = ogg_sync_pageout(&sync_, &page_);
+    if (result > 0) {
+      return true;
+    }
+    // result < 0 means bytes were skipped to find the next page.
+    if (result == 0) {
+      if (offset_ == size_) {
+        return false;
+      }
+      // Copied in chunks, so libogg never holds the whole file twice.
+      std::size_t chunk = std::min(kChunkSize, size_ - offset_);
+      char *buffer = ogg_sync_buffer(&sync_, chunk);
+      assert(buffer); // Allocation error
+      memcpy(buffer, data_ + offset_, chunk);
+      ogg_sync_wrote(&sync_, chunk);
+      offset_ += chunk;
+    }
+  }
+}
+
+int OggReader::findStream(int serial) const
+{
+  for (std::size_t i = 0; i < streams_.size(); i++) {
+    if (streams_[i].serial == serial) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+int OggReader::addStream(void)
+{
+  int serial = ogg_page_serialno(&page_);
+  if (findStream(serial) >= 0) {
+    return ERR_INVALID_DATA; // Two streams with one serial
+  }
+
+  Stream s;
+  int result = ogg_stream_init(&s.state, serial);
+  assert(result == 0); // Init failed
+  (void)result;
+  s.serial = serial;
+  s.tags_read = false;
+  s.granulepos = 0;
+  s.granule_offset = 0;
+  s.granule_offset_known = false;
+
+  // The beginning-of-stream page holds the ID header and nothing else.
+  ogg_packet op;
+  if (ogg_stream_pagein(&s.state, &page_) != 0
+      || ogg_stream_packetout(&s.state, &op) != 1
+      || op.bytes < 8 || memcmp(op.packet, "OpusHead", 8) != 0) {
+    ogg_stream_clear(&s.state);
+    return OK; // Another codec, skipped
+  }
+  ContainerInterface::IdHeader header;
+  if (!ContainerInterface::parseOpusIdHeader(op.packet, op.bytes, &header)) {
+    ogg_stream_clear(&s.state);
+    return ERR_UNSUPPORTED;
+  }
+  streams_.push_back(s);
+  tracks_.push_back(header);
+  return OK;
+}
@@ -0,0 +1,62 @@
+#ifndef OGGREADER_H_
+#define OGGREADER_H_
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include "lib/ogg/include/ogg/ogg.h"
+#include "ContainerReader.hpp"
+
+/**
+ * @brief Reads the Opus streams of an Ogg file.
+ *
+ *    Each Opus logical bitstream of the first link is a track, in the order
+ *    of their beginning-of-stream pages. Streams of other codecs (e.g. a
+ *    Skeleton) are skipped. A chained file, with a link after the first one
+ *    ends, is read up to its second link, where readPacket() returns
+ *    ERR_UNSUPPORTED.
+ *
+ *    The end trimming of a stream, given by the granule position of its
+ *    last page, is kept as the num_samples of its last packet. A non-zero
+ *    granule position at the start of a stream is not kept.
+ *
+ *    See https://tools.ietf.org/html/rfc7845
+ */
+class OggReader
+  : public ContainerReader
+{
+public:
+  OggReader();
+  ~OggReader();
+
+  int open(const void *data, std::size_t size) override;
+  int readPacket(Packet *packet) override;
+
+private:
+  // Bytes handed to libogg at once
+  static const std::size_t kChunkSize = 64 * 1024;
+
+  // An Opus logical bitstream
+  struct Stream {
+    ogg_stream_state state;
+    int serial;
+    bool tags_read;             // The comment header has been skipped
+    ogg_int64_t granulepos;     // Samples of the packets read so far
+    ogg_int64_t granule_offset; // Granule position at the start of the stream
+    bool granule_offset_known;
+  };
+
+  ogg_sync_state sync_;
+  ogg_page page_;
+  std::size_t offset_;      // Bytes of the file handed to libogg so far
+  bool page_pending_;       // page_ is yet to be read into its stream
+  int current_stream_;      // Stream of the last page, -1 before the first
+  std::vector<Stream> streams_;
+
+  void close(void);
+  bool nextPage(void);
+  int findStream(int serial) const;
+  int addStream(void);
+};
+
+#endif /* OGGREADER_H_ */
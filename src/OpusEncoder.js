@@ -1,218 +1,860 @@
-const { EmscriptenMemoryAllocator } = require('./commonFunctions.js');
+// Ogg granule positions and Opus frame sizes are always counted at 48 kHz.
+const GRANULES_PER_MS = 48;
 
-/**
- * Configuration
- */
-const OPUS_APPLICATION = 2049; /** Defined in opus_defines.h
-                                *  2048: OPUS_APPLICATION_VOIP = Voice (Lower fidelity)
-                                *  2049: OPUS_APPLICATION_AUDIO = Full Band Audio (Highest fidelity)
-                                *  2051: OPUS_APPLICATION_RESTRICTED_LOWDELAY = Restricted Low Delay (Lowest latency) */
-const OPUS_OUTPUT_SAMPLE_RATE = 48000; // Desired encoding sample rate. Audio will be resampled
-const OPUS_OUTPUT_MAX_LENGTH = 4000;
-const OPUS_FRAME_SIZE = 20; // Specified in ms.
+// EncoderPipeline::kDefaultResampleQuality and kDefaultFrameSize (20 ms)
+const DEFAULT_RESAMPLE_QUALITY = 6;
+const DEFAULT_FRAME_SIZE = 960;
+
+// EncoderPipeline::Control
+const CONTROLS = {
+  bitrate: 0,
+  complexity: 1,
+  vbr: 2,
+  bandwidth: 3,
+  adaptiveComplexity: 4,
+  dtx: 5,
+  silenceThreshold: 6
+};
+
+// OPUS_AUTO and OPUS_BANDWIDTH_* of opus_defines.h
+const BANDWIDTHS = {
+  auto: -1000,
+  narrowband: 1101,
+  mediumband: 1102,
+  wideband: 1103,
+  superwideband: 1104,
+  fullband: 1105
+};
+
+// Initial capacity of the output arena. It grows when a flush needs more.
+const OUTPUT_ARENA_CAPACITY = 64 * 1024;
 
-const SPEEX_RESAMPLE_QUALITY = 6; // Value between 0 and 10 inclusive. 10 being highest quality.
+// Room above encoderOptions.outputHighWaterMark for the output of the encode()
+// crossing it, so a bounded arena is allocated once for the whole recording.
+// A few Opus frames at most.
+const OUTPUT_ARENA_HEADROOM = 64 * 1024;
 
-const BUFFER_LENGTH = 4096;
+// TimeHistogram::kBucketCount
+const HISTOGRAM_BUCKET_COUNT = 16;
+
+// Container class of each MIME type. A module has one of them, or both of
+// them in OggWebMOpusEncoder.js.
+const CONTAINER_CLASSES = {
+  'audio/ogg': 'OggContainer',
+  'audio/webm': 'WebMContainer'
+};
+
+// Reader class of each MIME type, for Module.remux(). Only
+// OggWebMOpusEncoder.js has them.
+const READER_CLASSES = {
+  'audio/ogg': 'OggReader',
+  'audio/webm': 'WebMReader'
+};
+
+// Threads of the EncoderEngine of a pthreads build (OggWebMOpusEncoderMT.js).
+// Keep it the same as PTHREAD_POOL_SIZE of the Makefile.
+const ENGINE_THREAD_COUNT = 4;
 
 /**
- * Constants used for libraries
- */;
-// in opus_defines.h
-const OPUS_OK = 0;
-const OPUS_SET_BITRATE_REQUEST = 4002;
-// in speex_resampler.h
-const RESAMPLER_ERR_SUCCESS = 0;
+ * Error codes returned by EncoderPipeline. See EncoderPipeline::Error.
+ */
+const PIPELINE_ERRORS = {
+  '-1': 'Opus encodor initialization failed.',
+  '-2': 'Initializing resampler failed.',
+  '-3': 'Resampling error.',
+  '-4': 'Opus encoding error.',
+  '-5': 'Unsupported frame duration, must be 2.5, 5, 10, 20, 40 or 60 ms.',
+  '-6': 'Invalid encoder control value.',
+  '-16': 'Invalid encoder session.'
+};
+
+/**
+ * Error codes returned by ContainerReader. See ContainerReader::Error.
+ */
+const READER_ERRORS = {
+  '-1': 'Invalid or truncated file.',
+  '-2': 'No Opus track in the file.',
+  '-3': 'Unsupported file, e.g. a chained Ogg stream.'
+};
 
 class _OpusEncoder {
-  constructor (inputSampleRate, channelCount, bitsPerSecond = undefined) {
+  /**
+   * @param {string} [mimeType] - 'audio/ogg' or 'audio/webm'. Only needed
+   *        with a module that has both containers.
+   */
+  constructor (inputSampleRate, channelCount, bitsPerSecond = undefined, options = {},
+               mimeType = undefined) {
     this.config = {
       inputSampleRate, // Usually 44100Hz or 48000Hz
       channelCount
     };
 
-    // Emscripten memory allocator
-    this.memory = new EmscriptenMemoryAllocator(Module);
-    // libopus functions imported from WASM
-    this._opus_encoder_create = Module._opus_encoder_create;
-    this._opus_encoder_ctl = Module._opus_encoder_ctl;
-    this._opus_encode_float = Module._opus_encode_float;
-    this._opus_encoder_destroy = Module._opus_encoder_destroy;
-    // SpeexDSP functions
-    this._speex_resampler_init = Module._speex_resampler_init;
-    this._speex_resampler_process_interleaved_float = Module._speex_resampler_process_interleaved_float;
-    this._speex_resampler_destroy = Module._speex_resampler_destroy;
-    // Ogg container imported using WebIDL binding
-    this._container = new Module.Container();
-    this._container.init(OPUS_OUTPUT_SAMPLE_RATE, channelCount,
-                         Math.floor(Math.random() * 0xFFFFFFFF));
-
-    this.OpusInitCodec(OPUS_OUTPUT_SAMPLE_RATE, channelCount, bitsPerSecond);
-    this.SpeexInitResampler(inputSampleRate, OPUS_OUTPUT_SAMPLE_RATE, channelCount);
-
-    this.inputSamplesPerChannel = inputSampleRate * OPUS_FRAME_SIZE / 1000;
-    this.outputSamplePerChannel = OPUS_OUTPUT_SAMPLE_RATE * OPUS_FRAME_SIZE / 1000;
-
-    // Initialize all buffers
-    //  |input buffer| =={reampler}=> |resampled buffer| =={encoder}=> |output buffer|
-    this.inputBufferIndex = 0;
-    this.mInputBuffer = this.memory.mallocFloat32Buffer(this.inputSamplesPerChannel * channelCount);
-    this.mResampledBuffer = this.memory.mallocFloat32Buffer(this.outputSamplePerChannel * channelCount);
-    this.mOutputBuffer = this.memory.mallocUint8Buffer(OPUS_OUTPUT_MAX_LENGTH);
-
-    // TODO: Figure out how to delete this thing.
-    this.interleavedBuffers = (channelCount !== 1)
-                            ? new Float32Array(BUFFER_LENGTH * channelCount)
-                            : undefined;
-  }
-
-  encode (buffers) {
-    let samples = this.interleave(buffers);
-    let sampleIndex = 0;
-
-    while (sampleIndex < samples.length) {
-      // Copy samples to input buffer
-      let lengthToCopy = Math.min(this.mInputBuffer.length - this.inputBufferIndex,
-                                  samples.length - sampleIndex);
-      this.mInputBuffer.set(samples.subarray(sampleIndex, sampleIndex + lengthToCopy),
-                            this.inputBufferIndex);
-      this.inputBufferIndex += lengthToCopy;
-
-      // When mInputBuffer is fill, then encode.
-      if (this.inputBufferIndex >= this.mInputBuffer.length) {
-        // Resampling
-        let mInputLength = this.memory.mallocUint32(this.inputSamplesPerChannel);
-        let mOutputLength = this.memory.mallocUint32(this.outputSamplePerChannel);
-        let err = this._speex_resampler_process_interleaved_float(
-          this.resampler,
-          this.mInputBuffer.pointer,
-          mInputLength.pointer,
-          this.mResampledBuffer.pointer,
-          mOutputLength.pointer);
-        mInputLength.free();
-        mOutputLength.free();
-        if (err !== RESAMPLER_ERR_SUCCESS) {
-          throw new Error('Resampling error.');
-        }
-        // Encoding
-        let packetLength = this._opus_encode_float(this.encoder,
-                                                   this.mResampledBuffer.pointer,
-                                                   this.outputSamplePerChannel,
-                                                   this.mOutputBuffer.pointer,
-                                                   this.mOutputBuffer.length);
-        if (packetLength < 0) {
-          throw new Error('Opus encoding error.');
-        }
-        // Input packget to Ogg or WebM page generator
-        this._container.writeFrame(this.mOutputBuffer.pointer,
-                                   packetLength,
-                                   this.outputSamplePerChannel); // 960 samples
-        this.inputBufferIndex = 0;
+    // Container output is collected back-to-back in the WASM heap until
+    // flush() is called, instead of one ArrayBuffer per page or element.
+    this._output = new Module.MemoryOutputSink();
+    // flush() takes the bytes while recording, so the containers must not
+    // seek back into them: a seekable WebM is kept whole until the end.
+    this._output.setSeekable(false);
+    this._reserveOutput(options);
+    // Peak of the bytes allocated in the WASM heap, sampled after each encode()
+    this._heapUsage = new Module.HeapUsage();
+    // Ogg or WebM container imported using WebIDL binding
+    this._container = createContainer(mimeType);
+    this._container.setOutputSink(this._output);
+    this._configureContainer(options, bitsPerSecond);
+    // Resampling, encoding and muxing all happen inside WASM, one pipeline
+    // per track. The first one initializes the container. In a pthreads build
+    // the pipeline runs on the shared engine instead, off this thread.
+    this._engine = getEngine();
+    this._bitsPerSecond = bitsPerSecond || 0;
+    this._resampleQuality = options.resampleQuality;
+    this._frameSize = frameSizeOf(options.frameDuration);
+    this._controls = pickControls(options);
+    this._initChunks(options);
+    this._tracks = [];
+    this.addTrack(channelCount, inputSampleRate);
+  }
+
+  /**
+   * Add an audio track muxed into the same file. Must be called before the
+   * first encode(), when the container has not written its headers yet.
+   * @param {number} channelCount - Channels of the new track.
+   * @param {number} [inputSampleRate] - Defaults to the rate of the first track.
+   * @return {number} - Track index to pass to encode().
+   */
+  addTrack (channelCount, inputSampleRate = this.config.inputSampleRate) {
+    if (this._engine && this._tracks.length > 0) {
+      // Tracks of one container would be encoded on two threads at once.
+      throw new Error('Encoders of a pthreads build have a single track.');
+    }
+    const pipeline = this._engine
+      ? new _EngineSession(this._engine, this._container)
+      : new Module.EncoderPipeline(this._container);
+    this._tracks.push(this._initTrack(pipeline, channelCount, inputSampleRate));
+    return pipeline.getTrack();
+  }
+
+  /**
+   * Encode planar channel buffers, a single call to WASM per block.
+   * @param {Float32Array[]} buffers - One buffer per channel.
+   * @param {number} [track] - Track index returned by addTrack().
+   */
+  encode (buffers, track = 0) {
+    const { pipeline, channelCount, inputPointers } = this._tracks[track];
+    const length = buffers[0].length;
+
+    for (let offset = 0; offset < length; offset += this.maxInputLength) {
+      const blockLength = Math.min(this.maxInputLength, length - offset);
+      for (let ch = 0; ch < channelCount; ch++) {
+        Module.HEAPF32.set(buffers[ch].subarray(offset, offset + blockLength),
+                           inputPointers[ch] >> 2);
       }
-      sampleIndex += lengthToCopy;
+      this._check(pipeline.encode(blockLength));
+    }
+    this._heapUsage.sample();
+  }
+
+  /**
+   * Change the Opus frame duration of every track from its next frame on.
+   * Shorter frames lower the latency, longer ones the overhead.
+   * @param {number} frameDuration - 2.5, 5, 10, 20, 40 or 60 ms.
+   */
+  setFrameDuration (frameDuration) {
+    const frameSize = frameSizeOf(frameDuration);
+    for (const { pipeline } of this._tracks) {
+      this._check(pipeline.setFrameSize(frameSize));
+    }
+    // Tracks added later start with it too.
+    this._frameSize = frameSize;
+  }
+
+  /**
+   * Change encoder settings of every track from its next frame on. Settings
+   * left out are kept.
+   * @param {Object} controls
+   * @param {number} [controls.bitrate] - Bits per second, 0 for automatic.
+   * @param {number} [controls.complexity] - 0 to 10. With adaptiveComplexity,
+   *        the highest one used.
+   * @param {boolean} [controls.vbr] - false for constant bitrate.
+   * @param {string} [controls.bandwidth] - 'auto', 'narrowband',
+   *        'mediumband', 'wideband', 'superwideband' or 'fullband'.
+   * @param {boolean} [controls.adaptiveComplexity] - Lower the complexity
+   *        while frames take too long to encode.
+   * @param {boolean} [controls.dtx] - Discontinuous transmission: libopus
+   *        sends tiny packets during silence.
+   * @param {number} [controls.silenceThreshold] - In dBFS, e.g. -60. After
+   *        200 ms quieter than that, frames are not encoded at all until the
+   *        sound comes back. 0 or null turns it off.
+   */
+  setControls (controls) {
+    for (const { pipeline } of this._tracks) {
+      this._applyControls(pipeline, controls);
+    }
+    // Tracks added later get them too.
+    Object.assign(this._controls, controls);
+  }
+
+  /**
+   * Take the output produced so far.
+   * @return {ArrayBuffer[]} - Empty, or one buffer with all bytes since the
+   *         last call. With encoderOptions.chunkDuration, the buffers of
+   *         flushChunks().
+   */
+  flush () {
+    if (this._chunked) {
+      return this.flushChunks().buffers;
+    }
+    this._drain();
+    const size = this._output.size();
+    if (size === 0) {
+      return [];
+    }
+    // A single copy out of the heap. The heap itself cannot be transferred to
+    // the main thread.
+    const pointer = this._output.data();
+    const buffer = Module.HEAPU8.slice(pointer, pointer + size).buffer;
+    this._output.clear();
+    return [buffer];
+  }
+
+  /**
+   * Take the whole chunks produced so far, see encoderOptions.chunkDuration.
+   * The chunk still being written is kept for the next call, until the
+   * recording ends. Without chunks, the buffers of flush() and no chunk.
+   * @return {{buffers: ArrayBuffer[], header: boolean, chunks: Object[]}} -
+   *         buffers: the header first if header is true, then one buffer
+   *         per chunk. The header is taken once, by the first call with a
+   *         chunk. Their bytes in order are the same as flush() would give.
+   *         chunks: {start, end, offset, size} of each chunk. start and end
+   *         in milliseconds, offset and size in bytes of the whole file.
+   */
+  flushChunks () {
+    if (!this._chunked) {
+      return { buffers: this.flush(), header: false, chunks: [] };
+    }
+    this._drain();
+    if (!this._chunkEnd) {
+      this._collectChunks();
     }
+    const starts = this._chunkStarts;
+    // The last chunk is complete once the recording has ended.
+    const count = this._chunkEnd ? starts.length : Math.max(0, starts.length - 1);
+    const pointer = this._output.data();
+    // File offset of the first byte in the arena
+    const base = this._outputOffset;
+    const slice = (begin, end) =>
+      Module.HEAPU8.slice(pointer + begin - base, pointer + end - base).buffer;
+
+    const buffers = [];
+    const chunks = [];
+    let taken = base;
+    // Everything is header if the recording ended without audio.
+    const headerSize = starts.length > 0 ? starts[0].offset
+      : this._chunkEnd ? this._chunkEnd.offset : 0;
+    const header = !this._headerTaken && (count > 0 || !!this._chunkEnd);
+    if (header) {
+      buffers.push(slice(0, headerSize));
+      this._headerTaken = true;
+      taken = headerSize;
+    }
+    for (let i = 0; i < count; i++) {
+      const { offset, time } = starts[i];
+      const next = starts[i + 1] || this._chunkEnd;
+      buffers.push(slice(offset, next.offset));
+      chunks.push({
+        start: time / GRANULES_PER_MS,
+        end: next.time / GRANULES_PER_MS,
+        offset,
+        size: next.offset - offset
+      });
+      taken = next.offset;
+    }
+    starts.splice(0, count);
+    this._output.consume(taken - base);
+    this._outputOffset = taken;
+    return { buffers, header, chunks };
+  }
+
+  /**
+   * Bytes the next flush() would take, e.g. to hand them off once
+   * encoderOptions.outputHighWaterMark is reached. With chunks, those of the
+   * whole chunks only. 0 for a seekable WebM, which is kept by the container
+   * until the end.
+   * @return {number}
+   */
+  getTakeableBytes () {
+    if (this._heldWhole) {
+      return 0;
+    }
+    this._drain();
+    if (!this._chunked) {
+      return this._output.size();
+    }
+    if (!this._chunkEnd) {
+      this._collectChunks();
+    }
+    // Up to the start of the chunk being written, see flushChunks().
+    const starts = this._chunkStarts;
+    const count = this._chunkEnd ? starts.length : Math.max(0, starts.length - 1);
+    if (count === 0) {
+      return 0;
+    }
+    const end = starts[count] || this._chunkEnd;
+    return end.offset - this._outputOffset;
+  }
+
+  /**
+   * The seek index sidecar of the finished recording, see
+   * encoderOptions.oggSeekIndexInterval and OggContainer::writeSeekIndex().
+   * @return {?ArrayBuffer} - null without a seek index, or before the end.
+   */
+  getSeekIndex () {
+    return this._seekIndex;
+  }
+
+  /**
+   * Counters for monitoring. See OpusMediaRecorder.requestStats().
+   * @return {Object}
+   */
+  getStats () {
+    this._drain();
+    const container = this._container.getStats();
+    const memory = this._container.getMemoryStats();
+    return {
+      frames: container.frames,
+      bytes: container.bytes,
+      pages: container.pages,
+      clusters: container.clusters,
+      // Output collected but not taken by flush() yet
+      pendingBytes: this._output.size(),
+      // Bytes allocated in the WASM heap now and at most, and the size of
+      // the WASM memory, which only grows.
+      heapInUse: this._heapUsage.sample(),
+      heapPeak: this._heapUsage.getPeak(),
+      memorySize: Module.HEAPU8.length,
+      // The arena of the container, see ContainerArena.hpp
+      arena: {
+        size: memory.arena_bytes,
+        used: memory.used_bytes,
+        peak: memory.peak_bytes,
+        heapAllocations: memory.heap_allocations
+      },
+      tracks: this._tracks.map(({ pipeline }) => ({
+        // Lowered by adaptiveComplexity when encoding is too slow
+        complexity: pipeline.getControl(CONTROLS.complexity),
+        // Left out by encoderOptions.silenceThreshold
+        gatedFrames: pipeline.getGatedFrameCount(),
+        encodeTime: histogramToObject(pipeline.getEncodeTime()),
+        muxTime: histogramToObject(pipeline.getMuxTime())
+      }))
+    };
+  }
+
+  /**
+   * End the recording but keep the container and the pipelines, so reset()
+   * can start the next one without allocating them again. The last flush()
+   * collects the end of the stream.
+   */
+  finish () {
+    for (const { pipeline } of this._tracks) {
+      this._check(pipeline.close());
+    }
+    this._container.finish();
+    this._endChunks();
+    this._takeSeekIndex();
+  }
+
+  /**
+   * Start a new recording after finish(), with the same arguments as the
+   * constructor. The pipeline of the first track is initialized again, which
+   * keeps its Opus encoder and resampler if the format is the same.
+   */
+  reset (inputSampleRate, channelCount, bitsPerSecond = undefined, options = {}) {
+    this.config = { inputSampleRate, channelCount };
+    // Tracks added to the last recording are added again by addTrack().
+    for (const { pipeline } of this._tracks.splice(1)) {
+      this._destroyPipeline(pipeline);
+    }
+    this._reserveOutput(options);
+    this._configureContainer(options, bitsPerSecond);
+    this._bitsPerSecond = bitsPerSecond || 0;
+    this._resampleQuality = options.resampleQuality;
+    this._frameSize = frameSizeOf(options.frameDuration);
+    this._controls = pickControls(options);
+    this._initChunks(options);
+    this._tracks[0] = this._initTrack(this._tracks[0].pipeline, channelCount,
+                                      inputSampleRate);
   }
 
   /**
-   * Free up memory before close the web worker.
+   * Free up memory before close the web worker. The output arena is kept so
+   * the last flush() can collect what the container emitted on destruction.
    */
   close () {
-    // Encode the remaining buffers first.
-    const {channelCount} = this.config;
-    // Fill zero to buffers, size is the same as re rest of inputBuffer.
-    let finalFrameBuffers = [];
-    for (let i = 0; i < channelCount; ++i) {
-      finalFrameBuffers.push(new Float32Array(BUFFER_LENGTH - (this.inputBufferIndex / channelCount)));
+    // Encode the remaining samples of every track first.
+    for (const { pipeline } of this._tracks) {
+      this._check(pipeline.close());
+      this._destroyPipeline(pipeline);
     }
-    this.encode(finalFrameBuffers);
+    this._tracks = [];
 
-    // By destroying the container it may emit the remaining buffer.
+    // The container emits the remaining buffer when it finishes, which
+    // destroying it would do too. The chunks are read before it is gone.
+    this._container.finish();
+    this._endChunks();
+    this._takeSeekIndex();
     Module.destroy(this._container);
-    this.mInputBuffer.free();
-    this.mResampledBuffer.free();
-    this.mOutputBuffer.free();
-    this._opus_encoder_destroy(this.encoder);
-    this._speex_resampler_destroy(this.resampler);
+    Module.destroy(this._heapUsage);
   }
 
   /**
-   * Interleave the channel buffer.
-   * @param {Float32Array[]} channelBuffers - An array of buffers to interleave.
+   * Initialize a pipeline for a new track, or the first track again.
+   * @return {{pipeline, channelCount: number, inputPointers: number[]}}
    */
-  interleave (channelBuffers) {
-    const chCount = channelBuffers.length;
+  _initTrack (pipeline, channelCount, inputSampleRate) {
+    // The first pipeline of an uninitialized container initializes it.
+    // Optional arguments of the binding cannot be skipped, so the default
+    // quality is passed explicitly along with the frame size.
+    const resampleQuality = this._resampleQuality === undefined
+      ? DEFAULT_RESAMPLE_QUALITY
+      : this._resampleQuality;
+    this._check(pipeline.init(inputSampleRate, channelCount,
+                              this._bitsPerSecond,
+                              Math.floor(Math.random() * 0xFFFFFFFF),
+                              resampleQuality, this._frameSize));
+    this._applyControls(pipeline, this._controls);
 
-    // if it only has one channel, no interleave needed.
-    if (chCount === 1) {
-      return channelBuffers[0];
+    // Planar input buffers in the WASM heap. Keep pointers instead of typed
+    // array views, because views are detached when the heap grows.
+    const inputPointers = [];
+    for (let ch = 0; ch < channelCount; ch++) {
+      inputPointers.push(pipeline.getInputBuffer(ch));
     }
-    // Format: | ch0 | ch1 | ch0 | ch1 | ch0 | ch1 | ch0 | ch1 | ...
-    for (let ch = 0; ch < chCount; ch++) {
-      let buffer = channelBuffers[ch];
-      for (let i = 0; i < buffer.length; i++) {
-        this.interleavedBuffers[i * chCount + ch] = buffer[i];
+    this.maxInputLength = pipeline.getMaxInputLength();
+    return { pipeline, channelCount, inputPointers };
+  }
+
+  /**
+   * Set the controls given, see setControls().
+   */
+  _applyControls (pipeline, controls) {
+    for (const name of Object.keys(controls)) {
+      if (!(name in CONTROLS)) {
+        continue;
       }
+      let value = controls[name];
+      if (name === 'bandwidth') {
+        if (!(value in BANDWIDTHS)) {
+          throw new Error(`Unknown bandwidth ${value}.`);
+        }
+        value = BANDWIDTHS[value];
+      }
+      // Booleans are 0 or 1.
+      this._check(pipeline.setControl(CONTROLS[name], Number(value)));
+    }
+  }
+
+  /**
+   * Free a closed pipeline. The engine frees its sessions by itself.
+   */
+  _destroyPipeline (pipeline) {
+    if (!this._engine) {
+      Module.destroy(pipeline);
+    }
+  }
+
+  /**
+   * Size the output arena. With a high-water mark the output is handed off
+   * whenever it reaches the mark, so the arena never needs to grow past it.
+   * The capacity is kept by the sink, so it is only allocated once.
+   * @param {Object} options - encoderOptions from OpusMediaRecorder.
+   */
+  _reserveOutput (options) {
+    const { outputHighWaterMark } = options;
+    this._output.reserve(outputHighWaterMark
+      ? outputHighWaterMark + OUTPUT_ARENA_HEADROOM
+      : OUTPUT_ARENA_CAPACITY);
+  }
+
+  /**
+   * Start the chunk index of a new recording, see flushChunks().
+   * @param {Object} options - encoderOptions from OpusMediaRecorder.
+   */
+  _initChunks (options) {
+    // A seekable WebM is rewritten at the end, so it has no chunks.
+    this._chunked = options.chunkDuration > 0 &&
+      !(options.webmSeekable && this._container.setSeekable);
+    // Chunks listed by the container and not taken yet, {offset, time}. The
+    // last one is still being written until _chunkEnd is set at the end.
+    this._chunkStarts = [];
+    this._chunkEnd = null;
+    this._headerTaken = false;
+    // File offset of the first byte in the output arena
+    this._outputOffset = 0;
+  }
+
+  /**
+   * Move the chunks listed by the container to _chunkStarts.
+   */
+  _collectChunks () {
+    const count = this._container.getChunkCount();
+    for (let i = 0; i < count; i++) {
+      const { offset, time } = this._container.getChunk(i);
+      this._chunkStarts.push({ offset, time });
     }
-    return this.interleavedBuffers;
+    this._container.clearChunks();
   }
 
-  OpusInitCodec (outRate, chCount, bitRate = undefined) {
-    let mErr = this.memory.mallocUint32(undefined);
-    this.encoder = this._opus_encoder_create(outRate, chCount, OPUS_APPLICATION, mErr.pointer);
-    let err = mErr.value;
-    mErr.free();
-    if (err !== OPUS_OK) {
-      throw new Error('Opus encodor initialization failed.');
+  /**
+   * Note where the last chunk ends, once the container has finished.
+   */
+  _endChunks () {
+    if (!this._chunked) {
+      return;
+    }
+    this._collectChunks();
+    const { bytes, samples } = this._container.getStats();
+    this._chunkEnd = { offset: bytes, time: samples };
+  }
+
+  /**
+   * Copy the seek index out of the finished container, which may be
+   * destroyed next.
+   */
+  _takeSeekIndex () {
+    if (!this._seekIndexed) {
+      return;
     }
-    /** Configures the bitrate in the encoder.
-     * Rates from 500 to 512000 bits per second are meaningful, as well as the
-     * special values #OPUS_AUTO (-1000) and #OPUS_BITRATE_MAX (-1).
-     * The value #OPUS_BITRATE_MAX can be used to cause the codec to use as much
-     * rate as it can, which is useful for controlling the rate by adjusting the
-     * output buffer size. The default is determined based on the number of
-     * channels and the input sampling rate.
-     */
-    if (bitRate) {
-      this.OpusSetOpusControl(OPUS_SET_BITRATE_REQUEST, bitRate);
+    const sink = new Module.MemoryOutputSink();
+    this._container.writeSeekIndex(sink);
+    const pointer = sink.data();
+    this._seekIndex = Module.HEAPU8.slice(pointer, pointer + sink.size()).buffer;
+    Module.destroy(sink);
+  }
+
+  /**
+   * Apply format specific options. Options of the other format are ignored.
+   * @param {Object} options - encoderOptions from OpusMediaRecorder.
+   * @param {number} [bitsPerSecond] - Sizes the memory of the container.
+   */
+  _configureContainer (options, bitsPerSecond) {
+    const { oggMaxPageDuration, oggTargetPageSize, oggFlushPackets,
+            oggSeekIndexInterval, webmSeekable, webmBlockDuration,
+            webmClusterDuration, chunkDuration } = options;
+    if (this._container.setPagingPolicy) {
+      this._container.setPagingPolicy((oggMaxPageDuration || 0) * GRANULES_PER_MS,
+                                      oggTargetPageSize || 0,
+                                      oggFlushPackets || 0);
+      this._container.setSeekIndexInterval((oggSeekIndexInterval || 0) * GRANULES_PER_MS);
+    }
+    this._seekIndexed = oggSeekIndexInterval > 0 && !!this._container.setSeekIndexInterval;
+    // A seekable WebM is rewritten at the end, nothing can be taken before.
+    this._heldWhole = !!webmSeekable && !!this._container.setSeekable;
+    this._seekIndex = null;
+    if (this._container.setSeekable) {
+      this._container.setSeekable(!!webmSeekable);
+      this._container.setBlockDuration((webmBlockDuration || 0) * GRANULES_PER_MS);
+      this._container.setMaxClusterDuration((webmClusterDuration || 0) * GRANULES_PER_MS);
+    }
+    this._container.setChunkDuration((chunkDuration || 0) * GRANULES_PER_MS);
+    this._container.setBitrate(bitsPerSecond || 0);
+  }
+
+  /**
+   * Wait for the engine to encode everything submitted so far, before reading
+   * the output or the stats. Nothing to wait for without an engine.
+   */
+  _drain () {
+    if (!this._engine) {
+      return;
+    }
+    for (const { pipeline } of this._tracks) {
+      this._check(pipeline.drain());
+    }
+  }
+
+  /**
+   * Throw if a EncoderPipeline method failed.
+   * @param {number} result - Return value of a EncoderPipeline method.
+   */
+  _check (result) {
+    if (result < 0) {
+      throw new Error(PIPELINE_ERRORS[result] || 'Unknown encoder error.');
+    }
+  }
+}
+
+/**
+ * A session of EncoderEngine with the methods of EncoderPipeline that
+ * _OpusEncoder uses. encode() only queues the samples, so call drain() before
+ * reading the output.
+ */
+class _EngineSession {
+  constructor (engine, container) {
+    this._engine = engine;
+    this._container = container;
+    this._session = -1;
+    this._pipeline = null;
+  }
+
+  init (inputSampleRate, channelCount, bitrate, serial, resampleQuality, frameSize) {
+    const session = this._engine.openSession(this._container, inputSampleRate,
+                                             channelCount, bitrate, serial,
+                                             resampleQuality, frameSize);
+    if (session < 0) {
+      return session;
     }
+    this._session = session;
+    this._pipeline = this._engine.getPipeline(session);
+    return 0;
+  }
+
+  getTrack () {
+    return this._pipeline.getTrack();
+  }
+
+  getInputBuffer (channel) {
+    return this._engine.getInputBuffer(this._session, channel);
+  }
+
+  getMaxInputLength () {
+    return this._engine.getMaxInputLength();
+  }
+
+  encode (length) {
+    return this._engine.submit(this._session, length);
+  }
+
+  setFrameSize (frameSize) {
+    return this._engine.setFrameSize(this._session, frameSize);
+  }
+
+  setControl (control, value) {
+    return this._engine.setControl(this._session, control, value);
+  }
+
+  getControl (control) {
+    return this._pipeline.getControl(control);
+  }
+
+  getGatedFrameCount () {
+    return this._pipeline.getGatedFrameCount();
+  }
+
+  drain () {
+    // Nothing left to wait for once closed
+    return this._session < 0 ? 0 : this._engine.drain(this._session);
+  }
+
+  close () {
+    const result = this._engine.closeSession(this._session);
+    this._session = -1;
+    this._pipeline = null;
+    return result;
+  }
+
+  getEncodeTime () {
+    return this._pipeline.getEncodeTime();
   }
 
-  OpusSetOpusControl (request, vaArg) {
-    let value = this.memory.mallocInt32(vaArg);
-    this._opus_encoder_ctl(this.encoder, request, value.pointer);
-    value.free();
+  getMuxTime () {
+    return this._pipeline.getMuxTime();
   }
+}
 
-  SpeexInitResampler (inputRate, outputRate, chCount) {
-    let mErr = this.memory.mallocUint32(undefined);
-    this.resampler = this._speex_resampler_init(chCount, inputRate, outputRate,
-                                                SPEEX_RESAMPLE_QUALITY, mErr.pointer);
-    let err = mErr.value;
-    mErr.free();
-    if (err !== RESAMPLER_ERR_SUCCESS) {
-      throw new Error('Initializing resampler failed.');
+/**
+ * Samples per channel of a frame at 48 kHz. An unsupported duration is
+ * rejected by EncoderPipeline.
+ * @param {number} [frameDuration] - In milliseconds, 20 by default.
+ * @return {number}
+ */
+function frameSizeOf (frameDuration) {
+  return frameDuration === undefined
+    ? DEFAULT_FRAME_SIZE
+    : Math.round(frameDuration * GRANULES_PER_MS);
+}
+
+/**
+ * The encoder controls among encoderOptions. The bitrate is bitsPerSecond.
+ * @param {Object} options - encoderOptions from OpusMediaRecorder.
+ * @return {Object} - See _OpusEncoder.setControls().
+ */
+function pickControls (options) {
+  const controls = {};
+  for (const name of ['complexity', 'vbr', 'bandwidth', 'adaptiveComplexity',
+                      'dtx', 'silenceThreshold']) {
+    if (options[name] !== undefined) {
+      controls[name] = options[name];
     }
   }
+  return controls;
+}
+
+/**
+ * Make the container of a MIME type, or the only container of the module.
+ * @param {string} [mimeType]
+ * @return {OggContainer|WebMContainer}
+ */
+function createContainer (mimeType) {
+  const className = mimeType
+    ? CONTAINER_CLASSES[mimeType]
+    : Object.values(CONTAINER_CLASSES).find(name => Module[name]);
+  if (!className || !Module[className]) {
+    throw new Error(`This encoder module does not support ${mimeType}.`);
+  }
+  return new Module[className]();
+}
+
+// Shared by every encoder of the module. Only pthreads builds have it.
+let sharedEngine = null;
+
+/**
+ * @return {?EncoderEngine} - The engine, or null if the module has none.
+ */
+function getEngine () {
+  if (!Module.EncoderEngine) {
+    return null;
+  }
+  if (!sharedEngine) {
+    sharedEngine = new Module.EncoderEngine(ENGINE_THREAD_COUNT);
+  }
+  return sharedEngine;
+}
+
+/**
+ * Copy a TimeHistogram out of WASM.
+ * @param {TimeHistogram} histogram
+ * @return {{count: number, total: number, max: number, buckets: number[]}} -
+ *         Times in microseconds. buckets[0] counts frames under 1 us,
+ *         buckets[i] frames under 2^i us, the last one all the slower ones.
+ */
+function histogramToObject (histogram) {
+  const buckets = [];
+  for (let i = 0; i < HISTOGRAM_BUCKET_COUNT; i++) {
+    buckets.push(histogram.getBucket(i));
+  }
+  return {
+    count: histogram.getCount(),
+    total: histogram.getTotal(),
+    max: histogram.getMax(),
+    buckets
+  };
 }
 
 // Emscripten (wasm) Module. Module is globally defined after compiled by emcc.
 /* global Module */
 
+/**
+ * Make an encoder independent of Module.encoder, e.g. to run several
+ * recordings in one module. In a pthreads build they are all encoded on the
+ * same thread pool. Its methods are those of the module interface below.
+ * @return {_OpusEncoder}
+ */
+Module.createEncoder = function (inputSampleRate, channelCount, bitsPerSecond, options = {},
+                                mimeType = undefined) {
+  return new _OpusEncoder(inputSampleRate, channelCount, bitsPerSecond, options,
+                          mimeType);
+};
+
 /**
  * Define the encoder module interface. The worker will interact with
  * the encoder via those functions only.
  */
-Module.init = function (inputSampleRate, channelCount, bitsPerSecond) {
-  Module.encodedBuffers = [];
-  Module.encoder = new _OpusEncoder(inputSampleRate, channelCount, bitsPerSecond);
+Module.init = function (inputSampleRate, channelCount, bitsPerSecond, options = {},
+                        mimeType = undefined) {
+  if (Module.encoder) {
+    // A reused worker: the last recording ended with finish(). Workers are
+    // reused for the same MIME type only, so the container is kept.
+    Module.encoder.reset(inputSampleRate, channelCount, bitsPerSecond, options);
+    return;
+  }
+  Module.encoder = Module.createEncoder(inputSampleRate, channelCount, bitsPerSecond,
+                                        options, mimeType);
+};
+
+/**
+ * Convert a whole Opus file between Ogg and WebM without decoding it, so the
+ * audio is not degraded and it costs a fraction of encoding. Pre-skip and
+ * channel mapping are kept, and so is end trimming when writing Ogg. Only
+ * OggWebMOpusEncoder.js has it.
+ * @param {ArrayBuffer|Uint8Array} data - The whole input file.
+ * @param {string} inputMimeType - 'audio/ogg' or 'audio/webm'.
+ * @param {string} outputMimeType - 'audio/ogg' or 'audio/webm'.
+ * @param {Object} [options] - Container options, e.g. webmSeekable.
+ * @return {ArrayBuffer} - The output file.
+ */
+Module.remux = function (data, inputMimeType, outputMimeType, options = {}) {
+  const readerClass = READER_CLASSES[inputMimeType];
+  if (!readerClass || !Module[readerClass]) {
+    throw new Error(`This encoder module cannot read ${inputMimeType}.`);
+  }
+  const bytes = data instanceof Uint8Array ? data : new Uint8Array(data);
+  const reader = new Module[readerClass]();
+  const output = new Module.MemoryOutputSink();
+  const container = createContainer(outputMimeType);
+  const pointer = Module._malloc(bytes.length);
+  try {
+    Module.HEAPU8.set(bytes, pointer);
+    let result = reader.open(pointer, bytes.length);
+    if (result === 0) {
+      container.setOutputSink(output);
+      if (container.setSeekable) {
+        container.setSeekable(!!options.webmSeekable);
+      }
+      result = reader.remux(container, Math.floor(Math.random() * 0xFFFFFFFF));
+    }
+    if (result < 0) {
+      throw new Error(READER_ERRORS[result] || 'Unknown remux error.');
+    }
+    const outputPointer = output.data();
+    return Module.HEAPU8.slice(outputPointer, outputPointer + output.size()).buffer;
+  } finally {
+    // The container flushes its sink when destroyed, so it goes first.
+    Module.destroy(container);
+    Module.destroy(output);
+    Module.destroy(reader);
+    Module._free(pointer);
+  }
 };
 
-Module.encode = function (buffers) {
-  Module.encoder.encode(buffers);
+Module.addTrack = function (channelCount, inputSampleRate) {
+  return Module.encoder.addTrack(channelCount, inputSampleRate);
+};
+
+Module.encode = function (buffers, track = 0) {
+  Module.encoder.encode(buffers, track);
+};
+
+Module.setFrameDuration = function (frameDuration) {
+  Module.encoder.setFrameDuration(frameDuration);
+};
+
+Module.setControls = function (controls) {
+  Module.encoder.setControls(controls);
 };
 
 Module.flush = function () {
-  return Module.encodedBuffers.splice(0, Module.encodedBuffers.length);
+  return Module.encoder.flush();
+};
+
+Module.flushChunks = function () {
+  return Module.encoder.flushChunks();
+};
+
+Module.getSeekIndex = function () {
+  return Module.encoder.getSeekIndex();
+};
+
+Module.getTakeableBytes = function () {
+  return Module.encoder.getTakeableBytes();
+};
+
+Module.getStats = function () {
+  return Module.encoder.getStats();
+};
+
+Module.finish = function () {
+  Module.encoder.finish();
 };
 
 Module.close = function () {
@@ -1,9 +1,17 @@
 const { EventTarget, defineEventAttribute } = require('event-target-shim');
 const { detect } = require('detect-browser');
+const InputRing = require('./InputRing.js');
 const browser = detect();
 
 const AudioContext = global.AudioContext || global.webkitAudioContext;
 const BUFFER_SIZE = 4096;
+// Seconds of input the ring of workerOptions.useAudioWorklet holds, how far
+// the worker may fall behind before input is dropped.
+const INPUT_RING_DURATION = 1;
+
+// Loaded encoder workers kept by workerOptions.reuseWorker, waiting for the
+// next recording of the same MIME type and WASM path.
+const idleWorkers = [];
 
 /**
  * Reference: https://w3c.github.io/mediacapture-record/#mediarecorder-api
@@ -38,11 +46,129 @@ class OpusMediaRecorder extends EventTarget {
    * @param {string} [workerOptions.WebMOpusEncoderWasmPath]
    *          Path of ./WebMOpusEncoder.wasm which is used for WebM Opus encoding
    *          by the encoder worker. This is NON-STANDARD.
+   * @param {string} [workerOptions.OggWebMOpusEncoderWasmPath]
+   *          Path of ./OggWebMOpusEncoder.wasm, which has both the OGG and
+   *          the WebM container. If present, it is used for both formats
+   *          instead of the two above, so an app recording in both downloads
+   *          the codecs once. This is NON-STANDARD.
+   * @param {string} [workerOptions.WaveEncoderWasmPath]
+   *          Path of ./WaveEncoder.wasm which is used for WAV encoding
+   *          by the encoder worker. This is NON-STANDARD.
+   * @param {Object} [workerOptions.encoderOptions] Settings passed to the
+   *          encoder in the worker. Options of other formats are ignored.
+   *          This is NON-STANDARD.
+   * @param {number} [workerOptions.encoderOptions.oggMaxPageDuration]
+   *          Ogg: flush a page once it holds this many milliseconds of audio.
+   * @param {number} [workerOptions.encoderOptions.oggTargetPageSize]
+   *          Ogg: emit pages when about this many bytes are queued.
+   * @param {number} [workerOptions.encoderOptions.oggFlushPackets]
+   *          Ogg: flush a page every N Opus packets.
+   * @param {number} [workerOptions.encoderOptions.oggSeekIndexInterval]
+   *          Ogg: record a seek index with a point at least every this many
+   *          milliseconds, e.g. 1000. It comes as the NON-STANDARD seekIndex
+   *          Blob of the last dataavailable event, a sidecar file mapping
+   *          granule positions to byte offsets of pages, so a server can seek
+   *          without bisecting the file. See OggContainer::writeSeekIndex()
+   *          for its format.
+   * @param {boolean} [workerOptions.encoderOptions.webmSeekable]
+   *          WebM: write Cues and Duration for seeking. The whole file is
+   *          kept in the worker and comes out with the last dataavailable,
+   *          whatever the timeslice, requestData() calls or
+   *          outputHighWaterMark, as its beginning is rewritten at the end.
+   * @param {number} [workerOptions.encoderOptions.webmBlockDuration]
+   *          WebM: pack consecutive Opus packets into blocks of up to this
+   *          many milliseconds, at most 120, e.g. 100 for a block every 5
+   *          packets of 20 ms. It saves the block header of each packet,
+   *          which matters at low bitrates like 8 to 16 kbps of voice, and
+   *          delays the output by up to that long. One packet per block by
+   *          default. Only a mono or stereo single track is packed.
+   * @param {number} [workerOptions.encoderOptions.webmClusterDuration]
+   *          WebM: start a new cluster after this many milliseconds. Longer
+   *          clusters save bytes, shorter ones let players join a live
+   *          stream sooner. The default of libwebm is about 30 seconds.
+   * @param {number} [workerOptions.encoderOptions.resampleQuality]
+   *          Ogg and WebM: quality of resampling to 48 kHz, from 0 (fastest)
+   *          to 10 (best). The default is 6. Low-end devices can trade
+   *          quality for CPU time. Unused when the input is 48 kHz.
+   * @param {number} [workerOptions.encoderOptions.frameDuration]
+   *          Ogg and WebM: duration of an Opus frame in milliseconds, 2.5, 5,
+   *          10, 20, 40 or 60. The default is 20. Shorter frames lower the
+   *          latency, longer ones the overhead. See setFrameDuration().
+   * @param {number} [workerOptions.encoderOptions.complexity]
+   *          Ogg and WebM: Opus complexity from 0 (fastest) to 10 (best).
+   *          The default of libopus is used if not given.
+   * @param {boolean} [workerOptions.encoderOptions.vbr]
+   *          Ogg and WebM: false for a constant bitrate. true by default.
+   * @param {string} [workerOptions.encoderOptions.bandwidth]
+   *          Ogg and WebM: 'auto', the default, 'narrowband', 'mediumband',
+   *          'wideband', 'superwideband' or 'fullband'.
+   * @param {boolean} [workerOptions.encoderOptions.adaptiveComplexity]
+   *          Ogg and WebM: lower the complexity while encoding takes more
+   *          than half of real time, e.g. on a busy phone, and raise it again
+   *          up to encoderOptions.complexity once there is time to spare.
+   *          The complexity in use is in the stats, see requestStats().
+   *          See also setEncoderControls().
+   * @param {boolean} [workerOptions.encoderOptions.dtx]
+   *          Ogg and WebM: Opus discontinuous transmission, tiny packets
+   *          during silence. false by default.
+   * @param {number} [workerOptions.encoderOptions.silenceThreshold]
+   *          Ogg and WebM: a level in dBFS, e.g. -60. Once the input has been
+   *          quieter than that for 200 ms, frames are not encoded until it is
+   *          louder again, which saves CPU time and bytes in long mostly
+   *          silent recordings. Ogg keeps them as empty packets, WebM as gaps
+   *          between blocks, and players conceal them. Off by default.
+   * @param {number} [workerOptions.encoderOptions.outputHighWaterMark]
+   *          Bytes of encoded output the worker may hold. Once it holds that
+   *          much that can be handed over, it does so by itself: a
+   *          NON-STANDARD 'highwatermark' event, then a dataavailable event
+   *          with it, as if requestData() was called. Unbounded by default.
+   *          The output of Ogg, a WAV or a streamed WebM then stays under
+   *          the mark however long the recording is, and WAV headers keep
+   *          unknown sizes. With chunkDuration, only whole chunks are handed
+   *          over, so the output may also hold the chunk being written. A
+   *          seekable WebM is kept whole until the end whatever the mark.
+   * @param {number} [workerOptions.encoderOptions.chunkDuration]
+   *          Ogg and WebM: cut the output into chunks of at least this many
+   *          milliseconds, each starting on a WebM cluster or on new Ogg
+   *          pages, so each one can be decoded, uploaded or retried on its own
+   *          together with the header bytes. dataavailable then only carries
+   *          whole chunks, the one being written comes with the next event,
+   *          and has NON-STANDARD properties: header, a Blob of the EBML
+   *          header and Tracks or the ID and comment pages, the same in every
+   *          event once the first chunk is out, and chunks, an array of {start, end, offset, data} with
+   *          start and end in milliseconds, offset in bytes from the
+   *          beginning of the file and data a Blob. data of the event is
+   *          still the next part of the file, header included in the first
+   *          one. Ignored by a seekable WebM.
+   * @param {16|24|32} [workerOptions.encoderOptions.waveBitDepth]
+   *          WAV: bits per sample, 32 for float. 16 by default.
+   *          The RIFF and data sizes are only filled in when the file comes
+   *          out in one piece, with the last dataavailable. Once part of it
+   *          has been handed over, by a timeslice, requestData() or
+   *          outputHighWaterMark, they stay 0xFFFFFFFF, the mark of a WAV
+   *          stream of unknown length, which most players read to the end.
+   * @param {boolean} [workerOptions.useAudioWorklet] Capture with an
+   *          AudioWorklet writing to a lock-free ring in a SharedArrayBuffer
+   *          that the worker reads by itself, instead of a
+   *          ScriptProcessorNode posting every block through the main thread.
+   *          A busy main thread then cannot cause dropouts. Needs a
+   *          cross-origin isolated page, otherwise the ScriptProcessorNode is
+   *          used. The stats then count droppedInputFrames, see
+   *          requestStats(). This is NON-STANDARD.
+   * @param {string} [workerOptions.inputWorkletPath] Path of
+   *          ./inputWorklet.js, for useAudioWorklet. The default is next to
+   *          this script. This is NON-STANDARD.
+   * @param {boolean} [workerOptions.reuseWorker] Keep the encoder worker
+   *          after stop() instead of closing it. The next start() of this
+   *          recorder, or of a new recorder with the same MIME type and WASM
+   *          path, records on it right away without loading WASM again.
    */
   constructor (stream, options = {}, workerOptions = {}) {
     const { mimeType, audioBitsPerSecond, videoBitsPerSecond, bitsPerSecond } = options; // eslint-disable-line
     // NON-STANDARD options
-    const { encoderWorkerFactory, OggOpusEncoderWasmPath, WebMOpusEncoderWasmPath } = workerOptions;
+    const { encoderWorkerFactory, OggOpusEncoderWasmPath, WebMOpusEncoderWasmPath,
+            OggWebMOpusEncoderWasmPath, WaveEncoderWasmPath, encoderOptions,
+            reuseWorker, useAudioWorklet, inputWorkletPath } = workerOptions;
 
     super();
     // Attributes for the specification conformance. These have their own getters.
@@ -50,6 +176,13 @@ class OpusMediaRecorder extends EventTarget {
     this._state = 'inactive';
     this._mimeType = mimeType || '';
     this._audioBitsPerSecond = audioBitsPerSecond || bitsPerSecond;
+    this._encoderOptions = encoderOptions || {};
+    this._reuseWorker = !!reuseWorker;
+    // Header bytes of the chunks, see encoderOptions.chunkDuration
+    this._chunkHeader = null;
+    this._useAudioWorklet = !!useAudioWorklet;
+    // The ring of the recording, when it is captured by the AudioWorklet
+    this._inputRing = null;
     /** @type {'inactive'|'readyToInit'|'encoding'|'closed'} */
     this.workerState = 'inactive';
 
@@ -95,17 +228,22 @@ class OpusMediaRecorder extends EventTarget {
             this._mimeType = 'audio/webm';
         }
     }
+    this._combinedEncoder = false;
     switch (this._mimeType) {
       case 'audio/wave':
-        this._wasmPath = ''; // wasm is not used
+        this._wasmPath = WaveEncoderWasmPath || '';
         break;
 
       case 'audio/webm':
-        this._wasmPath = WebMOpusEncoderWasmPath || '';
-        break;
-
       case 'audio/ogg':
-        this._wasmPath = OggOpusEncoderWasmPath || '';
+        if (OggWebMOpusEncoderWasmPath) {
+          this._wasmPath = OggWebMOpusEncoderWasmPath;
+          this._combinedEncoder = true;
+          break;
+        }
+        this._wasmPath = this._mimeType === 'audio/webm'
+          ? WebMOpusEncoderWasmPath || ''
+          : OggOpusEncoderWasmPath || '';
         break;
 
       default:
@@ -119,8 +257,9 @@ class OpusMediaRecorder extends EventTarget {
     } else if (self.location) {
       workerDir = self.location.href;
     }
-    workerDir = workerDir.substr(0, workerDir.lastIndexOf('/')) +
-                '/encoderWorker.umd.js';
+    const scriptDir = workerDir.substr(0, workerDir.lastIndexOf('/'));
+    workerDir = scriptDir + '/encoderWorker.umd.js';
+    this._inputWorkletPath = inputWorkletPath || scriptDir + '/inputWorklet.js';
     // If worker function is imported via <script> tag, make it blob to get URL.
     if (typeof OpusMediaRecorder.encoderWorker === 'function') {
       workerDir = URL.createObjectURL(new Blob([`(${OpusMediaRecorder.encoderWorker})()`]));
@@ -186,36 +325,70 @@ class OpusMediaRecorder extends EventTarget {
    * Initialize worker
    */
   _spawnWorker () {
-    this.worker = this._workerFactory();
+    const idle = this._reuseWorker
+      ? idleWorkers.findIndex(({ key }) => key === this._workerKey())
+      : -1;
+    this.worker = idle >= 0
+      ? idleWorkers.splice(idle, 1)[0].worker
+      : this._workerFactory();
     this.worker.onmessage = (e) => this._onmessageFromWorker(e);
     this.worker.onerror = (e) => this._onerrorFromWorker(e);
 
+    if (idle >= 0) {
+      // Already loaded, so it takes 'init' now.
+      this.workerState = 'readyToInit';
+      return;
+    }
     this._postMessageToWorker('loadEncoder',
                               { mimeType: this._mimeType,
-                                wasmPath: this._wasmPath });
+                                wasmPath: this._wasmPath,
+                                combined: this._combinedEncoder });
+  }
+
+  /**
+   * Hand a worker that has finished a recording over to the next one.
+   */
+  _releaseWorker () {
+    this.worker.onmessage = null;
+    this.worker.onerror = null;
+    idleWorkers.push({ key: this._workerKey(), worker: this.worker });
+    this.worker = null;
+  }
+
+  /**
+   * Workers can be reused by recorders loading the same module.
+   * @return {string}
+   */
+  _workerKey () {
+    return `${this._mimeType} ${this._wasmPath}`;
   }
 
   /**
    * Post message to the encoder web worker.
-   * @param {"init"|"pushInputData"|"getEncodedData"|"done"} command - Type of message to send to the worker
+   * @param {"init"|"pushInputData"|"getEncodedData"|"getStats"|"done"} command - Type of message to send to the worker
    * @param {object} message - Payload to the worker
    */
   _postMessageToWorker (command, message = {}) {
     switch (command) {
       case 'loadEncoder':
-        let { mimeType, wasmPath } = message;
-        this.worker.postMessage({ command, mimeType, wasmPath });
+        let { mimeType, wasmPath, combined } = message;
+        this.worker.postMessage({ command, mimeType, wasmPath, combined });
         break;
 
       case 'init':
         // Initialize the worker
-        let { sampleRate, channelCount, bitsPerSecond } = message;
-        this.worker.postMessage({ command, sampleRate, channelCount, bitsPerSecond });
+        let { sampleRate, channelCount, bitsPerSecond, encoderOptions } = message;
+        this.worker.postMessage({
+          command, sampleRate, channelCount, bitsPerSecond, encoderOptions,
+          // Shared, not transferred. The worker then reads the input itself
+          // and hands data over every timeslice (in seconds).
+          inputRingBuffer: this._inputRing && this._inputRing.buffer,
+          timeslice: this._timeslice
+        });
         this.workerState = 'encoding';
 
         // Start streaming
-        this.source.connect(this.processor);
-        this.processor.connect(this.context.destination);
+        this._connectInput();
         let eventToPush = new global.Event('start');
         this.dispatchEvent(eventToPush);
         break;
@@ -235,10 +408,24 @@ class OpusMediaRecorder extends EventTarget {
         this.worker.postMessage({ command });
         break;
 
+      case 'getStats':
+        // Expected 'stats' event from the worker
+        this.worker.postMessage({ command });
+        break;
+
+      case 'setFrameDuration':
+        this.worker.postMessage({ command, frameDuration: message.frameDuration });
+        break;
+
+      case 'setControls':
+        this.worker.postMessage({ command, controls: message.controls });
+        break;
+
       case 'done':
-        // Tell encoder finallize the job and destory itself.
+        // Tell encoder finallize the job and destory itself, unless the
+        // worker is reused.
         // Expected 'lastEncodedData' event from the worker.
-        this.worker.postMessage({ command });
+        this.worker.postMessage({ command, reuse: this._reuseWorker });
         break;
 
       default:
@@ -264,39 +451,85 @@ class OpusMediaRecorder extends EventTarget {
           this._postMessageToWorker('init',
                                     { sampleRate,
                                       channelCount,
-                                      bitsPerSecond: this.audioBitsPerSecond});
+                                      bitsPerSecond: this.audioBitsPerSecond,
+                                      encoderOptions: this._encoderOptions });
         }
         break;
 
       case 'encodedData':
       case 'lastEncodedData':
+        if (event.data.highWaterMark) {
+          // Handed off by the worker, not requested
+          eventToPush = new global.Event('highwatermark');
+          eventToPush.bytes = buffers.reduce((sum, buffer) => sum + buffer.byteLength, 0);
+          this.dispatchEvent(eventToPush);
+        }
         let data = new Blob(buffers, {'type': this._mimeType});
         eventToPush = new global.Event('dataavailable');
         eventToPush.data = data;
+        if (event.data.chunks) {
+          this._addChunks(eventToPush, event.data);
+        }
+        if (event.data.seekIndex) {
+          eventToPush.seekIndex = new Blob([event.data.seekIndex],
+                                           {'type': 'application/octet-stream'});
+        }
         this.dispatchEvent(eventToPush);
 
         // Detect of stop() called before
         if (command === 'lastEncodedData') {
+          // Before 'stop', so a start() from its listener gets a worker.
+          if (this._reuseWorker) {
+            this._releaseWorker();
+          }
+          this.workerState = 'closed';
+
           eventToPush = new global.Event('stop');
           this.dispatchEvent(eventToPush);
-
-          this.workerState = 'closed';
         }
         break;
 
+      case 'stats':
+        eventToPush = new global.Event('stats');
+        eventToPush.stats = event.data.stats;
+        this.dispatchEvent(eventToPush);
+        break;
+
       default:
         break; // Ignore
     }
   }
 
+  /**
+   * Add the NON-STANDARD header and chunks of encoderOptions.chunkDuration to
+   * a dataavailable event.
+   * @param {Event} dataEvent - The dataavailable event.
+   * @param {Object} output - See _OpusEncoder.flushChunks().
+   */
+  _addChunks (dataEvent, { buffers, header, chunks }) {
+    const options = {'type': this._mimeType};
+    let first = 0;
+    if (header) {
+      // Taken once per recording by the worker, kept for every event
+      this._chunkHeader = new Blob([buffers[0]], options);
+      first = 1;
+    }
+    dataEvent.header = this._chunkHeader;
+    dataEvent.chunks = chunks.map(({ start, end, offset }, i) => ({
+      start,
+      end,
+      offset,
+      data: new Blob([buffers[first + i]], options)
+    }));
+  }
+
   /**
    * onerror() callback from the worker.
    * @param {ErrorEvent} error - error object from the worker
    */
   _onerrorFromWorker (error) {
     // Stop stream first
-    this.source.disconnect();
-    this.processor.disconnect();
+    this._disconnectInput();
 
     this.worker.terminate();
     this.workerState = 'closed';
@@ -313,6 +546,79 @@ class OpusMediaRecorder extends EventTarget {
     this.dispatchEvent(errorToPush);
   }
 
+  /**
+   * Create the node capturing the input: an AudioWorkletNode writing to a new
+   * InputRing if workerOptions.useAudioWorklet can be honored, otherwise a
+   * ScriptProcessorNode posting blocks to the worker.
+   * @param {number} timeslice - In seconds, see start().
+   */
+  _createInput (timeslice) {
+    this._timeslice = timeslice;
+    this._inputRing = null;
+    // SharedArrayBuffer is only defined on cross-origin isolated pages.
+    if (!this._useAudioWorklet || !this.context.audioWorklet ||
+        typeof SharedArrayBuffer === 'undefined') {
+      /** @type {ScriptProcessorNode} */
+      this.processor = this.context.createScriptProcessor(BUFFER_SIZE, this.channelCount, this.channelCount);
+      this._enableAudioProcessCallback(timeslice);
+      this._inputReady = Promise.resolve();
+      return;
+    }
+
+    const { context, channelCount } = this;
+    const ring = InputRing.create(channelCount, this.sampleRate * INPUT_RING_DURATION);
+    this._inputRing = ring;
+    // The node exists once its module has loaded, see _connectInput().
+    this.processor = null;
+    this._inputReady = context.audioWorklet.addModule(this._inputWorkletPath)
+      .then(() => {
+        // Stopped while loading
+        if (context.state === 'closed') {
+          return;
+        }
+        /** @type {AudioWorkletNode} */
+        this.processor = new global.AudioWorkletNode(context, 'opus-media-recorder-input', {
+          channelCount,
+          channelCountMode: 'explicit',
+          processorOptions: { buffer: ring.buffer }
+        });
+      })
+      .catch(error => {
+        let errorToPush = new global.Event('error');
+        errorToPush.name = 'NotSupportedError';
+        errorToPush.message = `Loading ${this._inputWorkletPath} failed: ${error}`;
+        this.dispatchEvent(errorToPush);
+      });
+  }
+
+  /**
+   * Start feeding the input to the encoder. With an AudioWorklet this waits
+   * for its module to load.
+   */
+  _connectInput () {
+    if (!this.processor) {
+      this._inputReady.then(() => {
+        // Unless paused or stopped meanwhile
+        if (this.processor && this.state === 'recording') {
+          this._connectInput();
+        }
+      });
+      return;
+    }
+    this.source.connect(this.processor);
+    this.processor.connect(this.context.destination);
+  }
+
+  /**
+   * Stop feeding the input to the encoder.
+   */
+  _disconnectInput () {
+    this.source.disconnect();
+    if (this.processor) {
+      this.processor.disconnect();
+    }
+  }
+
   /**
    * Enable onaudioprocess() callback.
    * @param {number} timeslice - In seconds. OpusMediaRecorder should request data
@@ -379,12 +685,10 @@ class OpusMediaRecorder extends EventTarget {
 
     /** @type {MediaStreamAudioSourceNode} */
     this.source = this.context.createMediaStreamSource(this.stream);
-    /** @type {ScriptProcessorNode} */
-    this.processor = this.context.createScriptProcessor(BUFFER_SIZE, this.channelCount, this.channelCount);
+    this._createInput(timeslice);
 
     // Start recording
     this._state = 'recording';
-    this._enableAudioProcessCallback(timeslice);
 
     // If the worker is already loaded then start
     if (this.workerState === 'readyToInit') {
@@ -392,7 +696,8 @@ class OpusMediaRecorder extends EventTarget {
       this._postMessageToWorker('init',
                                 { sampleRate,
                                   channelCount,
-                                  bitsPerSecond: this.audioBitsPerSecond });
+                                  bitsPerSecond: this.audioBitsPerSecond,
+                                  encoderOptions: this._encoderOptions });
     }
   }
 
@@ -406,8 +711,7 @@ class OpusMediaRecorder extends EventTarget {
     }
 
     // Stop stream first
-    this.source.disconnect();
-    this.processor.disconnect();
+    this._disconnectInput();
     this.context.close();
 
     // Stop event will be triggered at _onmessageFromWorker(),
@@ -425,8 +729,7 @@ class OpusMediaRecorder extends EventTarget {
     }
 
     // Stop stream first
-    this.source.disconnect();
-    this.processor.disconnect();
+    this._disconnectInput();
 
     let event = new global.Event('pause');
     this.dispatchEvent(event);
@@ -442,8 +745,7 @@ class OpusMediaRecorder extends EventTarget {
     }
 
     // Restart streaming data
-    this.source.connect(this.processor);
-    this.processor.connect(this.context.destination);
+    this._connectInput();
 
     let event = new global.Event('resume');
     this.dispatchEvent(event);
@@ -464,6 +766,83 @@ class OpusMediaRecorder extends EventTarget {
     this._postMessageToWorker('getEncodedData');
   }
 
+  /**
+   * NON-STANDARD. Ask the encoder for its counters. They arrive as the stats
+   * property of a 'stats' event:
+   *   frames, bytes, pages, clusters -- counted by the container
+   *   pendingBytes -- output in the worker not yet sent by dataavailable
+   *   heapInUse, heapPeak -- bytes allocated in the WASM heap now, and at
+   *     most as sampled after each encoded buffer
+   *   memorySize -- size of the WASM memory, which grows to fit heapPeak and
+   *     never shrinks
+   *   arena -- { size, used, peak, heapAllocations }: bytes the container
+   *     reserved for its own buffers, in use and at most in use, and how
+   *     many of their allocations did not fit and went to the WASM heap. Ogg
+   *     and WebM only. libogg and libwebm allocate on the heap, see heapPeak.
+   *   tracks[i].complexity -- the Opus complexity in use
+   *   tracks[i].gatedFrames -- frames left out by the silence gate
+   *   droppedInputFrames -- with workerOptions.useAudioWorklet, input frames
+   *     lost because the worker fell behind by more than a second
+   *   tracks[i].encodeTime, tracks[i].muxTime -- per frame times of the
+   *     Opus encoder and of the container, resampling left out, in
+   *     microseconds: { count, total, max, buckets }, buckets[i] counting
+   *     frames under 2^i us (see TimeHistogram.hpp)
+   * Encoding each frame in much less than its duration, 20 ms by default, is
+   * needed to keep up with real time.
+   */
+  requestStats () {
+    if (this.workerState !== 'encoding') {
+      throw new Error('DOMException: INVALID_STATE_ERR, the encoder is not running.');
+    }
+
+    // stats event will be triggerd at _onmessageFromWorker()
+    this._postMessageToWorker('getStats');
+  }
+
+  /**
+   * NON-STANDARD. Change the Opus frame duration, see
+   * encoderOptions.frameDuration. While recording it applies from the next
+   * frame, so a stream can switch between low latency and low overhead;
+   * timestamps stay exact either way. It also applies to later recordings.
+   * WAV ignores it.
+   * @param {number} frameDuration - 2.5, 5, 10, 20, 40 or 60 ms.
+   */
+  setFrameDuration (frameDuration) {
+    // A copy, the caller's encoderOptions are left alone.
+    this._encoderOptions = Object.assign({}, this._encoderOptions, { frameDuration });
+    if (this.workerState === 'encoding') {
+      this._postMessageToWorker('setFrameDuration', { frameDuration });
+    }
+  }
+
+  /**
+   * NON-STANDARD. Change Opus encoder settings while recording, from the next
+   * frame on. They also apply to later recordings. WAV ignores them.
+   * @param {Object} controls
+   * @param {number} [controls.bitrate] - Bits per second, 0 for automatic.
+   *        It becomes the audioBitsPerSecond.
+   * @param {number} [controls.complexity] - See encoderOptions.complexity.
+   * @param {boolean} [controls.vbr] - See encoderOptions.vbr.
+   * @param {string} [controls.bandwidth] - See encoderOptions.bandwidth.
+   * @param {boolean} [controls.adaptiveComplexity] - See
+   *        encoderOptions.adaptiveComplexity.
+   * @param {boolean} [controls.dtx] - See encoderOptions.dtx.
+   * @param {number} [controls.silenceThreshold] - See
+   *        encoderOptions.silenceThreshold.
+   */
+  setEncoderControls (controls) {
+    // A copy, the caller's encoderOptions are left alone.
+    const options = Object.assign({}, this._encoderOptions, controls);
+    if (controls.bitrate !== undefined) {
+      this._audioBitsPerSecond = controls.bitrate;
+      delete options.bitrate;
+    }
+    this._encoderOptions = options;
+    if (this.workerState === 'encoding') {
+      this._postMessageToWorker('setControls', { controls });
+    }
+  }
+
   /**
    * Returns a Boolean value indicating if the given MIME type is supported
    * by the current user agent .
@@ -547,7 +926,11 @@ class OpusMediaRecorder extends EventTarget {
                         accessed via its data attribute. */
   'pause', // Called to handle the pause event.
   'resume', // Called to handle the resume event.
-  'error' // Called to handle a MediaRecorderErrorEvent.
+  'error', // Called to handle a MediaRecorderErrorEvent.
+  'stats', // NON-STANDARD. Called with the stats requested by requestStats().
+  'highwatermark' /* NON-STANDARD. Called before the worker hands its output
+                     over by itself, see encoderOptions.outputHighWaterMark.
+                     Its bytes attribute is the size handed over. */
 ].forEach(name => defineEventAttribute(OpusMediaRecorder.prototype, name));
 
 // MS Edge specific monkey patching:
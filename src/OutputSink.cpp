@@ -0,0 +1,204 @@
+#include "OutputSink.hpp"
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#ifdef __EMSCRIPTEN__
+# include "emscriptenImport.hpp"
+#else
+# include <cerrno>
+# include <sys/uio.h>
+# include <unistd.h>
+#endif
+
+MemoryOutputSink::MemoryOutputSink()
+  : buffer_(),
+    offset_(0),
+    cursor_(0),
+    seekable_(true)
+{
+  // Nothing to do
+}
+
+void MemoryOutputSink::write(const void *data, std::size_t size)
+{
+  assert(!(data == nullptr && size > 0));
+  const uint8_t *bytes = static_cast<const uint8_t *>(data);
+  // Overwrite first if seek() moved the cursor back, then append the rest.
+  std::size_t overwrite = std::min(size, buffer_.size() - cursor_);
+  if (overwrite > 0) {
+    memcpy(&buffer_[cursor_], bytes, overwrite);
+  }
+  buffer_.insert(buffer_.end(), bytes + overwrite, bytes + size);
+  cursor_ += size;
+}
+
+bool MemoryOutputSink::seekable() const
+{
+  return seekable_;
+}
+
+void MemoryOutputSink::setSeekable(bool seekable)
+{
+  seekable_ = seekable;
+}
+
+bool MemoryOutputSink::seek(uint64_t position)
+{
+  if (!seekable_ || position < offset_ || position - offset_ > buffer_.size()) {
+    return false; // Already cleared, or not written yet
+  }
+  cursor_ = position - offset_;
+  return true;
+}
+
+uint64_t MemoryOutputSink::position() const
+{
+  return offset_ + cursor_;
+}
+
+const uint8_t *MemoryOutputSink::data() const
+{
+  return buffer_.data();
+}
+
+std::size_t MemoryOutputSink::size() const
+{
+  return buffer_.size();
+}
+
+void MemoryOutputSink::reserve(std::size_t capacity)
+{
+  buffer_.reserve(capacity);
+}
+
+void MemoryOutputSink::clear()
+{
+  offset_ += buffer_.size();
+  buffer_.clear();
+  cursor_ = 0;
+}
+
+void MemoryOutputSink::consume(std::size_t size)
+{
+  assert(size <= cursor_); // Only bytes behind the write position
+  buffer_.erase(buffer_.begin(), buffer_.begin() + size);
+  offset_ += size;
+  cursor_ -= size;
+}
+
+#ifdef __EMSCRIPTEN__
+
+void EmscriptenOutputSink::write(const void *data, std::size_t size)
+{
+  emscriptenPushBuffer(data, size);
+}
+
+#else
+
+FileDescriptorOutputSink::FileDescriptorOutputSink(int fd, std::size_t batch_size)
+  : fd_(fd),
+    error_(0),
+    base_offset_(lseek(fd, 0, SEEK_CUR)),
+    batch_size_(batch_size),
+    stage_()
+{
+  assert(fd >= 0);
+  stage_.reserve(batch_size_);
+}
+
+FileDescriptorOutputSink::~FileDescriptorOutputSink()
+{
+  flush();
+}
+
+void FileDescriptorOutputSink::write(const void *data, std::size_t size)
+{
+  assert(!(data == nullptr && size > 0));
+  if (stage_.size() + size <= batch_size_) {
+    const uint8_t *bytes = static_cast<const uint8_t *>(data);
+    stage_.insert(stage_.end(), bytes, bytes + size);
+    return;
+  }
+  // The stage is full: write it and the new bytes together without copying
+  // the new bytes into the stage first.
+  writeAll(data, size);
+  stage_.clear();
+}
+
+void FileDescriptorOutputSink::flush()
+{
+  if (stage_.empty()) {
+    return;
+  }
+  writeAll(nullptr, 0);
+  stage_.clear();
+}
+
+bool FileDescriptorOutputSink::seekable() const
+{
+  return base_offset_ >= 0;
+}
+
+bool FileDescriptorOutputSink::seek(uint64_t position)
+{
+  if (!seekable()) {
+    return false;
+  }
+  flush();
+  return error_ == 0
+         && lseek(fd_, base_offset_ + position, SEEK_SET) >= 0;
+}
+
+uint64_t FileDescriptorOutputSink::position() const
+{
+  if (!seekable()) {
+    return 0;
+  }
+  return lseek(fd_, 0, SEEK_CUR) - base_offset_ + stage_.size();
+}
+
+int FileDescriptorOutputSink::error() const
+{
+  return error_;
+}
+
+void FileDescriptorOutputSink::writeAll(const void *data, std::size_t size)
+{
+  struct iovec iov[2];
+  iov[0].iov_base = stage_.data();
+  iov[0].iov_len = stage_.size();
+  iov[1].iov_base = const_cast<void *>(data);
+  iov[1].iov_len = size;
+
+  struct iovec *next = iov;
+  int count = (size > 0) ? 2 : 1;
+  // Empty iovecs are dropped, so a write taking nothing is an error.
+  while (count > 0 && next->iov_len == 0) {
+    next++;
+    count--;
+  }
+  while (count > 0 && error_ == 0) {
+    ssize_t written = writev(fd_, next, count);
+    if (written < 0 && errno == EINTR) {
+      continue;
+    }
+    if (written <= 0) {
+      // 0 would never make progress, e.g. a full device without an errno
+      error_ = written < 0 ? errno : EIO;
+      break;
+    }
+    // Skip what the kernel took, which may end in the middle of an iovec.
+    std::size_t remaining = static_cast<std::size_t>(written);
+    while (count > 0 && remaining >= next->iov_len) {
+      remaining -= next->iov_len;
+      next++;
+      count--;
+    }
+    if (count > 0) {
+      next->iov_base = static_cast<uint8_t *>(next->iov_base) + remaining;
+      next->iov_len -= remaining;
+    }
+  }
+}
+
+#endif
@@ -0,0 +1,165 @@
+#ifndef OUTPUTSINK_H_
+#define OUTPUTSINK_H_
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+/**
+ * @brief Destination of the bytes produced by a container.
+ *
+ *    Containers never know where their output goes. They call write() in the
+ *    order the bytes appear in the file and flush() once at the end of the
+ *    stream. A sink must outlive the container it is attached to.
+ */
+class OutputSink
+{
+public:
+  virtual ~OutputSink() {}
+
+  /**
+   * @brief Append bytes to the output. The buffer is only valid during the call.
+   *
+   * @param data    A pointer to the bytes to write
+   * @param size    Byte size of the data
+   */
+  virtual void write(const void *data, std::size_t size) = 0;
+
+  /**
+   * @brief Hand over bytes the sink may still be holding back.
+   */
+  virtual void flush() {}
+
+  /**
+   * @brief Whether seek() can work at all.
+   */
+  virtual bool seekable() const { return false; }
+
+  /**
+   * @brief Move the write position so the next writes overwrite earlier bytes.
+   *
+   * @param position    Byte offset from the first byte ever written to the sink
+   * @return bool       false if the position cannot be reached
+   */
+  virtual bool seek(uint64_t position) { return false; }
+
+  /**
+   * @brief The current write position. Only meaningful if seekable().
+   */
+  virtual uint64_t position() const { return 0; }
+};
+
+/**
+ * @brief Collects the output back-to-back in a growable memory buffer.
+ *
+ *    In WASM this is the output arena: the whole output between two reads is
+ *    one contiguous range of the heap, and because clear() keeps the capacity
+ *    a long recording stops allocating once the buffer has grown to the size
+ *    of the largest read.
+ *
+ *    It can seek within the bytes that have not been cleared yet, unless
+ *    setSeekable(false) says its bytes are taken while the stream is written.
+ */
+class MemoryOutputSink
+  : public OutputSink
+{
+public:
+  MemoryOutputSink();
+
+  void write(const void *data, std::size_t size) override;
+  bool seekable() const override;
+  bool seek(uint64_t position) override;
+  uint64_t position() const override;
+
+  const uint8_t *data() const;
+  std::size_t size() const;
+
+  /**
+   * @brief Whether containers may seek back into the sink, true by default.
+   *        Set it to false before init() of a container if the bytes are
+   *        taken with clear() or consume() while the stream is written, e.g.
+   *        by the worker on every timeslice: a seekable WebM then keeps the
+   *        file whole in the container until the end instead.
+   */
+  void setSeekable(bool seekable);
+
+  /**
+   * @brief Allocate room for at least capacity bytes up front.
+   */
+  void reserve(std::size_t capacity);
+
+  /**
+   * @brief Drop the collected bytes. The capacity is kept for the next use.
+   */
+  void clear();
+
+  /**
+   * @brief Drop the first size bytes and keep the rest, e.g. the part of the
+   *        output that is not complete yet. Positions do not change.
+   */
+  void consume(std::size_t size);
+
+private:
+  std::vector<uint8_t> buffer_;
+  uint64_t offset_;     // Position of buffer_[0], i.e. the bytes cleared so far
+  std::size_t cursor_;  // Write position in buffer_
+  bool seekable_;       // See setSeekable()
+};
+
+#ifdef __EMSCRIPTEN__
+/**
+ * @brief Pushes every write to Module.encodedBuffers as a new ArrayBuffer.
+ *        Prefer MemoryOutputSink, which does not allocate per write.
+ */
+class EmscriptenOutputSink
+  : public OutputSink
+{
+public:
+  void write(const void *data, std::size_t size) override;
+};
+#else
+/**
+ * @brief Writes the output to a file descriptor.
+ *
+ *    Small writes are staged and handed to the kernel in one writev() call
+ *    together with the write that overflows the stage, so an Ogg page header
+ *    and its body, or a run of small EBML elements, cost one system call.
+ *    The descriptor is not closed by the sink.
+ *
+ *    It is seekable when the descriptor is, e.g. a regular file but not a
+ *    pipe. Positions are relative to the file offset when the sink was made.
+ */
+class FileDescriptorOutputSink
+  : public OutputSink
+{
+public:
+  /**
+   * @param fd            An open file descriptor
+   * @param batch_size    Bytes to stage before calling writev()
+   */
+  explicit FileDescriptorOutputSink(int fd, std::size_t batch_size = 64 * 1024);
+  ~FileDescriptorOutputSink();
+
+  void write(const void *data, std::size_t size) override;
+  void flush() override;
+  bool seekable() const override;
+  bool seek(uint64_t position) override;
+  uint64_t position() const override;
+
+  /**
+   * @brief errno of the first failed write, or 0 if everything was written.
+   */
+  int error() const;
+
+private:
+  int fd_;
+  int error_;
+  int64_t base_offset_;   // -1 if the descriptor cannot seek
+  std::size_t batch_size_;
+  std::vector<uint8_t> stage_;
+
+  void writeAll(const void *data, std::size_t size);
+};
+#endif
+
+#endif /* OUTPUTSINK_H_ */
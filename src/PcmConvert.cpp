@@ -0,0 +1,247 @@
+#include "PcmConvert.hpp"
+#include <cstring>
+
+#if defined(__wasm_simd128__)
+#include <wasm_simd128.h>
+#define PCM_CONVERT_SIMD
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define PCM_CONVERT_SIMD
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define PCM_CONVERT_SIMD
+#endif
+
+namespace {
+  const float kInt16Max = 32767.0f;
+  const float kInt24Max = 8388607.0f;
+
+  inline int32_t scaleSample(float sample, float max)
+  {
+    float scaled = sample * max;
+    if (scaled != scaled) {
+      return 0;   // NaN
+    }
+    if (scaled < -max - 1.0f) {
+      return (int32_t)(-max - 1.0f);
+    }
+    if (scaled > max) {
+      return (int32_t)max;
+    }
+    return (int32_t)scaled;
+  }
+
+  inline void writeInt24(uint8_t *dst, int32_t sample)
+  {
+    dst[0] = (uint8_t)sample;
+    dst[1] = (uint8_t)(sample >> 8);
+    dst[2] = (uint8_t)(sample >> 16);
+  }
+
+/**
+ * The few vector operations the kernels need, 4 lanes each, for every
+ * instruction set. Stereo stores interleave two channels on the way out.
+ */
+#if defined(__wasm_simd128__)
+  typedef v128_t FloatVec;
+  typedef v128_t IntVec;
+
+  inline FloatVec loadFloat(const float *src) { return wasm_v128_load(src); }
+
+  inline IntVec scale(FloatVec v, float max)
+  {
+    v = wasm_f32x4_mul(v, wasm_f32x4_splat(max));
+    v = wasm_v128_and(v, wasm_f32x4_eq(v, v));   // NaN to 0
+    v = wasm_f32x4_max(v, wasm_f32x4_splat(-max - 1.0f));
+    v = wasm_f32x4_min(v, wasm_f32x4_splat(max));
+    return wasm_i32x4_trunc_saturate_f32x4(v);
+  }
+
+  inline void storeInt32(int32_t *dst, IntVec v) { wasm_v128_store(dst, v); }
+
+  inline void storeInt16(int16_t *dst, IntVec lo, IntVec hi)
+  {
+    wasm_v128_store(dst, wasm_i16x8_narrow_i32x4(lo, hi));
+  }
+
+  inline void storeInt16Stereo(int16_t *dst, IntVec l0, IntVec l1, IntVec r0, IntVec r1)
+  {
+    v128_t left = wasm_i16x8_narrow_i32x4(l0, l1);
+    v128_t right = wasm_i16x8_narrow_i32x4(r0, r1);
+    wasm_v128_store(dst, wasm_v16x8_shuffle(left, right, 0, 8, 1, 9, 2, 10, 3, 11));
+    wasm_v128_store(dst + 8, wasm_v16x8_shuffle(left, right, 4, 12, 5, 13, 6, 14, 7, 15));
+  }
+
+  inline void storeFloatStereo(float *dst, FloatVec left, FloatVec right)
+  {
+    wasm_v128_store(dst, wasm_v32x4_shuffle(left, right, 0, 4, 1, 5));
+    wasm_v128_store(dst + 4, wasm_v32x4_shuffle(left, right, 2, 6, 3, 7));
+  }
+#elif defined(__SSE2__)
+  typedef __m128 FloatVec;
+  typedef __m128i IntVec;
+
+  inline FloatVec loadFloat(const float *src) { return _mm_loadu_ps(src); }
+
+  inline IntVec scale(FloatVec v, float max)
+  {
+    v = _mm_mul_ps(v, _mm_set1_ps(max));
+    v = _mm_and_ps(v, _mm_cmpord_ps(v, v));      // NaN to 0
+    v = _mm_max_ps(v, _mm_set1_ps(-max - 1.0f));
+    v = _mm_min_ps(v, _mm_set1_ps(max));
+    return _mm_cvttps_epi32(v);
+  }
+
+  inline void storeInt32(int32_t *dst, IntVec v)
+  {
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(dst), v);
+  }
+
+  inline void storeInt16(int16_t *dst, IntVec lo, IntVec hi)
+  {
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(dst), _mm_packs_epi32(lo, hi));
+  }
+
+  inline void storeInt16Stereo(int16_t *dst, IntVec l0, IntVec l1, IntVec r0, IntVec r1)
+  {
+    __m128i left = _mm_packs_epi32(l0, l1);
+    __m128i right = _mm_packs_epi32(r0, r1);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(dst), _mm_unpacklo_epi16(left, right));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + 8), _mm_unpackhi_epi16(left, right));
+  }
+
+  inline void storeFloatStereo(float *dst, FloatVec left, FloatVec right)
+  {
+    _mm_storeu_ps(dst, _mm_unpacklo_ps(left, right));
+    _mm_storeu_ps(dst + 4, _mm_unpackhi_ps(left, right));
+  }
+#elif defined(__ARM_NEON)
+  typedef float32x4_t FloatVec;
+  typedef int32x4_t IntVec;
+
+  inline FloatVec loadFloat(const float *src) { return vld1q_f32(src); }
+
+  inline IntVec scale(FloatVec v, float max)
+  {
+    v = vmulq_n_f32(v, max);
+    v = vreinterpretq_f32_u32(vandq_u32(vreinterpretq_u32_f32(v), vceqq_f32(v, v)));  // NaN to 0
+    v = vmaxq_f32(v, vdupq_n_f32(-max - 1.0f));
+    v = vminq_f32(v, vdupq_n_f32(max));
+    return vcvtq_s32_f32(v);
+  }
+
+  inline void storeInt32(int32_t *dst, IntVec v) { vst1q_s32(dst, v); }
+
+  inline void storeInt16(int16_t *dst, IntVec lo, IntVec hi)
+  {
+    vst1q_s16(dst, vcombine_s16(vqmovn_s32(lo), vqmovn_s32(hi)));
+  }
+
+  inline void storeInt16Stereo(int16_t *dst, IntVec l0, IntVec l1, IntVec r0, IntVec r1)
+  {
+    int16x8x2_t frames;
+    frames.val[0] = vcombine_s16(vqmovn_s32(l0), vqmovn_s32(l1));
+    frames.val[1] = vcombine_s16(vqmovn_s32(r0), vqmovn_s32(r1));
+    vst2q_s16(dst, frames);
+  }
+
+  inline void storeFloatStereo(float *dst, FloatVec left, FloatVec right)
+  {
+    float32x4x2_t frames;
+    frames.val[0] = left;
+    frames.val[1] = right;
+    vst2q_f32(dst, frames);
+  }
+#endif
+}
+
+void PcmConvert::toInt16(const float *const *channels, uint8_t channel_count,
+                         std::size_t length, int16_t *dst)
+{
+  std::size_t i = 0;
+#ifdef PCM_CONVERT_SIMD
+  if (channel_count == 1) {
+    const float *src = channels[0];
+    for (; i + 8 <= length; i += 8) {
+      storeInt16(dst + i,
+                 scale(loadFloat(src + i), kInt16Max),
+                 scale(loadFloat(src + i + 4), kInt16Max));
+    }
+  } else if (channel_count == 2) {
+    const float *left = channels[0];
+    const float *right = channels[1];
+    for (; i + 8 <= length; i += 8) {
+      storeInt16Stereo(dst + 2 * i,
+                       scale(loadFloat(left + i), kInt16Max),
+                       scale(loadFloat(left + i + 4), kInt16Max),
+                       scale(loadFloat(right + i), kInt16Max),
+                       scale(loadFloat(right + i + 4), kInt16Max));
+    }
+  } else {
+    // Convert 4 samples of a channel at once, then scatter them.
+    int32_t block[4];
+    for (; i + 4 <= length; i += 4) {
+      for (uint8_t ch = 0; ch < channel_count; ch++) {
+        storeInt32(block, scale(loadFloat(channels[ch] + i), kInt16Max));
+        for (std::size_t j = 0; j < 4; j++) {
+          dst[(i + j) * channel_count + ch] = (int16_t)block[j];
+        }
+      }
+    }
+  }
+#endif
+  // The rest of the samples, or all of them without SIMD
+  for (; i < length; i++) {
+    for (uint8_t ch = 0; ch < channel_count; ch++) {
+      dst[i * channel_count + ch] = (int16_t)scaleSample(channels[ch][i], kInt16Max);
+    }
+  }
+}
+
+void PcmConvert::toInt24(const float *const *channels, uint8_t channel_count,
+                         std::size_t length, uint8_t *dst)
+{
+  std::size_t i = 0;
+#ifdef PCM_CONVERT_SIMD
+  // There is no 24-bit lane, so only the conversion is vectorized.
+  int32_t block[4];
+  for (; i + 4 <= length; i += 4) {
+    for (uint8_t ch = 0; ch < channel_count; ch++) {
+      storeInt32(block, scale(loadFloat(channels[ch] + i), kInt24Max));
+      for (std::size_t j = 0; j < 4; j++) {
+        writeInt24(dst + ((i + j) * channel_count + ch) * 3, block[j]);
+      }
+    }
+  }
+#endif
+  for (; i < length; i++) {
+    for (uint8_t ch = 0; ch < channel_count; ch++) {
+      writeInt24(dst + (i * channel_count + ch) * 3,
+                 scaleSample(channels[ch][i], kInt24Max));
+    }
+  }
+}
+
+void PcmConvert::toFloat32(const float *const *channels, uint8_t channel_count,
+                           std::size_t length, float *dst)
+{
+  if (channel_count == 1) {
+    memcpy(dst, channels[0], length * sizeof(float));
+    return;
+  }
+  std::size_t i = 0;
+#ifdef PCM_CONVERT_SIMD
+  if (channel_count == 2) {
+    const float *left = channels[0];
+    const float *right = channels[1];
+    for (; i + 4 <= length; i += 4) {
+      storeFloatStereo(dst + 2 * i, loadFloat(left + i), loadFloat(right + i));
+    }
+  }
+#endif
+  for (; i < length; i++) {
+    for (uint8_t ch = 0; ch < channel_count; ch++) {
+      dst[i * channel_count + ch] = channels[ch][i];
+    }
+  }
+}
@@ -0,0 +1,45 @@
+#ifndef PCMCONVERT_H_
+#define PCMCONVERT_H_
+
+#include <cstdint>
+#include <cstddef>
+
+/**
+ * @brief Planar float to interleaved PCM conversion for WAV output.
+ *
+ *    Each function clamps, converts and interleaves in a single pass. Integer
+ *    conversion scales by the largest positive value, clamps, then truncates
+ *    towards zero, e.g. 1.0 -> 32767 and -1.5 -> -32768 for 16 bits. NaN is
+ *    silence, 0, whichever instruction set is used.
+ *
+ *    The inner loops use WASM SIMD128 when built with -msimd128, SSE2 or NEON
+ *    natively, and plain C++ otherwise. Mono and stereo, by far the most
+ *    common layouts, are interleaved in vector registers as well. Output is
+ *    little endian.
+ *
+ *    No alignment is required for the buffers.
+ */
+namespace PcmConvert {
+  /**
+   * @param channels        Planar samples, one pointer per channel
+   * @param channel_count   The number of channels
+   * @param length          Samples per channel
+   * @param dst             length * channel_count samples
+   */
+  void toInt16(const float *const *channels, uint8_t channel_count,
+               std::size_t length, int16_t *dst);
+
+  /**
+   * @param dst   length * channel_count * 3 bytes
+   */
+  void toInt24(const float *const *channels, uint8_t channel_count,
+               std::size_t length, uint8_t *dst);
+
+  /**
+   * @brief Interleave only. Float WAV keeps values outside [-1, 1].
+   */
+  void toFloat32(const float *const *channels, uint8_t channel_count,
+                 std::size_t length, float *dst);
+}
+
+#endif /* PCMCONVERT_H_ */
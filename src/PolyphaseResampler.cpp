@@ -0,0 +1,208 @@
+#include "PolyphaseResampler.hpp"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+
+#if defined(__wasm_simd128__)
+#include <wasm_simd128.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace {
+  const double kPi = 3.14159265358979323846;
+
+  /**
+   * Filter of each quality: the length, upsampling bandwidth and window of
+   * the same quality in SpeexDSP (quality_map in resample.c), so a quality
+   * means the same whichever resampler the rate needs.
+   */
+  struct QualityLevel {
+    uint32_t taps;    // Per phase, a multiple of 4
+    double cutoff;    // Fraction of 22050 Hz
+    double beta;      // Kaiser window
+  };
+
+  const QualityLevel kQualityLevels[PolyphaseResampler::kMaxQuality + 1] = {
+    {8, 0.860, 6.0},
+    {16, 0.880, 6.0},
+    {32, 0.910, 6.0},
+    {48, 0.917, 8.0},
+    {64, 0.940, 8.0},
+    {80, 0.940, 10.0},
+    {96, 0.945, 10.0},
+    {128, 0.950, 10.0},
+    {160, 0.960, 10.0},
+    {192, 0.968, 12.0},
+    {256, 0.975, 12.0}
+  };
+
+  // Zeroth order modified Bessel function of the first kind
+  double besselI0(double x)
+  {
+    double sum = 1.0;
+    double term = 1.0;
+    for (int k = 1; k < 50 && term > sum * 1e-12; k++) {
+      term *= (x / (2 * k)) * (x / (2 * k));
+      sum += term;
+    }
+    return sum;
+  }
+
+  // length is a multiple of 4
+#if defined(__wasm_simd128__)
+  inline float dot(const float *a, const float *b, uint32_t length)
+  {
+    v128_t sum = wasm_f32x4_splat(0.0f);
+    for (uint32_t i = 0; i < length; i += 4) {
+      sum = wasm_f32x4_add(sum, wasm_f32x4_mul(wasm_v128_load(a + i),
+                                               wasm_v128_load(b + i)));
+    }
+    return wasm_f32x4_extract_lane(sum, 0) + wasm_f32x4_extract_lane(sum, 1)
+           + wasm_f32x4_extract_lane(sum, 2) + wasm_f32x4_extract_lane(sum, 3);
+  }
+#elif defined(__SSE2__)
+  inline float dot(const float *a, const float *b, uint32_t length)
+  {
+    __m128 sum = _mm_setzero_ps();
+    for (uint32_t i = 0; i < length; i += 4) {
+      sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+    }
+    sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+    sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+    return _mm_cvtss_f32(sum);
+  }
+#elif defined(__ARM_NEON)
+  inline float dot(const float *a, const float *b, uint32_t length)
+  {
+    float32x4_t sum = vdupq_n_f32(0.0f);
+    for (uint32_t i = 0; i < length; i += 4) {
+      sum = vmlaq_f32(sum, vld1q_f32(a + i), vld1q_f32(b + i));
+    }
+    float32x2_t half = vadd_f32(vget_low_f32(sum), vget_high_f32(sum));
+    return vget_lane_f32(vpadd_f32(half, half), 0);
+  }
+#else
+  inline float dot(const float *a, const float *b, uint32_t length)
+  {
+    // Four sums, so the compiler can still vectorize it.
+    float sum[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+    for (uint32_t i = 0; i < length; i += 4) {
+      for (uint32_t j = 0; j < 4; j++) {
+        sum[j] += a[i + j] * b[i + j];
+      }
+    }
+    return (sum[0] + sum[1]) + (sum[2] + sum[3]);
+  }
+#endif
+}
+
+PolyphaseResampler::PolyphaseResampler()
+  : channel_count_(0),
+    quality_(-1),
+    taps_(0),
+    history_stride_(0),
+    filter_(),
+    history_()
+{
+  // Nothing to do
+}
+
+bool PolyphaseResampler::init(uint8_t channel_count, int quality,
+                              uint32_t max_input_length)
+{
+  assert(channel_count > 0);
+  if (quality < 0 || quality > kMaxQuality) {
+    return false;
+  }
+  if (quality != quality_) {
+    buildFilter(quality);
+  }
+  channel_count_ = channel_count;
+  history_stride_ = taps_ - 1 + max_input_length;
+  history_.assign(history_stride_ * channel_count, 0.0f);
+  return true;
+}
+
+void PolyphaseResampler::reset(void)
+{
+  std::fill(history_.begin(), history_.end(), 0.0f);
+}
+
+uint32_t PolyphaseResampler::process(const float *input, uint32_t input_length,
+                                     float *output)
+{
+  assert(input_length % kInputPeriod == 0);
+  assert(taps_ - 1 + input_length <= history_stride_);
+  const uint32_t kept = taps_ - 1;
+
+  // Append the input to the last samples of the previous call, planar so a
+  // row of the filter meets consecutive samples of one channel.
+  for (uint8_t ch = 0; ch < channel_count_; ch++) {
+    float *history = &history_[ch * history_stride_ + kept];
+    for (uint32_t i = 0; i < input_length; i++) {
+      history[i] = input[i * channel_count_ + ch];
+    }
+  }
+
+  // Output sample n is at n * 147 / 160 input samples. Its phase is the
+  // remainder, and its window ends at the input sample before.
+  uint32_t output_length = input_length / kInputPeriod * kOutputPeriod;
+  uint32_t base = 0;
+  uint32_t phase = 0;
+  for (uint32_t n = 0; n < output_length; n++) {
+    const float *row = &filter_[phase * taps_];
+    for (uint8_t ch = 0; ch < channel_count_; ch++) {
+      output[n * channel_count_ + ch] =
+          dot(&history_[ch * history_stride_ + base], row, taps_);
+    }
+    phase += kInputPeriod;
+    if (phase >= kOutputPeriod) {
+      phase -= kOutputPeriod;
+      base++;
+    }
+  }
+
+  for (uint8_t ch = 0; ch < channel_count_; ch++) {
+    float *history = &history_[ch * history_stride_];
+    memmove(history, history + input_length, kept * sizeof(float));
+  }
+  return output_length;
+}
+
+void PolyphaseResampler::buildFilter(int quality)
+{
+  const QualityLevel &level = kQualityLevels[quality];
+  quality_ = quality;
+  taps_ = level.taps;
+  filter_.assign(kOutputPeriod * taps_, 0.0f);
+
+  // The prototype filter runs at 160 times the input rate. Tap k of a
+  // phase applies to the input sample k before the window end.
+  const uint32_t length = kOutputPeriod * taps_;
+  const double center = (length - 1) / 2.0;
+  const double window_scale = 1.0 / besselI0(level.beta);
+  for (uint32_t phase = 0; phase < kOutputPeriod; phase++) {
+    float *row = &filter_[phase * taps_];
+    double sum = 0.0;
+    for (uint32_t k = 0; k < taps_; k++) {
+      double t = phase + (double)k * kOutputPeriod - center;
+      double x = level.cutoff * t / kOutputPeriod;
+      double sinc = x == 0.0 ? 1.0 : std::sin(kPi * x) / (kPi * x);
+      double r = t / center;
+      double window = besselI0(level.beta * std::sqrt(std::max(0.0, 1.0 - r * r)))
+                      * window_scale;
+      // Oldest input first, so the row is read in the order of the history
+      row[taps_ - 1 - k] = sinc * window;
+      sum += sinc * window;
+    }
+    // Unity gain at DC for every phase, so silence stays silent and a
+    // constant stays constant.
+    for (uint32_t k = 0; k < taps_; k++) {
+      row[k] /= sum;
+    }
+  }
+}
@@ -0,0 +1,70 @@
+#ifndef POLYPHASERESAMPLER_H_
+#define POLYPHASERESAMPLER_H_
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+/**
+ * @brief Fixed-ratio resampler from 44100 Hz to 48000 Hz.
+ *
+ *    48000 / 44100 = 160 / 147: the input is, in effect, upsampled by 160,
+ *    low-pass filtered and decimated by 147. Only the 160 phases of the filter
+ *    are kept, each one a row of taps applied to consecutive input samples, so
+ *    an output sample is one dot product. The filter is a Kaiser-windowed sinc
+ *    computed once by init(). The quality, 0 to 10 like SpeexDSP, chooses its
+ *    length and cutoff.
+ *
+ *    The dot products use WASM SIMD128 when built with -msimd128, SSE2 or NEON
+ *    natively, and plain C++ otherwise.
+ */
+class PolyphaseResampler
+{
+public:
+  static const uint32_t kInputSampleRate = 44100;
+  static const uint32_t kOutputSampleRate = 48000;
+  // Samples of one period of the ratio, 147 in and 160 out
+  static const uint32_t kInputPeriod = 147;
+  static const uint32_t kOutputPeriod = 160;
+  static const int kMaxQuality = 10;
+
+  PolyphaseResampler();
+
+  /**
+   * @brief Build the filter and the buffers. Calling it again with the same
+   *        quality keeps the filter.
+   *
+   * @param channel_count       The number of interleaved channels
+   * @param quality             0 (fastest) to 10 (best)
+   * @param max_input_length    The largest input of process(), per channel
+   * @return bool               false if the quality is out of range
+   */
+  bool init(uint8_t channel_count, int quality, uint32_t max_input_length);
+
+  /**
+   * @brief Forget the past input, as if nothing was processed yet.
+   */
+  void reset(void);
+
+  /**
+   * @brief Resample interleaved samples.
+   *
+   * @param input           input_length samples per channel
+   * @param input_length    A multiple of kInputPeriod, e.g. 882 for 20 ms
+   * @param output          input_length / 147 * 160 samples per channel
+   * @return uint32_t       The number of output samples per channel
+   */
+  uint32_t process(const float *input, uint32_t input_length, float *output);
+
+private:
+  uint8_t channel_count_;
+  int quality_;
+  uint32_t taps_;                 // Taps per phase, a multiple of 4
+  uint32_t history_stride_;       // taps_ - 1 + the largest input
+  std::vector<float> filter_;     // kOutputPeriod rows of taps_, oldest input first
+  std::vector<float> history_;    // Planar, history_stride_ per channel
+
+  void buildFilter(int quality);
+};
+
+#endif /* POLYPHASERESAMPLER_H_ */
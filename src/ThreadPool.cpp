@@ -0,0 +1,115 @@
+#include "ThreadPool.hpp"
+#include <cassert>
+
+namespace {
+  // The pool and the index of the worker running on this thread, if any
+  thread_local const ThreadPool *current_pool = nullptr;
+  thread_local unsigned current_worker = 0;
+}
+
+ThreadPool::ThreadPool(unsigned thread_count)
+  : workers_(),
+    next_worker_(0),
+    queued_(0),
+    stopping_(false)
+{
+  if (thread_count == 0) {
+    thread_count = std::thread::hardware_concurrency();
+  }
+  if (thread_count == 0) {
+    thread_count = 1;
+  }
+  // Every deque must exist before a thread can try to steal from it.
+  for (unsigned i = 0; i < thread_count; i++) {
+    workers_.emplace_back(new Worker());
+  }
+  for (unsigned i = 0; i < thread_count; i++) {
+    workers_[i]->thread = std::thread(&ThreadPool::run, this, i);
+  }
+}
+
+ThreadPool::~ThreadPool()
+{
+  {
+    std::lock_guard<std::mutex> lock(idle_mutex_);
+    stopping_ = true;
+  }
+  idle_.notify_all();
+  for (auto &worker : workers_) {
+    worker->thread.join();
+  }
+  assert(queued_ == 0);
+}
+
+void ThreadPool::submit(TaskFunction function, void *argument)
+{
+  assert(function);
+  unsigned index = current_pool == this
+                     ? current_worker
+                     : next_worker_++ % workers_.size();
+  Worker &worker = *workers_[index];
+  // Counted first, so the count never drops below the tasks in the deques.
+  queued_++;
+  {
+    std::lock_guard<std::mutex> lock(worker.mutex);
+    worker.tasks.push_back(Task{function, argument});
+  }
+  // Taking the lock orders this with a worker about to wait, so the
+  // notification cannot fall between its check and its wait.
+  {
+    std::lock_guard<std::mutex> lock(idle_mutex_);
+  }
+  idle_.notify_one();
+}
+
+unsigned ThreadPool::getThreadCount() const
+{
+  return workers_.size();
+}
+
+void ThreadPool::run(unsigned index)
+{
+  current_pool = this;
+  current_worker = index;
+  for (;;) {
+    Task task;
+    if (pop(index, task) || steal(index, task)) {
+      task.function(task.argument);
+      continue;
+    }
+    std::unique_lock<std::mutex> lock(idle_mutex_);
+    // Queued tasks are run before stopping.
+    idle_.wait(lock, [this] { return queued_ > 0 || stopping_; });
+    if (queued_ == 0 && stopping_) {
+      return;
+    }
+  }
+}
+
+bool ThreadPool::pop(unsigned index, Task &task)
+{
+  Worker &worker = *workers_[index];
+  std::lock_guard<std::mutex> lock(worker.mutex);
+  if (worker.tasks.empty()) {
+    return false;
+  }
+  task = worker.tasks.front();
+  worker.tasks.pop_front();
+  queued_--;
+  return true;
+}
+
+bool ThreadPool::steal(unsigned index, Task &task)
+{
+  for (std::size_t i = 1; i < workers_.size(); i++) {
+    Worker &victim = *workers_[(index + i) % workers_.size()];
+    std::lock_guard<std::mutex> lock(victim.mutex);
+    if (!victim.tasks.empty()) {
+      task = victim.tasks.back();
+      victim.tasks.pop_back();
+      queued_--;
+      return true;
+    }
+  }
+  return false;
+}
@@ -0,0 +1,71 @@
+#ifndef THREADPOOL_H_
+#define THREADPOOL_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief A fixed number of threads with a task deque each.
+ *
+ *    Tasks submitted from outside the pool are spread over the deques
+ *    round-robin, and a task submitted from a task goes to the deque of its
+ *    own thread. A worker runs the oldest task of its own deque, so the
+ *    tasks of a deque take turns. A worker whose deque is empty steals the
+ *    newest task of another deque, the one its owner would run last.
+ *
+ *    Tasks are plain function pointers with an argument, so submitting one
+ *    does not allocate once the deques have grown.
+ */
+class ThreadPool
+{
+public:
+  typedef void (*TaskFunction)(void *argument);
+
+  /**
+   * @param thread_count    The number of threads, or 0 for one per core
+   */
+  explicit ThreadPool(unsigned thread_count = 0);
+
+  /**
+   * @brief Run the tasks still queued, then join the threads.
+   */
+  ~ThreadPool();
+
+  /**
+   * @brief Queue a task. Can be called from any thread, including the tasks.
+   */
+  void submit(TaskFunction function, void *argument);
+
+  unsigned getThreadCount() const;
+
+private:
+  struct Task {
+    TaskFunction function;
+    void *argument;
+  };
+
+  struct Worker {
+    std::mutex mutex;
+    std::deque<Task> tasks;
+    std::thread thread;
+  };
+
+  std::vector<std::unique_ptr<Worker>> workers_;
+  std::atomic<unsigned> next_worker_;   // Round-robin for outside submissions
+  std::atomic<unsigned> queued_;        // Tasks in all deques
+  std::mutex idle_mutex_;
+  std::condition_variable idle_;
+  bool stopping_;
+
+  void run(unsigned index);
+  bool pop(unsigned index, Task &task);
+  bool steal(unsigned index, Task &task);
+};
+
+#endif /* THREADPOOL_H_ */
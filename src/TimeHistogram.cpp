@@ -0,0 +1,69 @@
+#include "TimeHistogram.hpp"
+#include <cassert>
+#ifdef __EMSCRIPTEN__
+# include <emscripten.h>
+#else
+# include <chrono>
+#endif
+
+TimeHistogram::TimeHistogram()
+{
+  clear();
+}
+
+void TimeHistogram::add(double microseconds)
+{
+  int bucket = 0;
+  for (double bound = 1.0; bucket < kBucketCount - 1 && microseconds >= bound;
+       bound *= 2.0) {
+    bucket++;
+  }
+  buckets_[bucket]++;
+  count_++;
+  total_ += microseconds;
+  if (microseconds > max_) {
+    max_ = microseconds;
+  }
+}
+
+void TimeHistogram::clear(void)
+{
+  for (int i = 0; i < kBucketCount; i++) {
+    buckets_[i] = 0;
+  }
+  count_ = 0;
+  total_ = 0.0;
+  max_ = 0.0;
+}
+
+uint32_t TimeHistogram::getBucket(int bucket) const
+{
+  assert(bucket >= 0 && bucket < kBucketCount);
+  return buckets_[bucket];
+}
+
+uint32_t TimeHistogram::getCount() const
+{
+  return count_;
+}
+
+double TimeHistogram::getTotal() const
+{
+  return total_;
+}
+
+double TimeHistogram::getMax() const
+{
+  return max_;
+}
+
+double TimeHistogram::now(void)
+{
+#ifdef __EMSCRIPTEN__
+  // performance.now() in milliseconds
+  return emscripten_get_now() * 1000.0;
+#else
+  return std::chrono::duration<double, std::micro>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
@@ -0,0 +1,41 @@
+#ifndef TIMEHISTOGRAM_H_
+#define TIMEHISTOGRAM_H_
+
+#include <cstdint>
+
+/**
+ * @brief Distribution of durations in power-of-two buckets of microseconds.
+ *
+ *    Bucket 0 counts durations under 1 us, bucket b durations in
+ *    [2^(b-1), 2^b) us, and the last bucket everything from 16.4 ms up. At
+ *    48 kHz a 20 ms frame must be encoded and muxed well within 20 ms, so the
+ *    upper buckets show a device falling behind real time.
+ */
+class TimeHistogram
+{
+public:
+  static const int kBucketCount = 16;
+
+  TimeHistogram();
+
+  void add(double microseconds);
+  void clear(void);
+
+  uint32_t getBucket(int bucket) const;
+  uint32_t getCount() const;
+  double getTotal() const;  // Sum of all durations in microseconds
+  double getMax() const;
+
+  /**
+   * @brief Current time in microseconds, from an arbitrary origin.
+   */
+  static double now(void);
+
+private:
+  uint32_t buckets_[kBucketCount];
+  uint32_t count_;
+  double total_;
+  double max_;
+};
+
+#endif /* TIMEHISTOGRAM_H_ */
@@ -0,0 +1,248 @@
+#include "WaveContainer.hpp"
+#include "PcmConvert.hpp"
+#include <cstring>
+#include <cassert>
+
+namespace {
+  // Format tags of the fmt chunk
+  const uint16_t kFormatPcm = 1;
+  const uint16_t kFormatIeeeFloat = 3;
+  const uint16_t kFormatExtensible = 0xFFFE;
+  // The rest of the GUID of an extensible format, after its format tag
+  const uint8_t kSubFormatGuid[14] = {
+    0x00, 0x00, 0x00, 0x00, 0x10, 0x00, 0x80, 0x00, 0x00, 0xAA, 0x00, 0x38, 0x9B, 0x71
+  };
+  // Speaker positions of each channel count, in the order of the Web Audio
+  // API, e.g. FL FR FC LFE BL BR for 5.1
+  const uint32_t kChannelMasks[] = {
+    0x4,    // FC
+    0x3,    // FL FR
+    0x7,    // FL FR FC
+    0x33,   // FL FR BL BR
+    0x37,   // FL FR FC BL BR
+    0x3F,   // FL FR FC LFE BL BR
+    0x13F,  // FL FR FC LFE BL BR BC
+    0x63F   // FL FR FC LFE BL BR SL SR
+  };
+  // The longest header, extensible with the fact chunk
+  const std::size_t kMaxHeaderSize = 80;
+}
+
+WaveContainer::WaveContainer()
+  : ContainerInterface(),
+    bits_per_sample_(PCM_16),
+    initialized_(false),
+    header_seekable_(false),
+    header_position_(0),
+    header_size_(0),
+    data_size_(0),
+    input_(),
+    channels_(),
+    output_()
+{
+  // Nothing to do
+}
+
+WaveContainer::~WaveContainer()
+{
+  finish();
+}
+
+void WaveContainer::finishStream(void)
+{
+  // Chunks are word aligned, so an odd sized data chunk gets a pad byte.
+  if (data_size_ % 2 != 0) {
+    const uint8_t pad = 0;
+    writeOutput(&pad, 1);
+  }
+  patchHeader();
+  initialized_ = false;
+}
+
+void WaveContainer::setSampleFormat(int bits_per_sample)
+{
+  assert(!initialized_);
+  assert(bits_per_sample == PCM_16
+         || bits_per_sample == PCM_24
+         || bits_per_sample == FLOAT_32);
+  bits_per_sample_ = bits_per_sample;
+}
+
+void WaveContainer::init(uint32_t sample_rate, uint8_t channel_count, int serial)
+{
+  // Any sampling rate is fine, so the check for Opus is skipped.
+  initTracks(sample_rate, channel_count, serial);
+
+  input_.assign(kMaxInputLength * channel_count, 0.0f);
+  channels_.resize(channel_count);
+  for (uint8_t ch = 0; ch < channel_count; ch++) {
+    channels_[ch] = &input_[ch * kMaxInputLength];
+  }
+  output_.assign(kMaxInputLength * channel_count * (bits_per_sample_ / 8), 0);
+
+  OutputSink *sink = getOutputSink();
+  header_seekable_ = sink->seekable();
+  header_position_ = header_seekable_ ? sink->position() : 0;
+
+  uint8_t header[kMaxHeaderSize];
+  header_size_ = writeWaveHeader(header, kUnknownSize);
+  writeOutput(header, header_size_);
+  data_size_ = 0;
+  initialized_ = true;
+}
+
+int WaveContainer::addTrack(uint8_t channel_count, int serial)
+{
+  assert(false); // WAV has a single track
+  return -1;
+}
+
+void WaveContainer::writeTrackFrame(int track, void *data, std::size_t size,
+                                    int num_samples)
+{
+  assert(initialized_);
+  assert(track == 0);
+  stats_.frames++;
+  writeOutput(data, size);
+  data_size_ += size;
+}
+
+float *WaveContainer::getInputBuffer(uint8_t channel)
+{
+  assert(channel < channel_count_);
+  return &input_[channel * kMaxInputLength];
+}
+
+uint32_t WaveContainer::getMaxInputLength() const
+{
+  return kMaxInputLength;
+}
+
+void WaveContainer::writeSamples(uint32_t length)
+{
+  assert(initialized_);
+  assert(length <= kMaxInputLength);
+  switch (bits_per_sample_) {
+    case PCM_16:
+      PcmConvert::toInt16(channels_.data(), channel_count_, length,
+                          reinterpret_cast<int16_t *>(output_.data()));
+      break;
+    case PCM_24:
+      PcmConvert::toInt24(channels_.data(), channel_count_, length,
+                          output_.data());
+      break;
+    case FLOAT_32:
+      PcmConvert::toFloat32(channels_.data(), channel_count_, length,
+                            reinterpret_cast<float *>(output_.data()));
+      break;
+  }
+  std::size_t size = length * channel_count_ * (bits_per_sample_ / 8);
+  stats_.frames++;
+  writeOutput(output_.data(), size);
+  data_size_ += size;
+}
+
+std::size_t WaveContainer::writeWaveHeader(uint8_t *header, uint32_t data_size)
+{
+  /**
+   * @brief Header format, all numbers little endian:
+   *
+   *    Offset  Size  Field
+   *    0       4     'RIFF'
+   *    4       4     Size of everything after this field
+   *    8       4     'WAVE'
+   *    12      4     'fmt '
+   *    16      4     Size of the fmt chunk: 16, 18 for float, 40 extensible
+   *    20      2     Format tag: 1 for PCM, 3 for IEEE float, 0xFFFE extensible
+   *    22      2     Channel count
+   *    24      4     Sample rate
+   *    28      4     Byte rate (sample rate * block align)
+   *    32      2     Block align (channel count * bytes per sample)
+   *    34      2     Bits per sample
+   *    36      2     Extension size: 0 for float, 22 extensible
+   *    38      2     Valid bits per sample (extensible only)
+   *    40      4     Channel mask (extensible only)
+   *    44      16    Sub format GUID, starting with the format tag (extensible only)
+   *    ...     12    'fact' chunk with the number of sample frames (float only)
+   *    ...     4     'data'
+   *    ...     4     Size of the data chunk
+   *
+   *    The extensible format is used for more than 2 channels or more than
+   *    16 bits of PCM, as the reference requires. It gives the speaker of
+   *    each channel. Headers are 44, 58, 68 or 80 bytes long.
+   */
+  assert(header);
+  bool is_float = bits_per_sample_ == FLOAT_32;
+  uint16_t block_align = channel_count_ * (bits_per_sample_ / 8);
+  std::size_t size = 0;
+  auto putTag = [&](const char *tag) {
+    memcpy(header + size, tag, 4);
+    size += 4;
+  };
+  auto put32 = [&](uint32_t value) {
+    memcpy(header + size, &value, sizeof(uint32_t));
+    size += sizeof(uint32_t);
+  };
+  auto put16 = [&](uint16_t value) {
+    memcpy(header + size, &value, sizeof(uint16_t));
+    size += sizeof(uint16_t);
+  };
+
+  bool extensible = channel_count_ > 2 || (!is_float && bits_per_sample_ > 16);
+  uint16_t format = is_float ? kFormatIeeeFloat : kFormatPcm;
+  std::size_t fmt_size = extensible ? 40 : is_float ? 18 : 16;
+  const std::size_t header_size = 28 + fmt_size + (is_float ? 12 : 0);
+  bool known = data_size != kUnknownSize;
+  putTag("RIFF");
+  put32(known ? header_size - 8 + data_size + (data_size % 2) : kUnknownSize);
+  putTag("WAVE");
+  putTag("fmt ");
+  put32(fmt_size);
+  put16(extensible ? kFormatExtensible : format);
+  put16(channel_count_);
+  put32(sample_rate_);
+  put32(sample_rate_ * block_align);
+  put16(block_align);
+  put16(bits_per_sample_);
+  if (extensible) {
+    put16(22);
+    put16(bits_per_sample_);
+    put32(kChannelMasks[channel_count_ - 1]);
+    put16(format);
+    memcpy(header + size, kSubFormatGuid, sizeof(kSubFormatGuid));
+    size += sizeof(kSubFormatGuid);
+  } else if (is_float) {
+    put16(0);
+  }
+  if (is_float) {
+    // Every format other than PCM needs a fact chunk
+    putTag("fact");
+    put32(4);
+    put32(known ? data_size / block_align : kUnknownSize);
+  }
+  putTag("data");
+  put32(data_size);
+  assert(size == header_size);
+  return size;
+}
+
+void WaveContainer::patchHeader(void)
+{
+  OutputSink *sink = getOutputSink();
+  if (!header_seekable_) {
+    return;
+  }
+  uint64_t end = sink->position();
+  if (!sink->seek(header_position_)) {
+    return; // Already handed over, e.g. the arena was flushed meanwhile
+  }
+  // Sizes above 4 GiB cannot be represented, keep them unknown
+  uint32_t data_size = data_size_ < kUnknownSize - kMaxHeaderSize
+                         ? (uint32_t)data_size_ : kUnknownSize;
+  uint8_t header[kMaxHeaderSize];
+  std::size_t size = writeWaveHeader(header, data_size);
+  assert(size == header_size_);
+  // Over bytes already counted in the stats, so not with writeOutput().
+  sink->write(header, size);
+  sink->seek(end);
+}
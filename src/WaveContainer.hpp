@@ -0,0 +1,128 @@
+#ifndef WAVECONTAINER_H_
+#define WAVECONTAINER_H_
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include "ContainerInterface.hpp"
+
+/**
+ * @brief WAV (RIFF WAVE) Container class
+ *
+ * ## Reference
+ *
+ *    WAVE: http://www-mmsp.ece.mcgill.ca/Documents/AudioFormats/WAVE/WAVE.html
+ *
+ * ## File organization
+ *
+ *    +------+------+------+-------------+---------------+-------------------+
+ *    | RIFF | size | WAVE | fmt chunk   | fact chunk    | data chunk        |
+ *    |      |      |      |             | (float only)  | size, samples ... |
+ *    +------+------+------+-------------+---------------+-------------------+
+ *
+ *    The header is written by init() with every size set to 0xFFFFFFFF, the
+ *    usual mark of a WAV stream of unknown length. When the container is
+ *    destroyed the sizes are patched in place if the output sink can still
+ *    seek back to the header, e.g. a MemoryOutputSink that has not been
+ *    cleared since, or a regular file.
+ *
+ * ## How to use
+ *
+ *    1. Instantiate, optionally setSampleFormat().
+ *    2. Call init() with the input sample rate. There is no resampling.
+ *    3. Copy up to getMaxInputLength() samples of each channel to
+ *       getInputBuffer(channel), then call writeSamples() with the number of
+ *       samples. They are converted by PcmConvert.
+ *    4. Destroy it, or call finish() or reset(), to finish the file.
+ */
+class WaveContainer
+  : public ContainerInterface
+{
+public:
+  enum SampleFormat {
+    PCM_16 = 16,
+    PCM_24 = 24,
+    FLOAT_32 = 32
+  };
+
+  WaveContainer();
+  ~WaveContainer();
+
+  /**
+   * @brief Choose the sample format. Call it before init().
+   *
+   * @param bits_per_sample   One of SampleFormat. The default is PCM_16.
+   */
+  void setSampleFormat(int bits_per_sample);
+
+  /**
+   * @brief Write the header.
+   *
+   * @param sample_rate     Sampling rate of the input, any rate
+   * @param channel_count   The number of channels, up to 8
+   * @param serial          Not used by WAV
+   */
+  void init(uint32_t sample_rate, uint8_t channel_count, int serial) override;
+
+  /**
+   * @brief WAV has a single track. Must not be called.
+   */
+  int addTrack(uint8_t channel_count, int serial) override;
+
+  /**
+   * @brief Write samples that are already interleaved in the sample format.
+   *
+   * @param track         Must be 0
+   * @param data          A pointer to the samples
+   * @param size          Byte size of the samples
+   * @param num_samples   Not used
+   */
+  void writeTrackFrame(int track, void *data, std::size_t size,
+                       int num_samples) override;
+
+  /**
+   * @brief Planar input buffer of a channel, getMaxInputLength() samples long.
+   */
+  float *getInputBuffer(uint8_t channel);
+  uint32_t getMaxInputLength() const;
+
+  /**
+   * @brief Convert and write the samples copied to the input buffers. Each
+   *        call counts as a frame in getStats().
+   *
+   * @param length    The number of samples per channel, up to getMaxInputLength()
+   */
+  void writeSamples(uint32_t length);
+
+protected:
+  void finishStream(void) override;
+
+private:
+  // The same as BUFFER_SIZE of OpusMediaRecorder.js
+  static const uint32_t kMaxInputLength = 4096;
+  // Sizes not known yet
+  static const uint32_t kUnknownSize = 0xFFFFFFFF;
+
+  uint16_t bits_per_sample_;
+  bool initialized_;
+  bool header_seekable_;      // Whether header_position_ is valid
+  uint64_t header_position_;  // Sink position of the first byte of the header
+  std::size_t header_size_;
+  uint64_t data_size_;        // Bytes in the data chunk so far
+
+  std::vector<float> input_;            // Planar, kMaxInputLength per channel
+  std::vector<const float *> channels_; // Pointers into input_
+  std::vector<uint8_t> output_;         // Interleaved samples
+
+  /**
+   * @brief Fill the header.
+   *
+   * @param header          At least 80 bytes
+   * @param data_size       Byte size of the data chunk, or kUnknownSize
+   * @return std::size_t    The size of the header
+   */
+  std::size_t writeWaveHeader(uint8_t *header, uint32_t data_size);
+  void patchHeader(void);
+};
+
+#endif /* WAVECONTAINER_H_ */
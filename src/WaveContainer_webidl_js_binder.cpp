@@ -0,0 +1,8 @@
+/**
+ * Reference: https://kripken.github.io/emscripten-site/docs/porting/connecting_cpp_and_javascript/WebIDL-Binder.html#compiling-the-project-using-the-bindings-glue-code
+ * This is a requriement by Emscripten to bind C++ classes with JS.
+ */
+
+#include "WaveContainer.hpp"
+// This is an auto-generated code by Emscripten located in /build directory.
+#include "WaveContainer.webidl_glue.cpp"
@@ -1,125 +1,199 @@
-const { writeString } = require('./commonFunctions.js');
+// Initial capacity of the output arena. It grows when a flush needs more.
+const OUTPUT_ARENA_CAPACITY = 64 * 1024;
 
-const BYTES_PER_SAMPLE = Int16Array.BYTES_PER_ELEMENT; // This means 16-bit wav file.
+// Room above encoderOptions.outputHighWaterMark for the output of the encode()
+// crossing it: 4096 samples of 8 channels of 32 bits, the largest block of
+// OpusMediaRecorder.
+const OUTPUT_ARENA_HEADROOM = 128 * 1024;
 
-class WaveEncoder {
+// Bits per sample WaveContainer can write. 32 means IEEE float.
+const WAVE_BIT_DEPTHS = [16, 24, 32];
+
+class _WaveEncoder {
   /**
    * Contructor
    */
-  constructor (inputSampleRate, channelCount, bitsPerSecond) {
+  constructor (inputSampleRate, channelCount, bitsPerSecond = undefined, options = {}) {
     this.config = {
-      inputSampleRate,
+      inputSampleRate, // WAV keeps the input sampling rate.
       channelCount
     };
-    this.encodedBuffers = [];
+
+    // Output is collected in the WASM heap until flush() is called. The RIFF
+    // header is patched with the final sizes when the container is finished,
+    // which only reaches the header if it has not been flushed yet, i.e. when
+    // the recording is taken in one piece. Otherwise sizes stay 0xFFFFFFFF.
+    this._output = new Module.MemoryOutputSink();
+    this._reserveOutput(options);
+    // Peak of the bytes allocated in the WASM heap, sampled after each encode()
+    this._heapUsage = new Module.HeapUsage();
+    // WAV container imported using WebIDL binding
+    this._container = new Module.WaveContainer();
+    this._container.setOutputSink(this._output);
+    this._initContainer(inputSampleRate, channelCount, options);
   }
 
   /**
-   * Encode buffers and then store.
-   * @param {Float32Array[]} channelBuffers - original array of Float32Array.buffer
-   *                                         from inputBuffer.getChannelData().
+   * Convert planar channel buffers to interleaved PCM, a single call to WASM
+   * per block.
+   * @param {Float32Array[]} buffers - One buffer per channel.
    */
-  encode (channelBuffers) {
-    const length = channelBuffers[0].length; // Number of frames, in other words, the length of each channelBuffers.
-    const encodedBuffer = new ArrayBuffer(length * BYTES_PER_SAMPLE * this.config.channelCount);
-    const encodedView = new DataView(encodedBuffer);
-
-    // Convert Float32 to Int16
-    for (let ch = 0; ch < this.config.channelCount; ch++) {
-      let channelSamples = channelBuffers[ch];
-
-      for (let i = 0; i < length; i++) {
-        // Clamp value
-        let sample = (channelSamples[i] * 0x7FFF) | 0;
-        if (sample > 0x7FFF) {
-          sample = 0x7FFF | 0;
-        } else if (sample < -0x8000) {
-          sample = -0x8000 | 0;
-        }
-        // Then store
-        const offset = (i * this.config.channelCount + ch) * BYTES_PER_SAMPLE;
-        encodedView.setInt16(offset, sample | 0, true);
+  encode (buffers) {
+    const length = buffers[0].length;
+
+    for (let offset = 0; offset < length; offset += this.maxInputLength) {
+      const blockLength = Math.min(this.maxInputLength, length - offset);
+      for (let ch = 0; ch < this.config.channelCount; ch++) {
+        Module.HEAPF32.set(buffers[ch].subarray(offset, offset + blockLength),
+                           this.mInputPointers[ch] >> 2);
       }
+      this._container.writeSamples(blockLength);
+    }
+    this._heapUsage.sample();
+  }
+
+  /**
+   * Take the output produced so far. The header can no longer get the final
+   * sizes once it has been taken, see the constructor.
+   * @return {ArrayBuffer[]} - Empty, or one buffer with all bytes since the last call.
+   */
+  flush () {
+    const size = this._output.size();
+    if (size === 0) {
+      return [];
     }
-    this.encodedBuffers.push(encodedBuffer);
+    const pointer = this._output.data();
+    const buffer = Module.HEAPU8.slice(pointer, pointer + size).buffer;
+    this._output.clear();
+    return [buffer];
+  }
+
+  /**
+   * Bytes the next flush() would take.
+   * @return {number}
+   */
+  getTakeableBytes () {
+    return this._output.size();
   }
 
   /**
-   * Create and return a header buffer.
+   * Counters for monitoring. See OpusMediaRecorder.requestStats().
+   * @return {Object}
    */
-  getHeader () {
-    /**
-     * Get stored encoding result with Wave file format header
-     * Reference: http://www-mmsp.ece.mcgill.ca/Documents/AudioFormats/WAVE/WAVE.html
-     */
-    // Create header data
-    let dataLength = this.encodedBuffers.reduce((acc, cur) => acc + cur.byteLength, 0);
-    let header = new ArrayBuffer(44);
-    let view = new DataView(header);
-    // RIFF identifier 'RIFF'
-    writeString(view, 0, 'RIFF');
-    // file length minus RIFF identifier length and file description length
-    view.setUint32(4, 36 + dataLength, true);
-    // RIFF type 'WAVE'
-    writeString(view, 8, 'WAVE');
-    // format chunk identifier 'fmt '
-    writeString(view, 12, 'fmt ');
-    // format chunk length
-    view.setUint32(16, 16, true);
-    // sample format (raw)
-    view.setUint16(20, 1, true);
-    // channel count
-    view.setUint16(22, this.config.channelCount, true);
-    // sample rate
-    view.setUint32(24, this.config.inputSampleRate, true);
-    // byte rate (sample rate * block align)
-    view.setUint32(28, this.config.inputSampleRate * BYTES_PER_SAMPLE * this.config.channelCount, true);
-    // block align (channel count * bytes per sample)
-    view.setUint16(32, BYTES_PER_SAMPLE * this.config.channelCount, true);
-    // bits per sample
-    view.setUint16(34, 8 * BYTES_PER_SAMPLE, true);
-    // data chunk identifier 'data'
-    writeString(view, 36, 'data');
-    // data chunk length
-    view.setUint32(40, dataLength, true);
-
-    return header;
+  getStats () {
+    const container = this._container.getStats();
+    return {
+      frames: container.frames,
+      bytes: container.bytes,
+      pages: container.pages,
+      clusters: container.clusters,
+      pendingBytes: this._output.size(),
+      heapInUse: this._heapUsage.sample(),
+      heapPeak: this._heapUsage.getPeak(),
+      memorySize: Module.HEAPU8.length,
+      tracks: []
+    };
+  }
+
+  /**
+   * End the recording but keep the container for reset(). Patches the header.
+   */
+  finish () {
+    this._container.finish();
+  }
+
+  /**
+   * Start a new recording after finish(), with the same arguments as the
+   * constructor.
+   */
+  reset (inputSampleRate, channelCount, bitsPerSecond = undefined, options = {}) {
+    this.config = { inputSampleRate, channelCount };
+    this._reserveOutput(options);
+    this._initContainer(inputSampleRate, channelCount, options);
+  }
+
+  /**
+   * Destroying the container patches the header. The output arena is kept so
+   * the last flush() can collect it.
+   */
+  close () {
+    Module.destroy(this._container);
+    Module.destroy(this._heapUsage);
+  }
+
+  /**
+   * Size the output arena, so with a high-water mark it is allocated once.
+   * See _OpusEncoder._reserveOutput().
+   */
+  _reserveOutput (options) {
+    const { outputHighWaterMark } = options;
+    this._output.reserve(outputHighWaterMark
+      ? outputHighWaterMark + OUTPUT_ARENA_HEADROOM
+      : OUTPUT_ARENA_CAPACITY);
+  }
+
+  /**
+   * Initialize the container for a recording and take its input buffers.
+   */
+  _initContainer (inputSampleRate, channelCount, options) {
+    const bitDepth = options.waveBitDepth || 16;
+    if (!WAVE_BIT_DEPTHS.includes(bitDepth)) {
+      throw new Error(`Unsupported WAV bit depth: ${bitDepth}`);
+    }
+    this._container.setSampleFormat(bitDepth);
+    this._container.init(inputSampleRate, channelCount, 0);
+
+    // Planar input buffers in the WASM heap. Keep pointers instead of typed
+    // array views, because views are detached when the heap grows.
+    this.maxInputLength = this._container.getMaxInputLength();
+    this.mInputPointers = [];
+    for (let ch = 0; ch < channelCount; ch++) {
+      this.mInputPointers.push(this._container.getInputBuffer(ch));
+    }
   }
 }
 
+// Emscripten (wasm) Module. Module is globally defined after compiled by emcc.
+/* global Module */
+
 /**
- * As the name states, it emulates Emscripten module behavior.
- * @param {EmscriptenModule} Module
+ * Define the encoder module interface. The worker will interact with
+ * the encoder via those functions only.
  */
-function emscriptenModuleEmulator (Module) {
-  return new Promise(function (resolve, reject) {
-    Module = typeof Module !== 'undefined' ? (Module || {})
-                                           : {};
-
-    /**
-     * Define the encoder module interface. The worker will interact with
-     * the encoder via those functions only.
-     */
-    Module.init = function (inputSampleRate, channelCount, bitsPerSecond) {
-      Module.encoder = new WaveEncoder(inputSampleRate, channelCount, bitsPerSecond);
-    };
+Module.init = function (inputSampleRate, channelCount, bitsPerSecond, options = {}) {
+  if (Module.encoder) {
+    // A reused worker: the last recording ended with finish().
+    Module.encoder.reset(inputSampleRate, channelCount, bitsPerSecond, options);
+    return;
+  }
+  Module.encoder = new _WaveEncoder(inputSampleRate, channelCount, bitsPerSecond, options);
+};
 
-    Module.encode = function (buffers) {
-      Module.encoder.encode(buffers);
-    };
+Module.encode = function (buffers) {
+  Module.encoder.encode(buffers);
+};
 
-    Module.flush = function () {
-      let header = Module.encoder.getHeader();
-      let body = Module.encoder.encodedBuffers.splice(0, Module.encoder.encodedBuffers.length);
-      return [header, ...body];
-    };
+Module.flush = function () {
+  return Module.encoder.flush();
+};
 
-    Module.close = function () {
-      // Nothing to do.
-    };
+Module.getTakeableBytes = function () {
+  return Module.encoder.getTakeableBytes();
+};
 
-    resolve(Module);
-  });
-}
+Module.getStats = function () {
+  return Module.encoder.getStats();
+};
+
+Module.finish = function () {
+  Module.encoder.finish();
+};
+
+Module.close = function () {
+  Module.encoder.close();
+};
 
-module.exports = emscriptenModuleEmulator;
+/**
+ * Export is automatically done by emcc with "-s MODULARIZE=1" option.
+ */
+// module.exports = Module;
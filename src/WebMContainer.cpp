@@ -1,100 +1,544 @@
+#include <algorithm>
 #include <cassert>
 #include "WebMContainer.hpp"
-#include "emscriptenImport.hpp"
+#include "lib/webm/common/webmids.h"
 
-Container::Container()
+namespace {
+  // A packet holds at most 120 ms, or 48 frames. See RFC 6716 section 3.2.5.
+  const int kMaxPackedSamples = 5760;
+  const int kMaxPackedFrames = 48;
+  // Longest frame, RFC 6716 section 3.4 requirement R2
+  const std::size_t kMaxFrameSize = 1275;
+
+  // Samples per frame of the configuration of a TOC byte, RFC 6716 section 3.1
+  int frameSamples(uint8_t toc)
+  {
+    int config = toc >> 3;
+    if (config < 12) {
+      // SILK-only, 10 to 60 ms
+      return config % 4 == 3 ? 2880 : 480 << (config % 4);
+    }
+    if (config < 16) {
+      return 480 << (config % 2);   // Hybrid, 10 or 20 ms
+    }
+    return 120 << (config % 4);     // CELT-only, 2.5 to 20 ms
+  }
+
+  // Read a frame length of 1 or 2 bytes. Returns the bytes used, 0 if cut short.
+  std::size_t readFrameLength(const uint8_t *data, std::size_t size,
+                              std::size_t *length)
+  {
+    if (size < 1) {
+      return 0;
+    }
+    if (data[0] < 252) {
+      *length = data[0];
+      return 1;
+    }
+    if (size < 2) {
+      return 0;
+    }
+    *length = data[0] + 4 * data[1];
+    return 2;
+  }
+
+  std::size_t writeFrameLength(uint8_t *data, std::size_t length)
+  {
+    if (length < 252) {
+      data[0] = length;
+      return 1;
+    }
+    data[0] = 252 + (length & 3);
+    data[1] = (length - data[0]) >> 2;
+    return 2;
+  }
+
+  /**
+   * Split a single stream Opus packet into its frames, see RFC 6716 section
+   * 3.2. Padding is dropped.
+   *
+   * @return int    The number of frames, or -1 if the packet is invalid
+   */
+  int splitPacket(const uint8_t *packet, std::size_t size,
+                  const uint8_t **frames, std::size_t *sizes)
+  {
+    if (size < 1) {
+      return -1;
+    }
+    const uint8_t *p = packet + 1;
+    const uint8_t *end = packet + size;
+    int count = 0;
+    switch (packet[0] & 3) {
+      case 0:   // One frame
+        count = 1;
+        sizes[0] = end - p;
+        break;
+      case 1:   // Two frames of the same size
+        if ((end - p) % 2 != 0) {
+          return -1;
+        }
+        count = 2;
+        sizes[0] = sizes[1] = (end - p) / 2;
+        break;
+      case 2: { // Two frames, the size of the first one given
+        std::size_t used = readFrameLength(p, end - p, &sizes[0]);
+        if (used == 0 || sizes[0] > (std::size_t)(end - p) - used) {
+          return -1;
+        }
+        p += used;
+        count = 2;
+        sizes[1] = (end - p) - sizes[0];
+        break;
+      }
+      default: { // A frame count byte: VBR, padding and M frames
+        if (p == end) {
+          return -1;
+        }
+        uint8_t frame_count = *p++;
+        count = frame_count & 0x3F;
+        if (count == 0 || count > kMaxPackedFrames) {
+          return -1;
+        }
+        if (frame_count & 0x40) {
+          // Each 255 is 254 bytes of padding and one more length byte.
+          std::size_t padding = 0;
+          uint8_t length;
+          do {
+            if (p == end) {
+              return -1;
+            }
+            length = *p++;
+            padding += length == 255 ? 254 : length;
+          } while (length == 255);
+          if (padding > (std::size_t)(end - p)) {
+            return -1;
+          }
+          end -= padding;
+        }
+        if (frame_count & 0x80) {
+          // The size of every frame but the last one
+          std::size_t total = 0;
+          for (int i = 0; i + 1 < count; i++) {
+            std::size_t used = readFrameLength(p, end - p, &sizes[i]);
+            if (used == 0) {
+              return -1;
+            }
+            p += used;
+            total += sizes[i];
+          }
+          if (total > (std::size_t)(end - p)) {
+            return -1;
+          }
+          sizes[count - 1] = (end - p) - total;
+        } else {
+          if ((end - p) % count != 0) {
+            return -1;
+          }
+          for (int i = 0; i < count; i++) {
+            sizes[i] = (end - p) / count;
+          }
+        }
+        break;
+      }
+    }
+    for (int i = 0; i < count; i++) {
+      if (sizes[i] > kMaxFrameSize) {
+        return -1;
+      }
+      frames[i] = p;
+      p += sizes[i];
+    }
+    return count;
+  }
+
+  // Samples a packet holds, from its TOC byte and frame count. 0 if invalid.
+  int packetSamples(const uint8_t *packet, std::size_t size)
+  {
+    if (size < 1) {
+      return 0;
+    }
+    int count = 1;
+    switch (packet[0] & 3) {
+      case 1:
+      case 2:
+        count = 2;
+        break;
+      case 3:
+        count = size < 2 ? 0 : packet[1] & 0x3F;
+        break;
+    }
+    return count * frameSamples(packet[0]);
+  }
+}
+
+WebMContainer::WebMContainer()
   : ContainerInterface(),
     position_(0),
-    timestamp_(0),
-    track_number_(0)
+    segment_(),
+    segment_tracks_(),
+    interleaver_(&arena_),
+    seekable_(false),
+    spooling_(false),
+    spool_(),
+    sink_origin_(0),
+    block_samples_(0),
+    max_block_samples_(0),
+    max_cluster_samples_(0),
+    pack_toc_(0),
+    pack_samples_(0),
+    pack_data_(),
+    pack_sizes_(),
+    block_()
 {
-  // Init the segment
-  segment_.Init(this);
-  segment_.set_mode(mkvmuxer::Segment::kLive);
-  segment_.OutputCues(false); // This is live streams so cues may not be feasible
+  // The segment is made by init()
+}
 
-  // Write segment info
-  mkvmuxer::SegmentInfo* const info = segment_.GetSegmentInfo();
-  info->set_writing_app("opus-media-recorder");
-  info->set_muxing_app("opus-media-recorder");
+WebMContainer::~WebMContainer()
+{
+  finish();
 }
 
-Container::~Container()
+void WebMContainer::finishStream(void)
 {
-  segment_.Finalize();
+  // Write the frames still waiting for other tracks
+  while (const FrameInterleaver::Frame *frame = interleaver_.front(true)) {
+    writeBlock(frame->track, frame->data.data(), frame->data.size(),
+               frame->num_samples);
+    interleaver_.pop();
+  }
+  flushPackedBlock();
+  segment_->Finalize();
+  if (spooling_) {
+    writeOutput(spool_.data(), spool_.size());
+    spool_.clear();
+    spooling_ = false;
+  }
+  segment_.reset();
+  segment_tracks_.clear();
+  interleaver_.setTrackCount(1);
 }
 
-void Container::init(uint32_t sample_rate, uint8_t channel_count, int serial)
+void WebMContainer::init(uint32_t sample_rate, uint8_t channel_count, int serial)
 {
   ContainerInterface::init(sample_rate, channel_count, serial);
+  createSegment();
+  if (max_cluster_samples_ > 0) {
+    // In nanoseconds, 48 kHz samples are 62500 / 3 ns each.
+    segment_->set_max_cluster_duration(max_cluster_samples_ * 62500ull / 3);
+  }
+
+  if (seekable_) {
+    spooling_ = !getOutputSink()->seekable();
+    sink_origin_ = spooling_ ? spool_.position() : getOutputSink()->position();
+    segment_->set_mode(mkvmuxer::Segment::kFile);
+    segment_->OutputCues(true);
+  } else {
+    segment_->set_mode(mkvmuxer::Segment::kLive);
+    segment_->OutputCues(false); // This is live streams so cues may not be feasible
+  }
+
+  // Add the first track.
+  segment_tracks_.clear();
+  addSegmentTrack(0);
+  if (seekable_) {
+    // Cues only point to the video track by default
+    segment_->CuesTrack(segment_tracks_[0].number);
+  }
+}
+
+int WebMContainer::addTrack(uint8_t channel_count, int serial)
+{
+  assert(stats_.frames == 0); // Tracks must be added before the first frame
+  int track = ContainerInterface::addTrack(channel_count, serial);
+  addSegmentTrack(track);
+  interleaver_.setTrackCount(segment_tracks_.size());
+  return track;
+}
 
-  // Add a track.
-  // TODO: support for multiple tracks
-  addTrack();
+void WebMContainer::setTrackHeader(int track, const IdHeader &header)
+{
+  assert(stats_.frames == 0); // The track header is written before any frame
+  ContainerInterface::setTrackHeader(track, header);
+  setCodecPrivate(track);
+  mkvmuxer::Track *segment_track =
+      segment_->GetTrackByNumber(segment_tracks_[track].number);
+  // In nanoseconds, 48 kHz samples are 62500 / 3 ns each.
+  segment_track->set_codec_delay(header.pre_skip * 62500ull / 3);
 }
 
-void Container::writeFrame(void *data, std::size_t size, int num_samples)
+void WebMContainer::writeTrackFrame(int track, void *data, std::size_t size,
+                                    int num_samples)
 {
   assert(data);
+  assert(track >= 0 && track < (int)segment_tracks_.size());
+  stats_.frames++;
+  queueBlock(track, data, size, num_samples);
+}
+
+void WebMContainer::writeTrackGap(int track, int num_samples)
+{
+  assert(track >= 0 && track < (int)segment_tracks_.size());
+  // An empty block, so the interleaver keeps the other tracks in order.
+  queueBlock(track, nullptr, 0, num_samples);
+}
+
+void WebMContainer::queueBlock(int track, const void *data, std::size_t size,
+                               int num_samples)
+{
+  if (segment_tracks_.size() == 1) {
+    writeBlock(0, data, size, num_samples);
+    return;
+  }
+
+  // mkvmuxer rejects frames older than the current cluster, so frames of all
+  // tracks have to be added in timestamp order.
+  SegmentTrack &segment_track = segment_tracks_[track];
+  interleaver_.push(track, segment_track.queued_samples, data, size, num_samples);
+  segment_track.queued_samples += num_samples;
+  while (const FrameInterleaver::Frame *frame = interleaver_.front()) {
+    writeBlock(frame->track, frame->data.data(), frame->data.size(),
+               frame->num_samples);
+    interleaver_.pop();
+  }
+}
+
+void WebMContainer::writeBlock(int track, const void *data, std::size_t size,
+                               int num_samples)
+{
+  if (size == 0) {
+    // A gap, see writeTrackGap()
+    flushPackedBlock();
+    SegmentTrack &segment_track = segment_tracks_[track];
+    segment_track.written_samples += num_samples;
+    updateSamples(segment_track.written_samples);
+    return;
+  }
+  // Multistream packets are self-delimited and several tracks would have
+  // to be interleaved block by block, so only a single stream is packed.
+  if (max_block_samples_ > 0 && segment_tracks_.size() == 1
+      && tracks_[0].mapping.stream_count == 1) {
+    packBlock(data, size, num_samples);
+    return;
+  }
+  addBlock(track, data, size, num_samples);
+}
+
+void WebMContainer::packBlock(const void *data, std::size_t size,
+                              int num_samples)
+{
+  const uint8_t *packet = static_cast<const uint8_t *>(data);
+  const uint8_t *frames[kMaxPackedFrames];
+  std::size_t sizes[kMaxPackedFrames];
+  int count = splitPacket(packet, size, frames, sizes);
+  // A trimmed packet, i.e. the last one, keeps its own block so the decoded
+  // length of the others stays their duration.
+  bool whole = count > 0 && num_samples == count * frameSamples(packet[0]);
+  // Frames of a packet share the configuration of its TOC byte.
+  if (!whole || (packet[0] & 0xFC) != pack_toc_
+      || pack_sizes_.size() + count > (std::size_t)kMaxPackedFrames
+      || pack_samples_ + num_samples > (int)max_block_samples_) {
+    flushPackedBlock();
+  }
+  if (!whole) {
+    addBlock(0, data, size, num_samples);
+    return;
+  }
+
+  pack_toc_ = packet[0] & 0xFC;
+  for (int i = 0; i < count; i++) {
+    pack_data_.insert(pack_data_.end(), frames[i], frames[i] + sizes[i]);
+    pack_sizes_.push_back(sizes[i]);
+  }
+  pack_samples_ += num_samples;
+  if (pack_samples_ >= (int)max_block_samples_) {
+    flushPackedBlock();
+  }
+}
+
+void WebMContainer::flushPackedBlock(void)
+{
+  if (pack_sizes_.empty()) {
+    return;
+  }
+  int count = pack_sizes_.size();
+  block_.clear();
+  if (count == 1) {
+    block_.push_back(pack_toc_);          // Code 0, one frame
+  } else {
+    // Code 3 VBR: the size of every frame but the last one, then the frames.
+    block_.push_back(pack_toc_ | 3);
+    block_.push_back(0x80 | count);
+    for (int i = 0; i + 1 < count; i++) {
+      uint8_t length[2];
+      block_.insert(block_.end(), length,
+                    length + writeFrameLength(length, pack_sizes_[i]));
+    }
+  }
+  block_.insert(block_.end(), pack_data_.begin(), pack_data_.end());
+  int samples = pack_samples_;
+  pack_data_.clear();
+  pack_sizes_.clear();
+  pack_samples_ = 0;
+  addBlock(0, block_.data(), block_.size(), samples);
+}
+
+void WebMContainer::addBlock(int track, const void *data, std::size_t size,
+                             int num_samples)
+{
+  SegmentTrack &segment_track = segment_tracks_[track];
   // TODO: calculate paused time???
-  uint64_t timestamp = ((uint64_t)(num_samples * 1000000ull)) / (uint64_t)sample_rate_;
-  // uint64_t timestamp = 20 * 1000;
+  // Converted from the sample count every time instead of adding up frame
+  // durations, so frames of any size, e.g. 2.5 ms or an odd trimmed one, never
+  // drift. Split in whole seconds and the rest, so days of audio do not
+  // overflow. mkvmuxer rounds each one to the timecode scale on its own.
+  uint64_t samples = segment_track.written_samples;
+  uint64_t timestamp = samples / sample_rate_ * 1000000000ull
+                       + samples % sample_rate_ * 1000000000ull / sample_rate_;
+
+  // A chunk starts with a cluster, listed when mkvmuxer writes it.
+  block_samples_ = samples;
+  if (!seekable_ && chunkDue(samples)) {
+    segment_->ForceNewClusterOnNextFrame();
+  }
+  const uint8_t *bytes = static_cast<const uint8_t *>(data);
+  int packet_samples = packetSamples(bytes, size);
+  if (num_samples < packet_samples) {
+    // A trimmed packet, the last one of an Ogg stream being remuxed. The
+    // decoder drops the DiscardPadding, in nanoseconds, from its end.
+    mkvmuxer::Frame frame;
+    bool ok = frame.Init(bytes, size);
+    assert(ok);  // Out of memory
+    frame.set_track_number(segment_track.number);
+    frame.set_timestamp(timestamp);
+    frame.set_is_key(true);
+    frame.set_discard_padding((int64_t)(packet_samples - num_samples) * 62500 / 3);
+    segment_->AddGenericFrame(&frame);
+  } else {
+    segment_->AddFrame(bytes, size, segment_track.number, timestamp,
+                       true); /* is_key: -- always true for audio */
+  }
+  segment_track.written_samples += num_samples;
+  updateSamples(segment_track.written_samples);
+}
+
+void WebMContainer::updateSamples(uint64_t samples)
+{
+  if (samples > stats_.samples) {
+    stats_.samples = samples;
+  }
+}
+
+std::size_t WebMContainer::arenaSize(void) const
+{
+  // A single track is written without the interleaver.
+  return ContainerInterface::arenaSize() + interleaverArenaSize(kInterleavedSamples);
+}
+
+void WebMContainer::setBlockDuration(uint32_t max_block_samples)
+{
+  assert(pack_sizes_.empty());
+  max_block_samples_ = std::min<uint32_t>(max_block_samples, kMaxPackedSamples);
+}
+
+void WebMContainer::setMaxClusterDuration(uint32_t max_cluster_samples)
+{
+  max_cluster_samples_ = max_cluster_samples;
+}
 
-  segment_.AddFrame(reinterpret_cast<const uint8_t*>(data),
-                    size, track_number_, timestamp_ * 1000,
-                    true); /* is_key: -- always true for audio */
-  timestamp_ += timestamp;
+void WebMContainer::setSeekable(bool seekable)
+{
+  seekable_ = seekable;
 }
 
-mkvmuxer::int32 Container::Write(const void* buf, mkvmuxer::uint32 len) {
-  emscriptenPushBuffer(buf, len);
+mkvmuxer::int32 WebMContainer::Write(const void* buf, mkvmuxer::uint32 len) {
+  if (spooling_) {
+    spool_.write(buf, len);
+  } else {
+    writeOutput(buf, len);
+  }
   position_ += len;
   return 0;
 }
 
-mkvmuxer::int64 Container::Position() const
+mkvmuxer::int64 WebMContainer::Position() const
 {
   return position_;
 }
 
-mkvmuxer::int32 Container::Position(mkvmuxer::int64 position)
+mkvmuxer::int32 WebMContainer::Position(mkvmuxer::int64 position)
 {
-  // Is not Seekable() so it always returns fail
-  return -1;
+  if (!seekable_ || position < 0) {
+    return -1;
+  }
+  OutputSink *sink = spooling_ ? &spool_ : getOutputSink();
+  if (!sink->seek(sink_origin_ + position)) {
+    return -1;
+  }
+  position_ = position;
+  return 0;
 }
 
-bool Container::Seekable() const
+bool WebMContainer::Seekable() const
 {
-  return false;
+  return seekable_;
 }
 
-void Container::ElementStartNotify(mkvmuxer::uint64 element_id,
-                                   mkvmuxer::int64 position)
+void WebMContainer::ElementStartNotify(mkvmuxer::uint64 element_id,
+                                       mkvmuxer::int64 position)
 {
-  // TODO: Not used in this project, not sure if I should do something here.
-  return;
+  // mkvmuxer notifies every element ID it writes
+  if (element_id == libwebm::kMkvCluster) {
+    stats_.clusters++;
+    // See writeBlock(). mkvmuxer may start clusters on its own as well, those
+    // stay within a chunk.
+    if (!seekable_ && chunkDue(block_samples_)) {
+      startChunk(block_samples_);
+    }
+  }
 }
 
-void Container::addTrack(void)
+void WebMContainer::createSegment(void)
 {
-  track_number_ = segment_.AddAudioTrack(sample_rate_, channel_count_, 0);
-  assert(track_number_ > 0); // Init failed
+  position_ = 0;
+  segment_.reset(new mkvmuxer::Segment());
+  segment_->Init(this);
+
+  // Write segment info
+  mkvmuxer::SegmentInfo* const info = segment_->GetSegmentInfo();
+  info->set_writing_app("opus-media-recorder");
+  info->set_muxing_app("opus-media-recorder");
+}
+
+void WebMContainer::addSegmentTrack(int track)
+{
+  uint64_t track_number = segment_->AddAudioTrack(sample_rate_,
+                                                 tracks_[track].channel_count, 0);
+  assert(track_number > 0); // Init failed
+  segment_tracks_.push_back(SegmentTrack{track_number, 0, 0});
 
   mkvmuxer::AudioTrack* const audio_track =
       reinterpret_cast<mkvmuxer::AudioTrack*>(
-          segment_.GetTrackByNumber(track_number_));
+          segment_->GetTrackByNumber(track_number));
 
   // Audio data is always pcm_float32le.
   audio_track->set_bit_depth(32u);
   audio_track->set_codec_id(mkvmuxer::Tracks::kOpusCodecId);
-
-  uint8_t opus_header[OpusIdHeaderType::SIZE];
-  writeOpusIdHeader(opus_header);
-
-  // Init failed
-  assert(audio_track->SetCodecPrivate(opus_header, OpusIdHeaderType::SIZE));
+  setCodecPrivate(track);
 
   // Segment's timestamps should be in milliseconds
   // See http://www.webmproject.org/docs/container/#muxer-guidelines
-  assert(1000000ull == segment_.GetSegmentInfo()->timecode_scale());
+  assert(1000000ull == segment_->GetSegmentInfo()->timecode_scale());
+}
+
+void WebMContainer::setCodecPrivate(int track)
+{
+  // With more than 2 channels CodecPrivate carries the channel mapping table.
+  uint8_t opus_header[OpusIdHeaderType::MAX_SIZE];
+  std::size_t opus_header_size = writeOpusIdHeader(opus_header, track);
+
+  // Not inside assert(), which is compiled out with NDEBUG
+  bool result = segment_->GetTrackByNumber(segment_tracks_[track].number)
+                    ->SetCodecPrivate(opus_header, opus_header_size);
+  assert(result); // Init failed
+  (void)result;
 }
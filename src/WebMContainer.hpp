@@ -3,27 +3,86 @@
 
 #include <cstdint>
 #include <cstddef>
+#include <memory>
+#include <vector>
 #include "lib/webm/mkvmuxer.hpp"
 #include "ContainerInterface.hpp"
+#include "FrameInterleaver.hpp"
 
-class Container
-  : protected ContainerInterface,
+class WebMContainer
+  : public ContainerInterface,
     public mkvmuxer::IMkvWriter
 {
   public:
     /**
-     * @brief Construct a new Ogg Container object
+     * @brief Construct a new WebM Container object
      *
      * @param sample_rate     Sampling rate of the stream
-     * @param channel_count   The number of channels of the stream the maxium is 2.
+     * @param channel_count   The number of channels of the stream, up to 8.
      * @param serial          Uniqute number of the stream. Usually a random number.
      */
-    Container();
-    ~Container();
+    WebMContainer();
+    ~WebMContainer();
 
     void init(uint32_t sample_rate, uint8_t channel_count, int serial) override;
 
-    void writeFrame(void *data, std::size_t size, int num_samples) override;
+    int addTrack(uint8_t channel_count, int serial) override;
+
+    /**
+     * @brief Also sets CodecDelay to the pre-skip, which WebM players use
+     *        instead of the one in CodecPrivate.
+     */
+    void setTrackHeader(int track, const IdHeader &header) override;
+
+    void writeTrackFrame(int track, void *data, std::size_t size,
+                         int num_samples) override;
+
+    /**
+     * @brief A gap in the block timestamps of the track, which decoders
+     *        conceal. Nothing is written.
+     */
+    void writeTrackGap(int track, int num_samples) override;
+
+    /**
+     * @brief Write Cues, Duration and the segment size when the stream ends,
+     *        so players can seek without scanning the file. Call before init().
+     *
+     *        mkvmuxer has to go back and patch the beginning of the file for
+     *        this. If the output sink can seek (e.g. a file descriptor of a
+     *        regular file) the output is written through it. Otherwise the
+     *        whole output is spooled in memory and handed to the sink at the
+     *        end, so nothing comes out while recording.
+     *
+     * @param seekable    false (default) writes a live stream
+     */
+    void setSeekable(bool seekable);
+
+    /**
+     * @brief Pack consecutive packets into one block, up to max_block_samples
+     *        (at 48 kHz) each, to save the header of a block per packet. Call
+     *        before init().
+     *
+     *        mkvmuxer cannot lace, so the frames of the packets are put in a
+     *        single Opus packet of several frames instead, which decoders read
+     *        the same way. Packets of another mode or bandwidth, trimmed ones
+     *        and gaps start a new block. Only a single track of one stream is
+     *        packed. Blocks are written once full, which delays the output by
+     *        up to their duration.
+     *
+     * @param max_block_samples   0 (default) writes a block per packet. At most
+     *                            5760, or 120 ms.
+     */
+    void setBlockDuration(uint32_t max_block_samples);
+
+    /**
+     * @brief Start a new cluster after max_cluster_samples (at 48 kHz). Longer
+     *        clusters save their headers, shorter ones let players join or seek
+     *        a live stream sooner. Call before init().
+     *
+     * @param max_cluster_samples   0 (default) keeps the choice of mkvmuxer,
+     *                              about 30 seconds.
+     */
+    void setMaxClusterDuration(uint32_t max_cluster_samples);
 
     // IMkvWriter interface.
     mkvmuxer::int32 Write(const void *buf, mkvmuxer::uint32 len) override;
@@ -33,15 +92,49 @@ class Container
     void ElementStartNotify(mkvmuxer::uint64 element_id,
                             mkvmuxer::int64 position) override;
 
+  protected:
+    void finishStream(void) override;
+    std::size_t arenaSize(void) const override;
+
   private:
-    void addTrack(void);
+    struct SegmentTrack {
+      uint64_t number;          // Track number in the segment
+      uint64_t written_samples; // Start of the next block, in samples
+      uint64_t queued_samples;  // End of the last frame queued in the interleaver
+    };
+
+    void createSegment(void);
+    void addSegmentTrack(int track);
+    void setCodecPrivate(int track);
+    void queueBlock(int track, const void *data, std::size_t size, int num_samples);
+    void writeBlock(int track, const void *data, std::size_t size, int num_samples);
+    void packBlock(const void *data, std::size_t size, int num_samples);
+    void flushPackedBlock(void);
+    void addBlock(int track, const void *data, std::size_t size, int num_samples);
+    void updateSamples(uint64_t samples);
 
     // Rolling counter of the position in bytes of the written goo.
     mkvmuxer::int64 position_;
-    // The MkvMuxer active element.
-    mkvmuxer::Segment segment_;
-    uint64_t timestamp_;
-    uint64_t track_number_;
+    // The MkvMuxer active element. A new one is made by every init(),
+    // because a finalized segment cannot be reused.
+    std::unique_ptr<mkvmuxer::Segment> segment_;
+    std::vector<SegmentTrack> segment_tracks_;
+    FrameInterleaver interleaver_;
+    // See setSeekable()
+    bool seekable_;
+    bool spooling_;
+    MemoryOutputSink spool_;
+    uint64_t sink_origin_;  // Sink position of the first byte of the segment
+    uint64_t block_samples_;  // Start of the block being added, for chunks
+    // See setBlockDuration() and setMaxClusterDuration()
+    uint32_t max_block_samples_;
+    uint32_t max_cluster_samples_;
+    // Frames of the packets waiting to be packed in a block
+    uint8_t pack_toc_;                    // Their TOC byte, without the code
+    int pack_samples_;
+    std::vector<uint8_t> pack_data_;      // Back to back
+    std::vector<std::size_t> pack_sizes_;
+    std::vector<uint8_t> block_;          // The packed packet
 };
 
 #endif /* WEBMCONTAINER_H_ */
@@ -4,5 +4,6 @@
  */
 
 #include "WebMContainer.hpp"
+#include "EncoderPipeline.hpp"
 // This is an auto-generated code by Emscripten located in /build directory.
-#include "Container.webidl_glue.cpp"
\ No newline at end of file
+#include "WebMContainer.webidl_glue.cpp"
\ No newline at end of file
@@ -0,0 +1,198 @@
+#include "WebMReader.hpp"
+#include <algorithm>
+#include <cassert>
+#include <climits>
+#include <cstring>
+
+WebMReader::WebMReader()
+  : ContainerReader(),
+    segment_(),
+    track_numbers_(),
+    track_samples_(),
+    track_started_(),
+    cluster_(nullptr),
+    cluster_started_(false),
+    block_entry_(nullptr),
+    frame_index_(0),
+    frame_()
+{
+  // Nothing to do
+}
+
+WebMReader::~WebMReader()
+{
+  // Nothing to do
+}
+
+int WebMReader::open(const void *data, std::size_t size)
+{
+  assert(data || size == 0);
+  segment_.reset();
+  tracks_.clear();
+  track_numbers_.clear();
+  track_samples_.clear();
+  track_started_.clear();
+  cluster_ = nullptr;
+  data_ = static_cast<const uint8_t *>(data);
+  size_ = size;
+
+  // Non-zero is an error, or a truncated file.
+  long long position = 0;
+  mkvparser::EBMLHeader ebml_header;
+  if (ebml_header.Parse(this, position) != 0) {
+    return ERR_INVALID_DATA;
+  }
+  mkvparser::Segment *segment = nullptr;
+  if (mkvparser::Segment::CreateInstance(this, position, segment) != 0) {
+    return ERR_INVALID_DATA;
+  }
+  segment_.reset(segment);
+  // Live streams from WebMContainer have unknown sizes, which is fine as the
+  // whole file is there.
+  if (segment_->Load() < 0) {
+    return ERR_INVALID_DATA;
+  }
+
+  const mkvparser::Tracks *tracks = segment_->GetTracks();
+  if (!tracks) {
+    return ERR_INVALID_DATA;
+  }
+  for (unsigned long i = 0; i < tracks->GetTracksCount(); i++) {
+    const mkvparser::Track *track = tracks->GetTrackByIndex(i);
+    if (!track || track->GetType() != mkvparser::Track::kAudio
+        || !track->GetCodecId() || strcmp(track->GetCodecId(), "A_OPUS") != 0) {
+      continue;
+    }
+    std::size_t codec_private_size = 0;
+    const unsigned char *codec_private = track->GetCodecPrivate(codec_private_size);
+    ContainerInterface::IdHeader header;
+    if (!ContainerInterface::parseOpusIdHeader(codec_private, codec_private_size,
+                                               &header)) {
+      return ERR_UNSUPPORTED;
+    }
+    // In nanoseconds, 48 kHz samples are 62500 / 3 ns each.
+    unsigned long long codec_delay = track->GetCodecDelay();
+    if (codec_delay > 0) {
+      header.pre_skip = std::min(65535ull, (codec_delay * 3 + 31250) / 62500);
+    }
+    tracks_.push_back(header);
+    track_numbers_.push_back(track->GetNumber());
+    track_samples_.push_back(0);
+    track_started_.push_back(false);
+  }
+  if (tracks_.empty()) {
+    return ERR_NOT_OPUS;
+  }
+
+  cluster_ = segment_->GetFirst();
+  cluster_started_ = false;
+  block_entry_ = nullptr;
+  frame_index_ = 0;
+  return OK;
+}
+
+int WebMReader::readPacket(Packet *packet)
+{
+  assert(packet);
+  while (true) {
+    if (!cluster_ || cluster_->EOS()) {
+      return 0;
+    }
+    if (!cluster_started_) {
+      if (cluster_->GetFirst(block_entry_) < 0) {
+        return ERR_INVALID_DATA;
+      }
+      cluster_started_ = true;
+      frame_index_ = 0;
+    }
+    if (!block_entry_ || block_entry_->EOS()) {
+      cluster_ = segment_->GetNext(cluster_);
+      cluster_started_ = false;
+      continue;
+    }
+
+    // A laced block has several frames, each an Opus packet.
+    const mkvparser::Block *block = block_entry_->GetBlock();
+    int track = findTrack(block->GetTrackNumber());
+    if (track < 0 || frame_index_ >= block->GetFrameCount()) {
+      if (cluster_->GetNext(block_entry_, block_entry_) < 0) {
+        return ERR_INVALID_DATA;
+      }
+      frame_index_ = 0;
+      continue;
+    }
+    const mkvparser::Block::Frame &frame = block->GetFrame(frame_index_++);
+    if (frame.len <= 0) {
+      return ERR_INVALID_DATA;
+    }
+    frame_.resize(frame.len);
+    if (frame.Read(this, frame_.data()) < 0) {
+      return ERR_INVALID_DATA;
+    }
+    int samples = packetSamples(frame_.data(), frame_.size());
+    if (samples < 0) {
+      return ERR_INVALID_DATA;
+    }
+
+    packet->track = track;
+    packet->data = frame_.data();
+    packet->size = frame_.size();
+    packet->num_samples = samples;
+    packet->gap_samples = 0;
+    // Frames of a laced block follow each other, only a block can have a gap.
+    if (frame_index_ == 1) {
+      int64_t start = (block->GetTime(cluster_) * 3 + 31250) / 62500;
+      if (!track_started_[track]) {
+        // The first block is the origin, whatever its timestamp.
+        track_started_[track] = true;
+        track_samples_[track] = start;
+      }
+      int64_t gap = start - track_samples_[track];
+      if (gap >= kMinGapSamples) {
+        packet->gap_samples = std::min<int64_t>(gap, INT_MAX);
+        track_samples_[track] += packet->gap_samples;
+      }
+    }
+    track_samples_[track] += samples;
+    // DiscardPadding, in nanoseconds, trims the end of the last frame.
+    long long discard_padding = block->GetDiscardPadding();
+    if (discard_padding > 0 && frame_index_ == block->GetFrameCount()) {
+      long long discarded = (discard_padding * 3 + 31250) / 62500;
+      packet->num_samples = std::max(0ll, samples - discarded);
+    }
+    return 1;
+  }
+}
+
+int WebMReader::Read(long long position, long length, unsigned char *buffer)
+{
+  if (position < 0 || length < 0
+      || (unsigned long long)position + length > size_) {
+    return -1;
+  }
+  if (length > 0) {
+    memcpy(buffer, data_ + position, length);
+  }
+  return 0;
+}
+
+int WebMReader::Length(long long *total, long long *available)
+{
+  if (total) {
+    *total = size_;
+  }
+  if (available) {
+    *available = size_;
+  }
+  return 0;
+}
+
+int WebMReader::findTrack(long long track_number) const
+{
+  for (std::size_t i = 0; i < track_numbers_.size(); i++) {
+    if (track_numbers_[i] == track_number) {
+      return i;
+    }
+  }
+  return -1;
+}
@@ -0,0 +1,59 @@
+#ifndef WEBMREADER_H_
+#define WEBMREADER_H_
+
+#include <cstdint>
+#include <cstddef>
+#include <memory>
+#include <vector>
+#include "lib/webm/mkvparser/mkvparser.h"
+#include "ContainerReader.hpp"
+
+/**
+ * @brief Reads the Opus tracks of a WebM file with the mkvparser of libwebm.
+ *
+ *    Each A_OPUS audio track is a track, in the order of the Tracks element.
+ *    Other tracks are skipped. The ID header of a track is its CodecPrivate,
+ *    with the pre-skip taken from CodecDelay when it is set, as Matroska
+ *    players do.
+ *
+ *    The DiscardPadding of the last block of a track is kept as the
+ *    num_samples of its last packet. A block starting 2.5 ms or more after
+ *    the end of the previous one of its track has the difference as the
+ *    gap_samples of its first packet, up to INT_MAX. Shorter differences are
+ *    taken as timestamps rounded to the timecode scale. The first block of a
+ *    track is its origin, so a track starting late has no gap before it.
+ */
+class WebMReader
+  : public ContainerReader,
+    public mkvparser::IMkvReader
+{
+public:
+  WebMReader();
+  ~WebMReader();
+
+  int open(const void *data, std::size_t size) override;
+  int readPacket(Packet *packet) override;
+
+  // IMkvReader interface, over the memory given to open().
+  int Read(long long position, long length, unsigned char *buffer) override;
+  int Length(long long *total, long long *available) override;
+
+private:
+  std::unique_ptr<mkvparser::Segment> segment_;
+  // Shortest gap kept, 2.5 ms at 48 kHz
+  static const long long kMinGapSamples = 120;
+
+  std::vector<long long> track_numbers_;  // Track number of each track
+  std::vector<long long> track_samples_;  // End of the last packet of each track
+  std::vector<bool> track_started_;       // A block of the track was read
+  // Position of the next frame
+  const mkvparser::Cluster *cluster_;
+  bool cluster_started_;
+  const mkvparser::BlockEntry *block_entry_;
+  int frame_index_;
+  std::vector<uint8_t> frame_;            // The last packet read
+
+  int findTrack(long long track_number) const;
+};
+
+#endif /* WEBMREADER_H_ */
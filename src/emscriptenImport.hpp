@@ -8,6 +8,7 @@ EM_JS(void, emscriptenPushBuffer, (const void* buf, int len), {
   // Create a Typed Array
   let array = new Uint8Array(Module.HEAPU8.buffer, buf, len);
   // Then copy and queue
+  Module.encodedBuffers = Module.encodedBuffers || [];
   Module.encodedBuffers.push(new Uint8Array(array).buffer);
 });
 
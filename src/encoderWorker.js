@@ -1,18 +1,95 @@
+// Milliseconds between reads of the input ring, well under its capacity.
+const INPUT_POLL_INTERVAL = 10;
+
 function initWorker (workerGlobalScope) {
+  const InputRing = require('./InputRing.js');
   const WaveEncoder = require('./WaveEncoder.js');
   const WebMOpusEncoder = require('./WebMOpusEncoder.js');
   const OggOpusEncoder = require('./OggOpusEncoder.js');
+  const OggWebMOpusEncoder = require('./OggWebMOpusEncoder.js');
 
   let encoder;
+  // The combined module needs it to pick its container.
+  let encoderMimeType;
+  // encoderOptions.outputHighWaterMark of the recording, 0 if unbounded
+  let outputHighWaterMark = 0;
+  // Whether the output is handed over in chunks, see encoderOptions.chunkDuration
+  let chunked = false;
+
+  // Input from the AudioWorklet of the recorder, see InputRing.js. null when
+  // the input comes as 'pushInputData' messages instead.
+  let inputRing = null;
+  let inputTimer = null;
+  // With the ring the worker hands data over every timeslice by itself.
+  let timesliceFrames = 0;
+  let framesSinceData = 0;
+
+  /**
+   * Take the output of the encoder.
+   * @return {{buffers: ArrayBuffer[], header: ?boolean, chunks: ?Object[]}}
+   */
+  function takeOutput () {
+    return chunked ? encoder.flushChunks() : { buffers: encoder.flush() };
+  }
+
+  /**
+   * Hand the output off once what can be taken reaches the mark. Only whole
+   * chunks can be taken, and nothing of a seekable WebM before it ends.
+   */
+  function checkHighWaterMark () {
+    if (outputHighWaterMark > 0 &&
+        encoder.getTakeableBytes() >= outputHighWaterMark) {
+      const output = takeOutput();
+      self.postMessage(Object.assign({ command: 'encodedData', highWaterMark: true },
+                                     output), output.buffers);
+    }
+  }
+
+  /**
+   * Encode what the AudioWorklet has written to the input ring so far,
+   * straight from the ring.
+   */
+  function readInput () {
+    if (!inputRing) {
+      return;
+    }
+    const frames = inputRing.read(channelBuffers => encoder.encode(channelBuffers));
+    if (frames === 0) {
+      return;
+    }
+    checkHighWaterMark();
+    framesSinceData += frames;
+    if (framesSinceData >= timesliceFrames) {
+      framesSinceData = 0;
+      const output = takeOutput();
+      self.postMessage(Object.assign({ command: 'encodedData' }, output),
+                       output.buffers);
+    }
+  }
+
+  /**
+   * Stop reading the input ring, after reading what is left in it.
+   */
+  function closeInput () {
+    readInput();
+    clearInterval(inputTimer);
+    inputRing = null;
+    inputTimer = null;
+  }
 
   workerGlobalScope.onmessage = function (e) {
     const { command } = e.data;
     switch (command) {
       case 'loadEncoder':
-        const { mimeType, wasmPath } = e.data;
+        const { mimeType, wasmPath, combined } = e.data;
+        encoderMimeType = mimeType;
         // Setting encoder module
         let encoderModule;
-        switch (mimeType) {
+        switch (combined ? 'combined' : mimeType) {
+          case 'combined':
+            encoderModule = OggWebMOpusEncoder;
+            break;
+
           case 'audio/wav':
           case 'audio/wave':
             encoderModule = WaveEncoder;
@@ -42,12 +119,31 @@ function initWorker (workerGlobalScope) {
         break;
 
       case 'init':
-        const { sampleRate, channelCount, bitsPerSecond } = e.data;
-        encoder.init(sampleRate, channelCount, bitsPerSecond);
+        const { sampleRate, channelCount, bitsPerSecond, encoderOptions } = e.data;
+        encoder.init(sampleRate, channelCount, bitsPerSecond, encoderOptions,
+                     encoderMimeType);
+        outputHighWaterMark = (encoderOptions && encoderOptions.outputHighWaterMark) || 0;
+        // WAV has no chunks.
+        chunked = !!(encoderOptions && encoderOptions.chunkDuration > 0 &&
+                     encoder.flushChunks);
+        if (e.data.inputRingBuffer) {
+          inputRing = new InputRing(e.data.inputRingBuffer);
+          timesliceFrames = e.data.timeslice * sampleRate;
+          framesSinceData = 0;
+          inputTimer = setInterval(readInput, INPUT_POLL_INTERVAL);
+        }
+        break;
+
+      case 'addTrack':
+        // Only Ogg and WebM can hold several tracks, added before the first
+        // 'pushInputData'. Nothing is posted back: tracks get the indices 1,
+        // 2, ... in the order they are added.
+        const { trackChannelCount, trackSampleRate } = e.data;
+        encoder.addTrack(trackChannelCount, trackSampleRate);
         break;
 
       case 'pushInputData':
-        const { channelBuffers, length, duration } = e.data; // eslint-disable-line
+        const { channelBuffers, length, duration, track } = e.data; // eslint-disable-line
         // On Chrome, Float32Array doesn't recognize its buffer after
         // being transferred, making the size of ArrayBuffer 0.
         // This bug is found in Chrome 66.0.3359.181 (2018).
@@ -57,22 +153,62 @@ function initWorker (workerGlobalScope) {
           channelBuffers[i] = new Float32Array(channelBuffers[i].buffer);
         }
 
-        encoder.encode(channelBuffers);
+        encoder.encode(channelBuffers, track);
+        checkHighWaterMark();
+        break;
+
+      case 'setFrameDuration':
+        // WAV has no frames to change.
+        if (encoder.setFrameDuration) {
+          encoder.setFrameDuration(e.data.frameDuration);
+        }
+        break;
+
+      case 'setControls':
+        // WAV has no encoder to control.
+        if (encoder.setControls) {
+          encoder.setControls(e.data.controls);
+        }
+        break;
+
+      case 'getStats':
+        readInput();
+        const stats = encoder.getStats();
+        if (inputRing) {
+          stats.droppedInputFrames = inputRing.getDroppedFrames();
+        }
+        self.postMessage({ command: 'stats', stats });
         break;
 
       case 'getEncodedData':
       case 'done':
+        // Everything the AudioWorklet has written belongs to this data.
+        readInput();
+        framesSinceData = 0;
+        // A reused worker keeps the encoder warm for the next 'init' instead
+        // of closing, so the next recording needs no WASM instantiation.
+        const { reuse } = e.data;
         if (command === 'done') {
-          encoder.close();
+          closeInput();
+          if (reuse) {
+            encoder.finish();
+          } else {
+            encoder.close();
+          }
         }
 
-        const buffers = encoder.flush();
-        self.postMessage({
-          command: command === 'done' ? 'lastEncodedData' : 'encodedData',
-          buffers
-        }, buffers);
+        const output = takeOutput();
+        const transfer = output.buffers.slice();
+        // The Ogg seek index comes with the end of the recording.
+        if (command === 'done' && encoder.getSeekIndex && encoder.getSeekIndex()) {
+          output.seekIndex = encoder.getSeekIndex();
+          transfer.push(output.seekIndex);
+        }
+        self.postMessage(Object.assign({
+          command: command === 'done' ? 'lastEncodedData' : 'encodedData'
+        }, output), transfer);
 
-        if (command === 'done') {
+        if (command === 'done' && !reuse) {
           self.close();
         }
         break;
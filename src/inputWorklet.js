@@ -0,0 +1,64 @@
+/**
+ * AudioWorklet module of OpusMediaRecorder: copies the input of its node into
+ * the InputRing read by the encoder worker, on the audio thread. It is added
+ * with audioWorklet.addModule() as it is, so unlike the other files it is not
+ * bundled and requires nothing. See workerOptions.useAudioWorklet.
+ */
+
+// The layout of InputRing.js: keep them in sync.
+const WRITE_INDEX = 0;
+const READ_INDEX = 1;
+const DROPPED_FRAMES = 2;
+const CHANNEL_COUNT = 3;
+const HEADER_BYTES = 16;
+
+class OpusMediaRecorderInput extends AudioWorkletProcessor {
+  /**
+   * @param {Object} options
+   * @param {SharedArrayBuffer} options.processorOptions.buffer - The buffer
+   *        of the InputRing.
+   */
+  constructor (options) {
+    super();
+    const { buffer } = options.processorOptions;
+    this._header = new Int32Array(buffer, 0, HEADER_BYTES / 4);
+    const channelCount = this._header[CHANNEL_COUNT];
+    this._capacity = (buffer.byteLength - HEADER_BYTES) / 4 / channelCount;
+    this._planes = [];
+    for (let ch = 0; ch < channelCount; ch++) {
+      this._planes.push(new Float32Array(buffer, HEADER_BYTES + ch * this._capacity * 4,
+                                         this._capacity));
+    }
+  }
+
+  process (inputs) {
+    const input = inputs[0];
+    // Nothing connected, e.g. while paused
+    if (input.length === 0) {
+      return true;
+    }
+    const length = input[0].length;
+    const write = Atomics.load(this._header, WRITE_INDEX);
+    const used = (write - Atomics.load(this._header, READ_INDEX)) >>> 0;
+    // Never wait on the audio thread: a block that does not fit is dropped.
+    if (this._capacity - used < length) {
+      Atomics.add(this._header, DROPPED_FRAMES, length);
+      return true;
+    }
+    const start = (write >>> 0) % this._capacity;
+    const first = Math.min(length, this._capacity - start);
+    for (let ch = 0; ch < this._planes.length; ch++) {
+      // The node mixes to the channel count of the ring, this is a fallback.
+      const samples = input[Math.min(ch, input.length - 1)];
+      this._planes[ch].set(samples.subarray(0, first), start);
+      if (first < length) {
+        this._planes[ch].set(samples.subarray(first), 0);
+      }
+    }
+    // Published after the samples, so the reader never sees a partial block.
+    Atomics.store(this._header, WRITE_INDEX, (write + length) | 0);
+    return true;
+  }
+}
+
+registerProcessor('opus-media-recorder-input', OpusMediaRecorderInput);
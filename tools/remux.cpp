@@ -0,0 +1,162 @@
+/**
+ * @brief Remux Opus between Ogg and WebM without decoding it, e.g.
+ *
+ *      remux recording.webm recording.opus
+ *
+ *    The input format is detected from its first bytes, the output format
+ *    from its extension: .webm and .mka are WebM, anything else is Ogg. A
+ *    WebM output to a regular file gets Cues and a Duration. An Ogg output
+ *    can get a seek index sidecar, see OggContainer::writeSeekIndex():
+ *
+ *      remux recording.webm recording.opus recording.opus.idx
+ *
+ *    See "make remux".
+ */
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include "ContainerInterface.hpp"
+#include "ContainerReader.hpp"
+#include "OggContainer.hpp"
+#include "WebMContainer.hpp"
+
+namespace {
+  bool endsWith(const std::string &text, const char *suffix)
+  {
+    std::size_t length = strlen(suffix);
+    return text.size() >= length
+           && text.compare(text.size() - length, length, suffix) == 0;
+  }
+
+  bool readFile(const char *path, std::vector<uint8_t> &data)
+  {
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+      return false;
+    }
+    uint8_t buffer[64 * 1024];
+    std::size_t size;
+    while ((size = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+      data.insert(data.end(), buffer, buffer + size);
+    }
+    bool ok = !ferror(file);
+    fclose(file);
+    return ok;
+  }
+
+  // A seek point per second
+  const uint32_t kSeekIndexInterval = 48000;
+
+  const char *errorMessage(int error)
+  {
+    switch (error) {
+      case ContainerReader::ERR_INVALID_DATA:
+        return "invalid or truncated file";
+      case ContainerReader::ERR_NOT_OPUS:
+        return "no Opus track";
+      case ContainerReader::ERR_UNSUPPORTED:
+        return "unsupported file, e.g. a chained Ogg stream";
+    }
+    return "unknown error";
+  }
+}
+
+int main(int argc, char *argv[])
+{
+  if (argc != 3 && argc != 4) {
+    fprintf(stderr, "Usage: %s <input.ogg|.opus|.webm> <output.ogg|.opus|.webm>"
+                    " [<seek index of an Ogg output>]\n",
+            argv[0]);
+    return 2;
+  }
+
+  std::vector<uint8_t> data;
+  if (!readFile(argv[1], data)) {
+    perror(argv[1]);
+    return 1;
+  }
+  // 'OggS' or the EBML magic 0x1A45DFA3
+  ContainerInterface::Format input_format;
+  if (data.size() >= 4 && memcmp(data.data(), "OggS", 4) == 0) {
+    input_format = ContainerInterface::FORMAT_OGG;
+  } else if (data.size() >= 4 && memcmp(data.data(), "\x1A\x45\xDF\xA3", 4) == 0) {
+    input_format = ContainerInterface::FORMAT_WEBM;
+  } else {
+    fprintf(stderr, "%s: neither Ogg nor WebM\n", argv[1]);
+    return 1;
+  }
+  std::string output_path = argv[2];
+  ContainerInterface::Format output_format =
+      endsWith(output_path, ".webm") || endsWith(output_path, ".mka")
+      ? ContainerInterface::FORMAT_WEBM
+      : ContainerInterface::FORMAT_OGG;
+  const char *index_path = argc == 4 ? argv[3] : nullptr;
+  if (index_path && output_format != ContainerInterface::FORMAT_OGG) {
+    fprintf(stderr, "%s: only Ogg outputs have a seek index\n", index_path);
+    return 2;
+  }
+
+  std::unique_ptr<ContainerReader> reader(ContainerReader::create(input_format));
+  int result = reader->open(data.data(), data.size());
+  if (result != ContainerReader::OK) {
+    fprintf(stderr, "%s: %s\n", argv[1], errorMessage(result));
+    return 1;
+  }
+
+  int fd = open(argv[2], O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    perror(argv[2]);
+    return 1;
+  }
+  int write_error;
+  MemoryOutputSink index;
+  {
+    FileDescriptorOutputSink sink(fd);
+    std::unique_ptr<ContainerInterface> container(ContainerInterface::create(output_format));
+    container->setOutputSink(&sink);
+    if (output_format == ContainerInterface::FORMAT_WEBM) {
+      static_cast<WebMContainer *>(container.get())->setSeekable(true);
+    }
+    if (index_path) {
+      static_cast<OggContainer *>(container.get())->setSeekIndexInterval(kSeekIndexInterval);
+    }
+    // Any serial will do, this one is stable across runs.
+    result = reader->remux(container.get(), 0x4F707573);
+    if (index_path) {
+      container->finish();
+      static_cast<OggContainer *>(container.get())->writeSeekIndex(&index);
+    }
+    container.reset();
+    sink.flush();
+    write_error = sink.error();
+  }
+  close(fd);
+  if (result != ContainerReader::OK) {
+    fprintf(stderr, "%s: %s\n", argv[1], errorMessage(result));
+    return 1;
+  }
+  if (write_error != 0) {
+    fprintf(stderr, "%s: %s\n", argv[2], strerror(write_error));
+    return 1;
+  }
+
+  if (index_path) {
+    FILE *file = fopen(index_path, "wb");
+    bool ok = file && fwrite(index.data(), 1, index.size(), file) == index.size();
+    if (file && fclose(file) != 0) {
+      ok = false;
+    }
+    if (!ok) {
+      perror(index_path);
+      return 1;
+    }
+  }
+
+  fprintf(stderr, "%s: %d track(s) written\n", argv[2], reader->getTrackCount());
+  return 0;
+}